@@ -21,10 +21,76 @@
 #include <cstdint>
 #include <cstring>
 #include <functional>
-#include <queue>
+#include <new>
 
 #include "Particle.h"
 
+/**
+ * @brief Token bucket that limits the rate of publishes
+ *
+ * @details Holds up to a burst of tokens and gains one token each interval.
+ * Tokens build up while nothing is published so the full burst is available
+ * when publishing resumes.
+ */
+class PublishTokenBucket {
+public:
+    PublishTokenBucket(unsigned int burst, system_tick_t interval) :
+        _burst {burst},
+        _interval {interval},
+        _tokens {burst},
+        _last {millis()} {}
+
+    /**
+     * @brief Take a token if one is available
+     *
+     * @param[in] now current time [milliseconds]
+     *
+     * @return TRUE if a token was taken, FALSE if not
+     */
+    bool take(system_tick_t now)
+    {
+        refill(now);
+        if (!_tokens) {
+            return false;
+        }
+        _tokens--;
+        return true;
+    }
+
+    /**
+     * @brief Time until a token is available
+     *
+     * @param[in] now current time [milliseconds]
+     *
+     * @return Time to wait, zero if a token is available now [milliseconds]
+     */
+    system_tick_t wait_time(system_tick_t now)
+    {
+        refill(now);
+        return (_tokens) ? 0u : (_interval - (now - _last));
+    }
+
+private:
+    void refill(system_tick_t now)
+    {
+        if (_tokens >= _burst) {
+            // A full bucket doesn't save up time towards the next token
+            _last = now;
+            return;
+        }
+        auto gained {(now - _last) / _interval};
+        if (gained) {
+            _last += gained * _interval;
+            _tokens = (gained >= (_burst - _tokens)) ? _burst : (_tokens + gained);
+        }
+    }
+
+    unsigned int _burst;
+    system_tick_t _interval;
+    unsigned int _tokens;
+    system_tick_t _last;
+};
+
 template<std::size_t NumQueues = 2u>
 class BackgroundPublish {
 public:
@@ -32,6 +98,20 @@ public:
         const char *event_name,
         const char *event_data)>;
 
+    /**
+     * @brief Time spent waiting in one queue by the events taken from it
+     */
+    struct publish_stats_t {
+        std::uint32_t published;    ///< events taken from the queue to publish
+        std::uint32_t wait_last;    ///< wait of the most recent event [milliseconds]
+        std::uint32_t wait_max;     ///< longest wait [milliseconds]
+        std::uint64_t wait_total;   ///< sum of all waits [milliseconds]
+    };
+
+    static constexpr unsigned int burst_limit {4u};         ///< publishes allowed back to back, as Device OS allows
+    static constexpr system_tick_t token_interval {1000u};  ///< time to regain one publish, 1/s on average [milliseconds]
+    static constexpr std::size_t max_in_flight {4u};        ///< most publishes that can be outstanding at once
+
     template<typename Context>
     using publish_callback_with_context = std::function<void(particle::Error status,
         const char *event_name,
@@ -50,9 +130,18 @@ public:
      *
      * @details NUM_OF_QUEUES determines how many queues get created. Each queue
      * has a priority level determined by its index in the _queues vector. The
-     * lower the index, the higher the priority
+     * lower the index, the higher the priority. Event slots, about 1.1KB
+     * each, are allocated as they are first needed and then reused for the
+     * life of the publisher, so the heap used follows the most events ever
+     * held at once, up to max_slots
+     *
+     * @param[in] max_entries number of events each queue can hold
+     * @param[in] max_slots most event slots to allocate, zero for one for
+     * every queue entry, each publish in flight and one claimed
      */
-    BackgroundPublish(std::size_t max_entries = 8u) : running {false}, _thread(), maxEntries {max_entries}  {}
+    BackgroundPublish(std::size_t max_entries = 8u, std::size_t max_slots = 0u);
+
+    ~BackgroundPublish();
 
     /**
      * @brief Start the publisher
@@ -198,6 +287,55 @@ public:
                                  std::placeholders::_2, std::placeholders::_3, context));
     }
 
+    /**
+     * @brief Claim an event slot so that its data can be written in place
+     *
+     * @details Hands out the data buffer of a free slot so that a producer
+     * can format the event directly into it and avoid copying the data in
+     * publish(). Only one slot can be claimed at a time. The claimed slot
+     * is given back by commit() or release().
+     *
+     * @return Buffer of MAX_EVENT_DATA_LENGTH + 1 bytes, nullptr if a slot
+     * is already claimed or none are free
+     */
+    char* claim();
+
+    /**
+     * @brief Queue the claimed slot for publishing
+     *
+     * @details Behaves like publish() for the data already written to the
+     * buffer returned by claim(). The slot is given back whether or not the
+     * request is accepted.
+     *
+     * @param[in] name of the event requested
+     * @param[in] flags PublishFlags type for the request
+     * @param[in] priority priority of message. Lowest is highest priority, zero indexed
+     * @param[in] cb callback on publish success or failure
+     *
+     * @return TRUE if request accepted, FALSE if not
+     */
+    bool commit(const char* name,
+                PublishFlags flags = PRIVATE,
+                std::size_t priority = 0u,
+                publish_callback cb = nullptr);
+
+    /**
+     * @brief Give back the claimed slot without publishing it
+     */
+    void release();
+
+    /**
+     * @brief Check whether data is the buffer returned by claim()
+     *
+     * @param[in] data pointer to check
+     *
+     * @return TRUE if data is the claimed buffer, FALSE if not
+     */
+    bool claimed(const char* data) const
+    {
+        return (_claimed != nullptr) && (data == _claimed->event_data);
+    }
+
     /**
      * @brief Iterate through the queues and make calls to the 
      * callback functions
@@ -209,6 +347,45 @@ public:
      * meaningful action
      */
     void cleanup();
+
+    /**
+     * @brief Set how many publishes can be outstanding at once
+     *
+     * @details With a depth of one each publish finishes before the next
+     * starts. A deeper pipeline starts further publishes, within the rate
+     * limit, while earlier ones wait on the cloud, and their callbacks are
+     * called in the order the publishes finish.
+     *
+     * @param[in] depth number of outstanding publishes, 1 to max_in_flight
+     */
+    void set_pipeline_depth(std::size_t depth);
+
+    /**
+     * @brief Keep the events of a queue in order
+     *
+     * @details An ordered queue has at most one publish outstanding so its
+     * events are published and their callbacks called in the order they were
+     * queued, whatever the pipeline depth. Other queues can still publish
+     * alongside it.
+     *
+     * @param[in] priority priority level of the queue, zero indexed
+     * @param[in] ordered TRUE to keep the queue in order
+     */
+    void set_ordered(std::size_t priority, bool ordered);
+
+    /**
+     * @brief Get the queue wait statistics of a priority level
+     *
+     * @param[in] priority priority level of the queue, zero indexed
+     *
+     * @return Statistics since construction or the last reset_stats()
+     */
+    publish_stats_t stats(std::size_t priority);
+
+    /**
+     * @brief Clear the queue wait statistics of every priority level
+     */
+    void reset_stats();
     
     //remove copy and assignment operators
     BackgroundPublish(BackgroundPublish const&) = delete; 
@@ -219,20 +396,104 @@ protected:
     struct publish_event_t {
         PublishFlags event_flags;
         publish_callback completed_cb;
+        system_tick_t queued_at;
         char event_name[particle::protocol::MAX_EVENT_NAME_LENGTH + 1];
         char event_data[particle::protocol::MAX_EVENT_DATA_LENGTH + 1];
     };
 
-    std::array<std::queue<publish_event_t>, NumQueues> _queues;
-    static particle::Error process_publish(const publish_event_t& event);
+    /**
+     * @brief Take the oldest event from the highest priority queue
+     *
+     * @details Ordered queues with a publish outstanding are passed over.
+     * The event is no longer queued and must be given back with free_event()
+     * once it has been published
+     *
+     * @param[out] priority priority level the event was queued at
+     *
+     * @return Event to publish, nullptr if no queue has an event ready
+     */
+    publish_event_t* next_event(std::size_t& priority);
+    void free_event(publish_event_t* event);
+
+    /**
+     * @brief Get a free event slot, allocating one if none can be reused
+     *
+     * @return Event slot, nullptr if every slot is in use
+     */
+    publish_event_t* take_event();
+
+    /**
+     * @brief Complete finished publishes and start new ones
+     *
+     * @details Calls the callbacks of the publishes that have finished, then
+     * fills the pipeline with as many events as the rate limit allows
+     *
+     * @param[in] now current time [milliseconds]
+     *
+     * @return Time until there may be more to do, zero to call again straight
+     * away or CONCURRENT_WAIT_FOREVER if there is nothing to do until an event
+     * is queued [milliseconds]
+     */
+    system_tick_t dispatch(system_tick_t now);
 
 private:
+    // Ring of events waiting to be published at one priority level
+    struct publish_queue_t {
+        publish_event_t** ring;
+        std::size_t head;
+        std::size_t count;
+    };
+
+    // Publish waiting on the cloud
+    struct publish_in_flight_t {
+        publish_event_t* event;
+        std::size_t priority;
+        particle::Future<bool> promise;
+    };
+
+    // Upper bound on sleeping with publishes outstanding in case a completion doesn't wake the thread
+    static constexpr system_tick_t completion_check {1000u};
+
     void thread();
+    void wake();
+    bool pending();
+    void start_publish(publish_event_t* event, std::size_t priority);
+    void complete_publishes();
+    bool enqueue(publish_event_t* event,
+                 const char* name,
+                 PublishFlags flags,
+                 std::size_t priority,
+                 publish_callback& cb);
+    static void reject(publish_callback& cb,
+                       particle::Error error,
+                       const char* name,
+                       const char* data);
 
     RecursiveMutex _mutex;
     bool running;
     Thread _thread;
     std::size_t maxEntries;
+    os_semaphore_t _wake;
+    PublishTokenBucket _tokens;
+    std::array<publish_stats_t, NumQueues> _stats;
+
+    // Only used by the thread, apart from the settings
+    std::array<publish_in_flight_t, max_in_flight> _in_flight;
+    std::size_t _in_flight_count;
+    std::size_t _pipeline_depth;
+    std::array<bool, NumQueues> _ordered;
+    std::array<std::size_t, NumQueues> _queue_in_flight;
+
+    // Slots are allocated when there is no free one to reuse, up to the
+    // limit, so publishing stops touching the heap once the busiest moment
+    // has been seen.
+    std::array<publish_queue_t, NumQueues> _queues;
+    std::size_t _slot_limit;
+    std::size_t _slot_count;
+    publish_event_t** _slots;
+    publish_event_t** _free;
+    std::size_t _free_count;
+    publish_event_t* _claimed;
 
     static Logger logger;
 };
@@ -240,6 +501,70 @@ private:
 template<std::size_t NumQueues>
 Logger BackgroundPublish<NumQueues>::logger("background-publish");
 
+template<std::size_t NumQueues>
+constexpr unsigned int BackgroundPublish<NumQueues>::burst_limit;
+
+template<std::size_t NumQueues>
+constexpr system_tick_t BackgroundPublish<NumQueues>::token_interval;
+
+template<std::size_t NumQueues>
+constexpr std::size_t BackgroundPublish<NumQueues>::max_in_flight;
+
+template<std::size_t NumQueues>
+constexpr system_tick_t BackgroundPublish<NumQueues>::completion_check;
+
+template<std::size_t NumQueues>
+BackgroundPublish<NumQueues>::BackgroundPublish(std::size_t max_entries, std::size_t max_slots) :
+    running {false},
+    _thread(),
+    maxEntries {max_entries},
+    _wake {nullptr},
+    _tokens {burst_limit, token_interval},
+    _stats {},
+    _in_flight {},
+    _in_flight_count {},
+    _pipeline_depth {1u},
+    _ordered {},
+    _queue_in_flight {},
+    _queues {},
+    _slot_limit {max_slots ? max_slots : NumQueues * max_entries + max_in_flight + 1u},
+    _slot_count {},
+    _slots {new (std::nothrow) publish_event_t*[_slot_limit]},
+    _free {new (std::nothrow) publish_event_t*[_slot_limit + NumQueues * max_entries]},
+    _free_count {},
+    _claimed {nullptr}
+{
+    // Given whenever there is new work so the thread can sleep until then
+    os_semaphore_create(&_wake, 1u, 0u);
+
+    if (!_slots || !_free) {
+        logger.error("unable to allocate %u slots", (unsigned)_slot_limit);
+        delete[] _slots;
+        delete[] _free;
+        _slots = nullptr;
+        _free = nullptr;
+        maxEntries = 0u;
+        return;
+    }
+    // The queue rings share the allocation of the free list
+    for (std::size_t i = 0; i < NumQueues; i++) {
+        _queues[i].ring = _free + _slot_limit + i * maxEntries;
+    }
+}
+
+template<std::size_t NumQueues>
+BackgroundPublish<NumQueues>::~BackgroundPublish()
+{
+    for (std::size_t i = 0; i < _slot_count; i++) {
+        delete _slots[i];
+    }
+    delete[] _slots;
+    delete[] _free;
+    if (_wake) {
+        os_semaphore_destroy(_wake);
+    }
+}
+
 template<std::size_t NumQueues>
 void BackgroundPublish<NumQueues>::start()
 {
@@ -261,68 +586,216 @@ void BackgroundPublish<NumQueues>::stop()
         return;
     }
     running = false;
+    wake();
     _thread.join();
     cleanup();
 }
 
 template<std::size_t NumQueues>
-particle::Error BackgroundPublish<NumQueues>::process_publish(const publish_event_t& event)
+void BackgroundPublish<NumQueues>::start_publish(publish_event_t* event, std::size_t priority)
 {
-    auto promise {Particle.publish(event.event_name,
-                                   event.event_data,
-                                   event.event_flags)};
+    auto &entry {_in_flight[_in_flight_count++]};
+    entry.event = event;
+    entry.priority = priority;
+    entry.promise = Particle.publish(event->event_name,
+                                     event->event_data,
+                                     event->event_flags);
+    _queue_in_flight[priority]++;
 
     // Can't use promise.wait() outside of the application thread
-    while(!promise.isDone()) {
-        delay(2); // yield to other threads
+    entry.promise.onDone([this](const particle::Future<bool>&) {
+        wake();
+    });
+}
+
+template<std::size_t NumQueues>
+void BackgroundPublish<NumQueues>::complete_publishes()
+{
+    std::size_t i {};
+    while(i < _in_flight_count) {
+        auto &entry {_in_flight[i]};
+        if(!entry.promise.isDone()) {
+            i++;
+            continue;
+        }
+
+        auto event {entry.event};
+        auto error {entry.promise.error()};
+        _queue_in_flight[entry.priority]--;
+        // Keep the outstanding publishes packed at the front in the order they were started
+        for(std::size_t j = i + 1; j < _in_flight_count; j++) {
+            _in_flight[j - 1] = _in_flight[j];
+        }
+        _in_flight_count--;
+        _in_flight[_in_flight_count] = {};
+
+        if(event->completed_cb != nullptr) {
+            event->completed_cb(error,
+                                event->event_name,
+                                event->event_data);
+        } else {
+            if (error != particle::Error::NONE) {
+                // log error if no callback is used
+                logger.error("publish failed: %s", error.message());
+            }
+        }
+        free_event(event);
     }
-    auto error {promise.error()};
+}
 
-    if(event.completed_cb != nullptr) {
-        event.completed_cb(error,
-                           event.event_name,
-                           event.event_data);
-    } else {
-        if (error != particle::Error::NONE) {
-            // log error if no callback is used
-            logger.error("publish failed: %s", error.message());
+template<std::size_t NumQueues>
+typename BackgroundPublish<NumQueues>::publish_event_t* BackgroundPublish<NumQueues>::next_event(std::size_t& priority)
+{
+    std::lock_guard<RecursiveMutex> lock(_mutex);
+
+    for(priority = 0; priority < NumQueues; priority++) {
+        auto &queue {_queues[priority]};
+        if(queue.count && !(_ordered[priority] && _queue_in_flight[priority])) {
+            auto event {queue.ring[queue.head]};
+            queue.head = (queue.head + 1) % maxEntries;
+            queue.count--;
+
+            auto &stats {_stats[priority]};
+            std::uint32_t wait {millis() - event->queued_at};
+            stats.published++;
+            stats.wait_last = wait;
+            stats.wait_max = (wait > stats.wait_max) ? wait : stats.wait_max;
+            stats.wait_total += wait;
+            return event;
         }
     }
+    return nullptr;
+}
+
+template<std::size_t NumQueues>
+bool BackgroundPublish<NumQueues>::pending()
+{
+    std::lock_guard<RecursiveMutex> lock(_mutex);
 
-    return error;
+    for(std::size_t priority = 0; priority < NumQueues; priority++) {
+        if(_queues[priority].count && !(_ordered[priority] && _queue_in_flight[priority])) {
+            return true;
+        }
+    }
+    return false;
 }
 
 template<std::size_t NumQueues>
-void BackgroundPublish<NumQueues>::thread() {
-    constexpr std::size_t burst_rate {2u}; // allowable burst rate (Hz), Device OS allows up to 4/s
-    constexpr system_tick_t process_interval {1000u};
+void BackgroundPublish<NumQueues>::free_event(publish_event_t* event)
+{
+    std::lock_guard<RecursiveMutex> lock(_mutex);
+
+    // Drop anything captured by the callback now rather than when the slot is reused
+    event->completed_cb = nullptr;
+    _free[_free_count++] = event;
+}
+
+template<std::size_t NumQueues>
+typename BackgroundPublish<NumQueues>::publish_event_t* BackgroundPublish<NumQueues>::take_event()
+{
+    std::lock_guard<RecursiveMutex> lock(_mutex);
+
+    if (_free_count) {
+        return _free[--_free_count];
+    }
+    if (!_slots || (_slot_count >= _slot_limit)) {
+        return nullptr;
+    }
+    auto event {new (std::nothrow) publish_event_t()};
+    if (event) {
+        _slots[_slot_count++] = event;
+    }
+    return event;
+}
+
+template<std::size_t NumQueues>
+system_tick_t BackgroundPublish<NumQueues>::dispatch(system_tick_t now)
+{
+    complete_publishes();
+
+    // Look at the bucket first so an event isn't taken from its queue
+    // until it can be published
+    while((_in_flight_count < _pipeline_depth) && !_tokens.wait_time(now)) {
+        // The event is published from its slot so the mutex isn't held while it is outstanding
+        std::size_t priority {};
+        auto event {next_event(priority)};
+        if(!event) {
+            break;
+        }
+        _tokens.take(now);
+        start_publish(event, priority);
+    }
 
-    system_tick_t publish_t[burst_rate] {}; // publish time of the last (burst_rate) sends in a circular buffer
-    std::size_t i {}; // publish time of the previous (burst_rate)th send
+    complete_publishes();
+
+    system_tick_t wait {(_in_flight_count) ? completion_check : CONCURRENT_WAIT_FOREVER};
+    if((_in_flight_count < _pipeline_depth) && pending()) {
+        auto token_wait {_tokens.wait_time(now)};
+        wait = (token_wait < wait) ? token_wait : wait;
+    }
+    return wait;
+}
 
+template<std::size_t NumQueues>
+void BackgroundPublish<NumQueues>::thread() {
     while(running) {
-        auto now {millis()};
-        if(now - publish_t[i] >= process_interval) {
-            for(auto &queue : _queues) {
-                _mutex.lock();
-                if(!queue.empty()) {
-                    publish_t[i] = now;
-                    i = (i + 1) % burst_rate;
-                    // Copy the event and pop so the publish and wait is done without holding the mutex
-                    publish_event_t event {queue.front()};
-                    queue.pop();
-                    _mutex.unlock();
-                    process_publish(event);
-                    break;
-                }
-                _mutex.unlock();
-            }
+        auto wait {dispatch(millis())};
+        if(wait) {
+            // Sleep until a token is regained, a publish finishes or new events are queued
+            os_semaphore_take(_wake, wait, false);
         }
+    }
 
-        delay(2); // force yield to processor
+    // Let the outstanding publishes finish so that their callbacks are called
+    while(_in_flight_count) {
+        complete_publishes();
+        if(_in_flight_count) {
+            os_semaphore_take(_wake, completion_check, false);
+        }
     }
 }
 
+template<std::size_t NumQueues>
+void BackgroundPublish<NumQueues>::wake()
+{
+    if (_wake) {
+        os_semaphore_give(_wake, false);
+    }
+}
+
+template<std::size_t NumQueues>
+void BackgroundPublish<NumQueues>::reject(publish_callback& cb,
+                                          particle::Error error,
+                                          const char *name,
+                                          const char *data)
+{
+    if (cb != nullptr) {
+        cb(error, name, data);
+    }
+}
+
+template<std::size_t NumQueues>
+bool BackgroundPublish<NumQueues>::enqueue(publish_event_t* event,
+                                           const char *name,
+                                           PublishFlags flags,
+                                           std::size_t priority,
+                                           publish_callback& cb)
+{
+    auto &queue {_queues[priority]};
+    if(queue.count >= maxEntries) {
+        return false;
+    }
+    event->event_flags = flags;
+    event->completed_cb = std::move(cb);
+    event->queued_at = millis();
+    std::strncpy(event->event_name, name, sizeof(event->event_name));
+    event->event_name[sizeof(event->event_name) - 1] = '\0';
+    queue.ring[(queue.head + queue.count) % maxEntries] = event;
+    queue.count++;
+    wake();
+    return true;
+}
+
 template<std::size_t NumQueues>
 bool BackgroundPublish<NumQueues>::publish(const char *name,
                                            const char *data,
@@ -332,53 +805,152 @@ bool BackgroundPublish<NumQueues>::publish(const char *name,
 {
     if (!running) {
         logger.error("publisher not initialized");
-        cb(particle::Error::INVALID_STATE, name, data);
+        reject(cb, particle::Error::INVALID_STATE, name, data);
         return false;
     }
 
     if (priority >= NumQueues) {
         logger.error("priority %d exceeds number of queues %d", priority, NumQueues);
-        cb(particle::Error::INVALID_ARGUMENT, name, data);
+        reject(cb, particle::Error::INVALID_ARGUMENT, name, data);
         return false;
     }
 
     std::lock_guard<RecursiveMutex> lock(_mutex);
 
-    if(_queues[priority].size() >= maxEntries) {
+    auto event {(_queues[priority].count < maxEntries) ? take_event() : nullptr};
+    if(!event) {
         logger.error("queue at priority %d is full", priority);
-        cb(particle::Error::BUSY, name, data);
+        reject(cb, particle::Error::BUSY, name, data);
         return false;
     }
-    _queues[priority].emplace();
-    auto &event {_queues[priority].back()};
-    event.event_flags = flags;
-    event.completed_cb = cb;
-    std::strncpy(event.event_name, name, sizeof(event.event_name));
-    event.event_name[sizeof(event.event_name) - 1] = '\0';
     if (data != nullptr) {
-        std::strncpy(event.event_data, data, sizeof(event.event_data));
-        event.event_data[sizeof(event.event_data) - 1] = '\0';
+        std::strncpy(event->event_data, data, sizeof(event->event_data));
+        event->event_data[sizeof(event->event_data) - 1] = '\0';
     } else {
-        event.event_data[0] = '\0';
+        event->event_data[0] = '\0';
     }
+    enqueue(event, name, flags, priority, cb);
 
     return true;
 }
 
+template<std::size_t NumQueues>
+char* BackgroundPublish<NumQueues>::claim()
+{
+    std::lock_guard<RecursiveMutex> lock(_mutex);
+
+    if (_claimed) {
+        return nullptr;
+    }
+    _claimed = take_event();
+    if (!_claimed) {
+        return nullptr;
+    }
+    _claimed->event_data[0] = '\0';
+    return _claimed->event_data;
+}
+
+template<std::size_t NumQueues>
+bool BackgroundPublish<NumQueues>::commit(const char *name,
+                                          PublishFlags flags,
+                                          std::size_t priority,
+                                          publish_callback cb)
+{
+    std::lock_guard<RecursiveMutex> lock(_mutex);
+
+    if (!_claimed) {
+        logger.error("nothing claimed to commit");
+        reject(cb, particle::Error::INVALID_STATE, name, nullptr);
+        return false;
+    }
+
+    auto event {_claimed};
+    event->event_data[sizeof(event->event_data) - 1] = '\0';
+
+    particle::Error error {particle::Error::NONE};
+    if (!running) {
+        logger.error("publisher not initialized");
+        error = particle::Error::INVALID_STATE;
+    } else if (priority >= NumQueues) {
+        logger.error("priority %d exceeds number of queues %d", priority, NumQueues);
+        error = particle::Error::INVALID_ARGUMENT;
+    } else if (!enqueue(event, name, flags, priority, cb)) {
+        logger.error("queue at priority %d is full", priority);
+        error = particle::Error::BUSY;
+    }
+
+    _claimed = nullptr;
+    if (error != particle::Error::NONE) {
+        reject(cb, error, name, event->event_data);
+        _free[_free_count++] = event;
+        return false;
+    }
+    return true;
+}
+
+template<std::size_t NumQueues>
+void BackgroundPublish<NumQueues>::release()
+{
+    std::lock_guard<RecursiveMutex> lock(_mutex);
+
+    if (_claimed) {
+        _free[_free_count++] = _claimed;
+        _claimed = nullptr;
+    }
+}
+
 template<std::size_t NumQueues>
 void BackgroundPublish<NumQueues>::cleanup()
 {
     std::lock_guard<RecursiveMutex> lock(_mutex);
 
     for(auto &queue : _queues) {
-        while(!queue.empty()) {
-            publish_event_t &event {queue.front()};
-            if(event.completed_cb != nullptr) {
-                event.completed_cb(particle::Error::CANCELLED,
-                            event.event_name,
-                            event.event_data);
+        while(queue.count) {
+            auto event {queue.ring[queue.head]};
+            queue.head = (queue.head + 1) % maxEntries;
+            queue.count--;
+            if(event->completed_cb != nullptr) {
+                event->completed_cb(particle::Error::CANCELLED,
+                            event->event_name,
+                            event->event_data);
             }
-            queue.pop();
+            free_event(event);
         }
     }
 }
+
+template<std::size_t NumQueues>
+typename BackgroundPublish<NumQueues>::publish_stats_t BackgroundPublish<NumQueues>::stats(std::size_t priority)
+{
+    std::lock_guard<RecursiveMutex> lock(_mutex);
+
+    return (priority < NumQueues) ? _stats[priority] : publish_stats_t {};
+}
+
+template<std::size_t NumQueues>
+void BackgroundPublish<NumQueues>::reset_stats()
+{
+    std::lock_guard<RecursiveMutex> lock(_mutex);
+
+    _stats = {};
+}
+
+template<std::size_t NumQueues>
+void BackgroundPublish<NumQueues>::set_pipeline_depth(std::size_t depth)
+{
+    std::lock_guard<RecursiveMutex> lock(_mutex);
+
+    _pipeline_depth = (depth < 1u) ? 1u : ((depth > max_in_flight) ? max_in_flight : depth);
+    wake();
+}
+
+template<std::size_t NumQueues>
+void BackgroundPublish<NumQueues>::set_ordered(std::size_t priority, bool ordered)
+{
+    std::lock_guard<RecursiveMutex> lock(_mutex);
+
+    if(priority < NumQueues) {
+        _ordered[priority] = ordered;
+        wake();
+    }
+}
@@ -2,7 +2,10 @@
 
 #include <chrono>
 #include <functional>
+#include <memory>
 #include <mutex>
+#include <string>
+#include <vector>
 #include "concurrent_hal.h"
 
 // List of all defined system errors
@@ -257,22 +260,54 @@ inline Error::operator bool() const {
 template<typename ContextT>
 class Future {
 public:
+    using OnDoneCallback = std::function<void(const Future&)>;
+
     Future() {}
     bool isSucceeded() const {
-        return isSucceededReturn;
+        return state().isSucceededReturn;
     }
 
     bool isDone() const {
-        return isDoneReturn;
+        return state().isDoneReturn;
     }
 
     Error error() const {
-        return err;
+        return state().err;
+    }
+
+    Future& onDone(OnDoneCallback cb) {
+        if (isDone()) {
+            cb(*this);
+        } else {
+            state().doneCb = cb;
+        }
+        return *this;
+    }
+
+    // Finish a publish that was left outstanding
+    void complete(Error error) {
+        auto& s = state();
+        s.err = error;
+        s.isDoneReturn = true;
+        if (s.doneCb) {
+            s.doneCb(s);
+        }
     }
 
     bool isDoneReturn;
     bool isSucceededReturn;
     Error err;
+    OnDoneCallback doneCb;
+    std::shared_ptr<Future> shared; // results come from here when set, so copies see a later completion
+
+private:
+    const Future& state() const {
+        return shared ? *shared : *this;
+    }
+
+    Future& state() {
+        return shared ? *shared : *this;
+    }
 };
 
 namespace protocol {
@@ -294,9 +329,19 @@ public:
                                         const char *eventData, 
                                         PublishFlags flags1, 
                                         PublishFlags flags2 = PublishFlags()) {
-        return state_output;
+        published.push_back(eventData);
+        if (state_output.isDoneReturn) {
+            return state_output;
+        }
+        // Not done yet, keep it so the test can complete it later
+        particle::Future<bool> promise;
+        promise.shared = std::make_shared<particle::Future<bool>>(state_output);
+        outstanding.push_back(promise.shared);
+        return promise;
     }
     particle::Future<bool> state_output;
+    std::vector<std::string> published;                                 // data of every publish, in order
+    std::vector<std::shared_ptr<particle::Future<bool>>> outstanding;   // publishes that weren't done when started
 };
 extern CloudClass Particle;
 
@@ -6,3 +6,24 @@ os_result_t os_thread_exit(os_thread_t thread)
 {
 	return 0;
 }
+
+int os_semaphore_create(os_semaphore_t* semaphore, unsigned max, unsigned initial)
+{
+	*semaphore = semaphore;
+	return 0;
+}
+
+int os_semaphore_destroy(os_semaphore_t semaphore)
+{
+	return 0;
+}
+
+int os_semaphore_take(os_semaphore_t semaphore, uint32_t timeout, bool reserved)
+{
+	return 0;
+}
+
+int os_semaphore_give(os_semaphore_t semaphore, bool reserved)
+{
+	return 0;
+}
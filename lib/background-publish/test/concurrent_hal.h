@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstdint>
+#include <functional>
+
 typedef void*os_queue_t;
 /**
  * Type by which queues are referenced.  For example, a call to xQueueCreate()
@@ -15,3 +18,12 @@ typedef std::function<os_thread_return_t(void)> wiring_thread_fn_t;
 typedef uint8_t os_thread_prio_t;
 
 os_result_t os_thread_exit(os_thread_t thread);
+
+typedef void* os_semaphore_t;
+
+#define CONCURRENT_WAIT_FOREVER ((uint32_t)-1)
+
+int os_semaphore_create(os_semaphore_t* semaphore, unsigned max, unsigned initial);
+int os_semaphore_destroy(os_semaphore_t semaphore);
+int os_semaphore_take(os_semaphore_t semaphore, uint32_t timeout, bool reserved);
+int os_semaphore_give(os_semaphore_t semaphore, bool reserved);
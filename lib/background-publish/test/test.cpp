@@ -41,32 +41,14 @@ void priority_low_cb2(particle::Error status,
 
 class TestBackgroundPublish : public BackgroundPublish<> {
 public:
+    using BackgroundPublish<>::BackgroundPublish;
     void processOnce();
+    system_tick_t dispatchOnce() { return dispatch(millis()); }
 };
 
 void TestBackgroundPublish::processOnce()
 {
-    constexpr std::size_t burst_rate {2u}; // allowable burst rate (Hz), Device OS allows up to 4/s
-    constexpr system_tick_t process_interval {1000u};
-
-    // Publish time of the last (burst_rate) sends in a circular buffer
-    static system_tick_t publish_t[burst_rate] {};
-    static std::size_t i {}; // publish time of the previous (burst_rate)th send
-
-    auto now {millis()};
-    if(now - publish_t[i] >= process_interval) {
-        for(auto &queue : _queues) {
-            if(!queue.empty()) {
-                publish_t[i] = now;
-                i = (i + 1) % burst_rate;
-                // Copy the event and pop so the publish is done without holding the mutex
-                publish_event_t event {queue.front()};
-                queue.pop();
-                process_publish(event);
-                break;
-            }
-        }
-    }
+    dispatch(millis());
 }
 
 TEST_CASE("Test Background Publish") {
@@ -126,23 +108,29 @@ TEST_CASE("Test Background Publish") {
     REQUIRE(low_cb_counter == 2);
     REQUIRE(status_returned == particle::Error::NONE);
 
-    // Fail, not enough time passed between processing publishes
-    // Then PASS once once time has passed.
+    // Burst until the bucket is empty, then FAIL until a token is regained
     high_cb_counter = 0;
     low_cb_counter = 0;
-    REQUIRE(publisher.publish("TEST_PUB_HIGH",
-                        str.c_str(), 
-                        PRIVATE,
-                        0, 
-                        priority_high_cb ) == true);
-    System.inc(500); // not enough delay to process
-    publisher.processOnce(); //run to clear off the queues
-    REQUIRE(high_cb_counter == 0);
+    for(int i = 0; i < 3; i++) {
+        REQUIRE(publisher.publish("TEST_PUB_HIGH",
+                            str.c_str(), 
+                            PRIVATE,
+                            0, 
+                            priority_high_cb ) == true);
+    }
+    publisher.processOnce();
+    publisher.processOnce();
+    REQUIRE(high_cb_counter == 2);
+    publisher.processOnce(); // all four tokens have been used
+    REQUIRE(high_cb_counter == 2);
+    System.inc(500); // not enough delay to regain a token
+    publisher.processOnce();
+    REQUIRE(high_cb_counter == 2);
     REQUIRE(low_cb_counter == 0);
 
-    System.inc(500); //increase the tick by one second to allow processOnce to process
+    System.inc(500); //increase the tick by one second to regain a token
     publisher.processOnce(); //run to clear off the queues
-    REQUIRE(high_cb_counter == 1);
+    REQUIRE(high_cb_counter == 3);
     REQUIRE(low_cb_counter == 0);
     REQUIRE(status_returned == particle::Error::NONE);
     status_returned = particle::Error::UNKNOWN;
@@ -276,8 +264,250 @@ TEST_CASE("Test Background Publish") {
     REQUIRE(status_returned == particle::Error::NONE);
     status_returned = particle::Error::UNKNOWN;
 
+    publisher.processOnce(); // sustained sends are paced to one a second
+    REQUIRE(low_cb_counter == 2);
+    System.inc(1000);
     publisher.processOnce();
-    REQUIRE(status_returned == particle::Error::NONE);  // burst send
+    REQUIRE(status_returned == particle::Error::NONE);
     REQUIRE(low_cb_counter == 3);
     REQUIRE(high_cb_counter == 3);
+
+    // The full burst is available again after a quiet period
+    System.inc(10000);
+    for(int i = 0; i < 5; i++) {
+        publisher.publish("TEST_PUB_LOW",
+                            str.c_str(),
+                            PRIVATE,
+                            1,
+                            priority_low_cb);
+    }
+    for(int i = 0; i < 5; i++) {
+        publisher.processOnce();
+    }
+    REQUIRE(low_cb_counter == 7);
+
+    // Queue waits are recorded by priority level
+    publisher.reset_stats();
+    System.inc(1000);
+    publisher.processOnce();
+    REQUIRE(low_cb_counter == 8);
+    auto stats {publisher.stats(1)};
+    REQUIRE(stats.published == 1);
+    REQUIRE(stats.wait_last == 1000);
+    REQUIRE(stats.wait_max == 1000);
+    REQUIRE(stats.wait_total == 1000);
+    REQUIRE(publisher.stats(0).published == 0);
+}
+
+TEST_CASE("Test Claimed Slots") {
+    TestBackgroundPublish publisher;
+    std::string published;
+    auto record_cb = [&](particle::Error status, const char *event_name, const char *event_data) {
+        status_returned = status;
+        published = event_data;
+    };
+
+    Particle.state_output.isDoneReturn = true;
+    Particle.state_output.err = particle::Error::NONE;
+
+    // FAIL, publisher not started
+    auto buffer = publisher.claim();
+    REQUIRE(buffer != nullptr);
+    std::strcpy(buffer, "{\"cmd\":\"loc\"}");
+    REQUIRE(publisher.commit("TEST_PUB_CLAIM", PRIVATE, 0, record_cb) == false);
+    REQUIRE(status_returned == particle::Error::INVALID_STATE);
+    REQUIRE(published == "{\"cmd\":\"loc\"}");
+
+    publisher.start();
+
+    // Only one slot can be claimed at a time
+    buffer = publisher.claim();
+    REQUIRE(buffer != nullptr);
+    REQUIRE(publisher.claimed(buffer));
+    REQUIRE(publisher.claim() == nullptr);
+    std::strcpy(buffer, "{\"cmd\":\"loc\",\"n\":1}");
+    REQUIRE(publisher.commit("TEST_PUB_CLAIM", PRIVATE, 0, record_cb) == true);
+    REQUIRE_FALSE(publisher.claimed(buffer));
+
+    published.clear();
+    System.inc(1000);
+    publisher.processOnce();
+    REQUIRE(status_returned == particle::Error::NONE);
+    REQUIRE(published == "{\"cmd\":\"loc\",\"n\":1}");
+
+    // Released slots are reused
+    buffer = publisher.claim();
+    REQUIRE(buffer != nullptr);
+    publisher.release();
+    REQUIRE(publisher.claim() == buffer);
+    publisher.release();
+
+    // Claimed data is published ahead of copies at lower priority and the
+    // claimed slot survives all queues being full
+    for(int i = 0; i < 8; i++) {
+        REQUIRE(publisher.publish("TEST_PUB_LOW", str.c_str(), PRIVATE, 1, priority_low_cb) == true);
+    }
+    REQUIRE(publisher.publish("TEST_PUB_LOW", str.c_str(), PRIVATE, 1, priority_low_cb) == false);
+    REQUIRE(status_returned == particle::Error::BUSY);
+    for(int i = 0; i < 8; i++) {
+        REQUIRE(publisher.publish("TEST_PUB_HIGH", str.c_str(), PRIVATE, 0, priority_high_cb) == true);
+    }
+    buffer = publisher.claim();
+    REQUIRE(buffer != nullptr);
+    std::strcpy(buffer, "{\"cmd\":\"full\"}");
+    REQUIRE(publisher.commit("TEST_PUB_CLAIM", PRIVATE, 0, record_cb) == false);
+    REQUIRE(status_returned == particle::Error::BUSY);
+    REQUIRE(published == "{\"cmd\":\"full\"}");
+
+    high_cb_counter = 0;
+    low_cb_counter = 0;
+    System.inc(1000);
+    publisher.processOnce();
+    REQUIRE(high_cb_counter == 1);
+    REQUIRE(low_cb_counter == 0);
+
+    buffer = publisher.claim();
+    std::strcpy(buffer, "{\"cmd\":\"loc\",\"n\":2}");
+    REQUIRE(publisher.commit("TEST_PUB_CLAIM", PRIVATE, 0, record_cb) == true);
+
+    // CANCELLED, cleanup() gives every slot back
+    high_cb_counter = 0;
+    low_cb_counter = 0;
+    published.clear();
+    publisher.cleanup();
+    REQUIRE(high_cb_counter == 7);
+    REQUIRE(low_cb_counter == 8);
+    REQUIRE(published == "{\"cmd\":\"loc\",\"n\":2}");
+    for(int i = 0; i < 8; i++) {
+        REQUIRE(publisher.publish("TEST_PUB_HIGH", str.c_str(), PRIVATE, 0, priority_high_cb) == true);
+        REQUIRE(publisher.publish("TEST_PUB_LOW", str.c_str(), PRIVATE, 1, priority_low_cb) == true);
+    }
+    REQUIRE(publisher.claim() != nullptr);
+    publisher.release();
+    publisher.cleanup();
+}
+
+TEST_CASE("Test Slot Limit") {
+    TestBackgroundPublish publisher(8u, 3u);
+    publisher.start();
+    Particle.state_output.isDoneReturn = true;
+    Particle.state_output.err = particle::Error::NONE;
+
+    // Slots run out before the queue does
+    for(int i = 0; i < 3; i++) {
+        REQUIRE(publisher.publish("TEST_PUB_LOW", str.c_str(), PRIVATE, 1) == true);
+    }
+    REQUIRE(publisher.publish("TEST_PUB_LOW", str.c_str(), PRIVATE, 1, priority_low_cb) == false);
+    REQUIRE(status_returned == particle::Error::BUSY);
+    REQUIRE(publisher.claim() == nullptr);
+
+    // A published slot is reused rather than another being allocated
+    System.inc(1000);
+    publisher.processOnce();
+    REQUIRE(publisher.stats(1).published == 1);
+    REQUIRE(publisher.claim() != nullptr);
+    REQUIRE(publisher.publish("TEST_PUB_LOW", str.c_str(), PRIVATE, 1) == false);
+    publisher.release();
+    REQUIRE(publisher.publish("TEST_PUB_LOW", str.c_str(), PRIVATE, 1) == true);
+    publisher.cleanup();
+}
+
+TEST_CASE("Test Rate Governor") {
+    TestBackgroundPublish publisher;
+    publisher.start();
+    Particle.state_output.isDoneReturn = true;
+    Particle.state_output.err = particle::Error::NONE;
+
+    // Nothing to do, sleep until woken
+    REQUIRE(publisher.dispatchOnce() == CONCURRENT_WAIT_FOREVER);
+
+    for(int i = 0; i < 6; i++) {
+        REQUIRE(publisher.publish("TEST_PUB_LOW", str.c_str(), PRIVATE, 1) == true);
+    }
+    for(unsigned int i = 1; i < BackgroundPublish<>::burst_limit; i++) {
+        REQUIRE(publisher.dispatchOnce() == 0);
+    }
+    REQUIRE(publisher.dispatchOnce() == 1000);
+
+    // Sleep just until the next token
+    System.inc(300);
+    REQUIRE(publisher.dispatchOnce() == 700);
+    System.inc(700);
+    REQUIRE(publisher.dispatchOnce() == 1000);
+    System.inc(1000);
+    REQUIRE(publisher.dispatchOnce() == CONCURRENT_WAIT_FOREVER);
+    REQUIRE(publisher.stats(1).published == 6);
+    REQUIRE(publisher.stats(1).wait_max == 2000);
+}
+
+TEST_CASE("Test Pipelined Publishes") {
+    TestBackgroundPublish publisher;
+    std::vector<std::string> completed;
+    std::vector<particle::Error> errors;
+    auto record_cb = [&](particle::Error status, const char *event_name, const char *event_data) {
+        completed.push_back(event_data);
+        errors.push_back(status);
+    };
+    auto publish = [&](const char *data, std::size_t priority) {
+        return publisher.publish("TEST_PUB_PIPE", data, PRIVATE, priority, record_cb);
+    };
+
+    Particle.published.clear();
+    Particle.outstanding.clear();
+    Particle.state_output.isDoneReturn = false;
+    Particle.state_output.err = particle::Error::NONE;
+    publisher.start();
+    publisher.set_pipeline_depth(BackgroundPublish<>::max_in_flight);
+
+    for(auto data : {"1", "2", "3", "4", "5", "6"}) {
+        REQUIRE(publish(data, 1));
+    }
+
+    // The whole burst is started without waiting for the cloud
+    REQUIRE(publisher.dispatchOnce() == 1000);
+    REQUIRE(Particle.published == std::vector<std::string>({"1", "2", "3", "4"}));
+    REQUIRE(completed.empty());
+
+    // Callbacks are called as publishes finish, not in the order they started
+    Particle.outstanding[2]->complete(particle::Error::NONE);
+    REQUIRE(publisher.dispatchOnce() == 1000);
+    REQUIRE(completed == std::vector<std::string>({"3"}));
+    Particle.outstanding[0]->complete(particle::Error::NONE);
+    Particle.outstanding[3]->complete(particle::Error::LIMIT_EXCEEDED);
+    System.inc(1000);
+    publisher.dispatchOnce();
+    REQUIRE(completed == std::vector<std::string>({"3", "1", "4"}));
+    REQUIRE(errors[2] == particle::Error::LIMIT_EXCEEDED);
+
+    // Only one token was regained
+    REQUIRE(Particle.published.size() == 5);
+    REQUIRE(Particle.published.back() == "5");
+
+    // An ordered queue waits for its outstanding publish, other queues don't
+    publisher.set_ordered(1, true);
+    Particle.outstanding[1]->complete(particle::Error::NONE);
+    Particle.outstanding[4]->complete(particle::Error::NONE);
+    System.inc(2000);
+    publisher.dispatchOnce();
+    REQUIRE(completed == std::vector<std::string>({"3", "1", "4", "2", "5"}));
+    REQUIRE(Particle.published.back() == "6");
+    REQUIRE(publish("7", 1));
+    REQUIRE(publisher.dispatchOnce() == 1000);
+    REQUIRE(Particle.published.back() == "6");
+    REQUIRE(publish("A", 0));
+    publisher.dispatchOnce();
+    REQUIRE(Particle.published.back() == "A");
+
+    Particle.outstanding[5]->complete(particle::Error::NONE);
+    System.inc(1000);
+    publisher.dispatchOnce();
+    REQUIRE(completed.back() == "6");
+    REQUIRE(Particle.published.back() == "7");
+
+    Particle.outstanding[6]->complete(particle::Error::NONE);
+    Particle.outstanding[7]->complete(particle::Error::NONE);
+    REQUIRE(publisher.dispatchOnce() == CONCURRENT_WAIT_FOREVER);
+    REQUIRE(completed == std::vector<std::string>({"3", "1", "4", "2", "5", "6", "A", "7"}));
+
+    Particle.state_output.isDoneReturn = true;
 }
@@ -18,9 +18,36 @@
 #include <fcntl.h>
 #include <dirent.h>
 
-// TODO
-// * peekFront() after peekFrontSize() problem
-// * Handle pushBack() policy for DiskQueuePolicy::FifoDeleteNew
+// CRC32 as used by zip, a nibble at a time to keep the table small
+static uint32_t crc32(uint32_t crc, const void* data, size_t size) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+    };
+
+    auto bytes = (const uint8_t*)data;
+    crc = ~crc;
+    while (size--) {
+        crc ^= *bytes++;
+        crc = (crc >> 4) ^ table[crc & 0x0f];
+        crc = (crc >> 4) ^ table[crc & 0x0f];
+    }
+    return ~crc;
+}
+
+// Continue a CRC32 over data read from a file, a little at a time
+static bool readCrc32(int fd, size_t size, uint32_t& crc) {
+    uint8_t buffer[64];
+    while (size) {
+        auto chunk = std::min(size, sizeof(buffer));
+        if ((int)chunk > read(fd, buffer, chunk)) {
+            return false;
+        }
+        crc = crc32(crc, buffer, chunk);
+        size -= chunk;
+    }
+    return true;
+}
 
 int DiskQueue::start(const char* path, DiskQueuePolicy policy) {
     // Check if already running
@@ -40,6 +67,7 @@ int DiskQueue::start(const char* path, DiskQueuePolicy policy) {
 
         // Create a list of all filenames that may contain previously saved data
         getFilenames(path);
+        scanFiles();
 
         _policy = policy;
         _running = true;
@@ -56,6 +84,9 @@ int DiskQueue::stop() {
     // The lock here is to prevent the reader and writer from running
     const std::lock_guard<RecursiveMutex> lock(_lock);
 
+    // Write out held items before closing
+    flushStaging();
+
     _running = false;
 
     // Close all files and
@@ -71,24 +102,64 @@ void DiskQueue::setDiskLimit(size_t size) {
     _diskLimit = size;
 }
 
-int DiskQueue::getReadPolicyIndex(DiskQueuePolicy policy) {
-    return 0; // Will always be the first for now
+void DiskQueue::setSegmentSize(size_t size) {
+    // The lock here is to prevent segment size updates from affecting the writer
+    const std::lock_guard<RecursiveMutex> lock(_lock);
+
+    _segmentSize = size;
+}
+
+size_t DiskQueue::segmentLimit() const {
+    // Keep segments small enough that evicting one doesn't throw away most of the queue
+    auto size = std::min(_segmentSize, _diskLimit / MinSegmentsPerLimit);
+    return (MinSegmentSize > size) ? MinSegmentSize : size;
 }
 
-int DiskQueue::getWriteOverflowPolicyIndex(DiskQueuePolicy policy) {
-    int ret = 0;
+bool DiskQueue::readFrontHeader(QueueItemHeader& header) {
+    if ((0 == _itemCount) && _stagingCount) {
+        // The reader has caught up with what is on disk
+        flushStaging();
+    }
 
-    switch (policy) {
-    case DiskQueuePolicy::FifoDeleteOld:
-        ret = 0;
-        break;
+    while (0 < _itemCount) {
+        auto& entry = segmentAt(_head);
+        if (0 == entry.count) {
+            // Everything in this segment has been read
+            removeFrontSegment();
+            continue;
+        }
+
+        if (0 > _readFd) {
+            _readFd = open(segmentPath(_head).c_str(), O_RDONLY);
+            if (0 > _readFd) {
+                // File open is unsuccessful so remove file and continue
+                removeFrontSegment();
+                continue;
+            }
+        }
 
-    case DiskQueuePolicy::FifoDeleteNew:
-        ret = _fileList.size() - 1;  // Will not be < zero
-        break;
+        int ret = -1;
+        if ((off_t)_readOffset == lseek(_readFd, _readOffset, SEEK_SET)) {
+            ret = read(_readFd, &header, sizeof(header));
+        }
+        if (((int)sizeof(header) > ret) ||
+            (QueueItemMagic != header.magic) ||
+            ((_readOffset + storedSize(header)) > entry.size)) {
+
+            // Nothing after a damaged item can be trusted
+            removeFrontSegment();
+            continue;
+        }
+
+        if (0 == (ItemFlagActive & header.flags)) {
+            _readOffset += storedSize(header);
+            continue;
+        }
+
+        return true;
     }
 
-    return ret;
+    return false;
 }
 
 size_t DiskQueue::peekFrontSize() {
@@ -97,221 +168,503 @@ size_t DiskQueue::peekFrontSize() {
     // The lock here is to prevent the writer from catching up with the reader
     const std::lock_guard<RecursiveMutex> lock(_lock);
 
-    size_t size = 0;
-
-    while (true) {
-        if (_fileList.isEmpty()) {
-            break; // Nothing available
+    QueueItemHeader itemHeader = {};
+    while (readFrontHeader(itemHeader)) {
+        if (0 == (ItemFlagCompressed & itemHeader.flags)) {
+            return (size_t)itemHeader.length;
         }
 
-        auto entry = _fileList.first(); // TODO: Apply policy
-        unsigned long fileN = entry->n;
-        String filename = _path + String(fileN);
-
-        auto fd = open(filename.c_str(), O_RDWR, 0664);
-        if (0 > fd) {
-            // File open is unsuccessful so remove file and continue
-            unlink(filename.c_str());
-            removeFileNode(getReadPolicyIndex(_policy));
+        // Compressed items start with their original length
+        uint8_t codecHeader[DiskQueueCodec::HeaderSize] = {};
+        off_t dataOffset = _readOffset + storedSize(itemHeader) - itemHeader.length;
+        if (((size_t)itemHeader.length < sizeof(codecHeader)) ||
+            (dataOffset != lseek(_readFd, dataOffset, SEEK_SET)) ||
+            ((int)sizeof(codecHeader) > read(_readFd, codecHeader, sizeof(codecHeader)))) {
+            removeFrontSegment();
             continue;
         }
+        return DiskQueueCodec::originalSize(codecHeader);
+    }
 
-        // Get the file header
-        QueueFileHeader fileHeader = {};
-        auto ret = read(fd, &fileHeader, sizeof(fileHeader));
-        if (((int)sizeof(fileHeader) > ret) ||
-            (QueueFileMagic != fileHeader.magic) ||
-            (QueueFileVersion1 != fileHeader.version)) {
+    return 0; // Nothing available
+}
 
-            close(fd);
-            unlink(filename.c_str());
-            removeFileNode(getReadPolicyIndex(_policy));
+bool DiskQueue::peekFront(uint8_t* data, size_t& size) {
+    CHECK_TRUE(_running, false);
+
+    // The lock here is to prevent the writer from catching up with the reader
+    const std::lock_guard<RecursiveMutex> lock(_lock);
+
+    QueueItemHeader itemHeader = {};
+    while (readFrontHeader(itemHeader)) {
+        // Get the data, the read file is already positioned after the item header
+        auto toRead = size;
+        auto ret = readItem(_readFd, itemHeader, data, toRead, false);
+        if (SYSTEM_ERROR_BAD_DATA == ret) {
+            // Only this item can't be decoded
+            popItem();
             continue;
         }
+        if (SYSTEM_ERROR_FILE == ret) {
+            removeFrontSegment();
+            continue;
+        }
+        if (SYSTEM_ERROR_NONE != ret) {
+            break;
+        }
 
-        // Get the item header
-        QueueItemHeader itemHeader = {};
-        ret = read(fd, &itemHeader, sizeof(itemHeader));
-        if (((int)sizeof(itemHeader) > ret) ||
-            (QueueItemMagic != itemHeader.magic) ||
-            (0 == (ItemFlagActive & itemHeader.flags))) {
+        size = toRead;
+        return true;
+    }
 
-            close(fd);
-            unlink(filename.c_str());
-            removeFileNode(getReadPolicyIndex(_policy));
-            continue;
+    size = 0;
+    return false;
+}
+
+int DiskQueue::readItem(int fd, const QueueItemHeader& header, uint8_t* data, size_t& size, bool whole) {
+    auto length = (size_t)header.length;
+    bool checked = (0 != (ItemFlagChecksum & header.flags));
+    uint32_t expected = 0;
+    uint32_t crc = crc32(0, &header, sizeof(header));
+    if (checked) {
+        CHECK_FALSE(((int)sizeof(expected) > read(fd, &expected, sizeof(expected))), SYSTEM_ERROR_FILE);
+    }
+
+    if (0 == (ItemFlagCompressed & header.flags)) {
+        CHECK_FALSE((whole && (length > size)), SYSTEM_ERROR_TOO_LARGE);
+        size = std::min(size, length);
+        CHECK_FALSE(((int)size > read(fd, data, size)), SYSTEM_ERROR_FILE);
+        if (checked) {
+            // The rest of an item that is cut short is still read to check it
+            crc = crc32(crc, data, size);
+            CHECK_TRUE(readCrc32(fd, length - size, crc), SYSTEM_ERROR_FILE);
+            CHECK_TRUE((expected == crc), SYSTEM_ERROR_BAD_DATA);
         }
+        return SYSTEM_ERROR_NONE;
+    }
 
-        // Everything was successful
-        close(fd);
-        size = (size_t)itemHeader.length;
-        break;
+    // Items may have been compressed before a restart so a codec is made for reading them
+    if (!_codec) {
+        _codec = new DiskQueueCodec(_dictionary, _dictionarySize);
+        CHECK_TRUE(_codec, SYSTEM_ERROR_NO_MEMORY);
     }
 
-    return size;
+    CHECK_FALSE((length > _codec->bufferSize()), SYSTEM_ERROR_BAD_DATA);
+    CHECK_FALSE(((int)length > read(fd, _codec->buffer(), length)), SYSTEM_ERROR_FILE);
+    CHECK_FALSE((checked && (expected != crc32(crc, _codec->buffer(), length))), SYSTEM_ERROR_BAD_DATA);
+
+    size_t decodedSize = 0;
+    auto decoded = _codec->decompress(_codec->buffer(), length, decodedSize);
+    CHECK_TRUE(decoded, SYSTEM_ERROR_BAD_DATA);
+    CHECK_FALSE((whole && (decodedSize > size)), SYSTEM_ERROR_TOO_LARGE);
+    size = std::min(size, decodedSize);
+    memcpy(data, decoded, size);
+
+    return SYSTEM_ERROR_NONE;
 }
 
-// TODO: given size may be derived from peekFrontSize but this function may advance forward to another
-//       entry until successful
-bool DiskQueue::peekFront(uint8_t* data, size_t& size) {
-    CHECK_TRUE(_running, false);
+void DiskQueue::popFront() {
+    if (!_running) {
+        return;
+    }
 
     // The lock here is to prevent the writer from catching up with the reader
     const std::lock_guard<RecursiveMutex> lock(_lock);
 
-    auto success = false;
+    if (popItem() && (sizeof(QueueFileHeader) < _readOffset)) {
+        writeCursor();
+    }
+}
 
-    while (true) {
-        if (_fileList.isEmpty()) {
-            size = 0;
-            break; // Nothing available
-        }
+bool DiskQueue::popItem() {
+    QueueItemHeader itemHeader = {};
+    if (!readFrontHeader(itemHeader)) {
+        return false; // Nothing available
+    }
 
-        auto entry = _fileList.first(); // TODO: Apply policy
-        unsigned long fileN = entry->n;
-        String filename = _path + String(fileN);
+    auto& entry = segmentAt(_head);
+    _readOffset += storedSize(itemHeader);
+    entry.count--;
+    _itemCount--;
 
-        auto fd = open(filename.c_str(), O_RDWR, 0664);
-        if (0 > fd) {
-            // File open is unsuccessful so remove file and continue
-            unlink(filename.c_str());
-            removeFileNode(getReadPolicyIndex(_policy));
-            continue;
-        }
+    if (0 == entry.count) {
+        removeFrontSegment();
+    }
 
-        // Get the file header
-        QueueFileHeader fileHeader = {};
-        auto ret = read(fd, &fileHeader, sizeof(fileHeader));
-        if (((int)sizeof(fileHeader) > ret) ||
-            (QueueFileMagic != fileHeader.magic) ||
-            (QueueFileVersion1 != fileHeader.version)) {
+    return true;
+}
 
-            close(fd);
-            unlink(filename.c_str());
-            removeFileNode(getReadPolicyIndex(_policy));
+size_t DiskQueue::peekBatch(uint8_t* data, size_t maxBytes, size_t* sizes, size_t maxCount) {
+    CHECK_TRUE(_running, 0);
+    CHECK_TRUE((0 < maxCount), 0);
+
+    // The lock here is to prevent the writer from catching up with the reader
+    const std::lock_guard<RecursiveMutex> lock(_lock);
+
+    // Only the first item is cut short to fit
+    QueueItemHeader itemHeader = {};
+    size_t used = 0;
+    _batchValid = false;
+    while (!_batchValid && readFrontHeader(itemHeader)) {
+        used = maxBytes;
+        auto ret = readItem(_readFd, itemHeader, data, used, false);
+        if (SYSTEM_ERROR_BAD_DATA == ret) {
+            popItem();
+            continue;
+        }
+        if (SYSTEM_ERROR_FILE == ret) {
+            removeFrontSegment();
             continue;
         }
+        if (SYSTEM_ERROR_NONE != ret) {
+            break;
+        }
+        _batchValid = true;
+    }
+    if (!_batchValid) {
+        return 0; // Nothing available
+    }
+    _batchSegment = _head;
+    _batchOffset = _readOffset;
+
+    // Later items are read through their own file so that the read position doesn't move
+    auto n = _head;
+    auto offset = _readOffset + storedSize(itemHeader);
+    size_t remaining = segmentAt(n).count;
+    int fd = _readFd;
+    size_t count = 0;
+    sizes[count++] = used;
+
+    while ((maxCount > count) && (maxBytes > used)) {
+        if (0 == --remaining) {
+            do {
+                ++n;
+            } while ((_tail != n) && (0 == segmentAt(n).count));
+            if (_tail == n) {
+                break;
+            }
 
-        // Get the item header
-        QueueItemHeader itemHeader = {};
-        ret = read(fd, &itemHeader, sizeof(itemHeader));
-        if (((int)sizeof(itemHeader) > ret) ||
-            (QueueItemMagic != itemHeader.magic) ||
-            (0 == (ItemFlagActive & itemHeader.flags))) {
+            if (_readFd != fd) {
+                close(fd);
+            }
+            fd = open(segmentPath(n).c_str(), O_RDONLY);
+            if (0 > fd) {
+                break;
+            }
+            offset = sizeof(QueueFileHeader);
+            remaining = segmentAt(n).count;
+        }
 
-            close(fd);
-            unlink(filename.c_str());
-            removeFileNode(getReadPolicyIndex(_policy));
-            continue;
+        // Find the next active item, stopping at anything that doesn't look right
+        bool found = false;
+        while (!found) {
+            if (((off_t)offset != lseek(fd, offset, SEEK_SET)) ||
+                ((int)sizeof(itemHeader) > read(fd, &itemHeader, sizeof(itemHeader))) ||
+                (QueueItemMagic != itemHeader.magic) ||
+                ((offset + storedSize(itemHeader)) > segmentAt(n).size)) {
+                break;
+            }
+            found = (0 != (ItemFlagActive & itemHeader.flags));
+            if (!found) {
+                offset += storedSize(itemHeader);
+            }
+        }
+        if (!found) {
+            break;
         }
 
-        // Get the data
-        auto toRead = std::min<size_t>(size, (size_t)itemHeader.length);
-        ret = read(fd, data, toRead);
-        if ((int)toRead > ret) {
-            close(fd);
-            unlink(filename.c_str());
-            removeFileNode(getReadPolicyIndex(_policy));
-            continue;
+        // Items that can't be read whole are left for a later batch
+        auto size = maxBytes - used;
+        if (SYSTEM_ERROR_NONE != readItem(fd, itemHeader, data + used, size, true)) {
+            break;
         }
+        sizes[count++] = size;
+        used += size;
+        offset += storedSize(itemHeader);
+    }
 
-        // Everything was successful
+    if ((0 <= fd) && (_readFd != fd)) {
         close(fd);
-        success = true;
-        size = (size_t)toRead;
-        break;
     }
 
-    return success;
+    return count;
 }
 
-void DiskQueue::popFront() {
-    if (!_running) {
-        return;
-    }
+bool DiskQueue::commitBatch(size_t count) {
+    CHECK_TRUE(_running, false);
 
     // The lock here is to prevent the writer from catching up with the reader
     const std::lock_guard<RecursiveMutex> lock(_lock);
 
-    if (_fileList.isEmpty()) {
-        return; // Nothing available
+    // Items may have been popped or dropped since the batch was peeked
+    if (!_batchValid || (_batchSegment != _head) || (_batchOffset != _readOffset)) {
+        _batchValid = false;
+        return false;
     }
+    _batchValid = false;
 
-    auto entry = _fileList.first(); // TODO: Apply policy
-    unsigned long fileN = entry->n;
-    String filename = _path + String(fileN);
+    while (count-- && popItem()) {
+    }
+
+    if (sizeof(QueueFileHeader) < _readOffset) {
+        writeCursor();
+    }
 
-    unlink(filename.c_str());
-    removeFileNode(getReadPolicyIndex(_policy));
+    return true;
 }
 
 bool DiskQueue::pushBack(const uint8_t* data, size_t size) {
     CHECK_TRUE(_running, false);
     CHECK_TRUE((0 != size), false);
+    CHECK_TRUE((UINT16_MAX >= size), false);
     // A disk limit of zero means that no new items can be enqueued
     CHECK_TRUE((0 < _diskLimit), false);
 
     // The lock here is to prevent the reader from catching up with the writer
     const std::lock_guard<RecursiveMutex> lock(_lock);
 
-    unsigned long fileN = 0;
-    if (!_fileList.isEmpty()) {
-        fileN = _fileList.last()->n + 1;
+    QueueItemHeader itemHeader = { QueueItemMagic, ItemFlagActive | ItemFlagChecksum, (uint16_t)size };
+    if (_compress) {
+        auto packed = _codec->compress(data, size);
+        if (packed) {
+            data = _codec->buffer();
+            size = packed;
+            itemHeader.flags |= ItemFlagCompressed;
+            itemHeader.length = (uint16_t)size;
+        }
+    }
+
+    // The header and checksum are written together ahead of the data
+    uint32_t crc = crc32(crc32(0, &itemHeader, sizeof(itemHeader)), data, size);
+    uint8_t prefix[sizeof(itemHeader) + sizeof(crc)];
+    memcpy(prefix, &itemHeader, sizeof(itemHeader));
+    memcpy(prefix + sizeof(itemHeader), &crc, sizeof(crc));
+    size_t itemSize = sizeof(prefix) + size;
+
+    if (_stagingSize >= itemSize) {
+        if ((_stagingUsed + itemSize) > _stagingSize) {
+            flushStaging();
+        }
+
+        // Held items can't be refused later so check for room now
+        if ((DiskQueuePolicy::FifoDeleteNew == _policy) &&
+            ((_diskCurrent + _stagingUsed + itemSize + sizeof(QueueFileHeader)) > _diskLimit)) {
+            return false;
+        }
+
+        if (0 == _stagingCount) {
+            _stagingSince = millis();
+        }
+        memcpy(_staging + _stagingUsed, prefix, sizeof(prefix));
+        memcpy(_staging + _stagingUsed + sizeof(prefix), data, size);
+        _stagingUsed += itemSize;
+        _stagingCount++;
+
+        if ((millis() - _stagingSince) >= _commitWindow) {
+            flushStaging();
+        }
+        return true;
     }
 
-    String filename = _path + String(fileN);
+    // Anything already held has to be written first to keep the order
+    flushStaging();
+    return appendItems(prefix, sizeof(prefix), data, size, 1);
+}
+
+bool DiskQueue::appendItems(const uint8_t* first, size_t firstSize, const uint8_t* second, size_t secondSize, size_t count) {
+    size_t itemsSize = firstSize + secondSize;
+    auto needsSegment = [&]() {
+        return (_head == _tail) || _tailSealed ||
+            ((segmentAt(_tail - 1).size + itemsSize) > segmentLimit());
+    };
+    auto needed = [&]() {
+        return itemsSize + (needsSegment() ? sizeof(QueueFileHeader) : 0);
+    };
+
+    // Make room by dropping whole segments, or refuse the items, depending on policy
+    while ((_head != _tail) && ((_diskCurrent + needed()) > _diskLimit)) {
+        if (DiskQueuePolicy::FifoDeleteNew == _policy) {
+            return false;
+        }
+        removeFrontSegment();
+    }
+    CHECK_TRUE(((_diskCurrent + needed()) <= _diskLimit), false);
+
+    auto create = needsSegment();
+    if (create) {
+        CHECK_TRUE(reserveSegments(_tail - _head + 1), false);
+    }
 
-    auto fd = open(filename.c_str(), O_CREAT | O_RDWR | O_APPEND, 0664);
+    unsigned long fileN = (create) ? _tail : (_tail - 1);
+    int fd = -1;
+    if (create) {
+        fd = open(segmentPath(fileN).c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0664);
+    } else {
+        if (fileN == _head) {
+            // Don't keep a stale view of the segment being appended to
+            closeReadFile();
+        }
+        fd = open(segmentPath(fileN).c_str(), O_WRONLY | O_APPEND, 0664);
+    }
     if (0 > fd) {
         return false;
     }
 
     do {
-        QueueFileHeader fileHeader = { QueueFileMagic, QueueFileVersion1, 0x00 /* no flags */ };
         size_t written = 0;
-        auto ret = write(fd, &fileHeader, sizeof(fileHeader));
-        if (0 >= ret) {
-            break;
+        size_t expected = itemsSize;
+        ssize_t ret = 0;
+        if (create) {
+            QueueFileHeader fileHeader = { QueueFileMagic, QueueFileVersion2, 0x00 /* no flags */ };
+            ret = write(fd, &fileHeader, sizeof(fileHeader));
+            if (0 >= ret) {
+                break;
+            }
+            written += (size_t)ret;
+            expected += sizeof(fileHeader);
         }
-        written += (size_t)ret;
 
-        QueueItemHeader itemHeader = { QueueItemMagic, ItemFlagActive, (uint16_t)size };
-        ret = write(fd, &itemHeader, sizeof(itemHeader));
+        ret = write(fd, first, firstSize);
         if (0 >= ret) {
             break;
         }
         written += (size_t)ret;
 
-        ret = write(fd, data, size);
-        if (0 >= ret) {
-            break;
+        if (secondSize) {
+            ret = write(fd, second, secondSize);
+            if (0 >= ret) {
+                break;
+            }
+            written += (size_t)ret;
         }
-        written += (size_t)ret;
 
-        size_t fileSize = sizeof(fileHeader) + sizeof(itemHeader) + size;
-        if ((size_t)written != fileSize) {
+        if (written != expected) {
             break;
         }
 
         fsync(fd);
         close(fd);
-        addFileNode(fileN, fileSize);
 
-        while (_diskCurrent > _diskLimit) {
-            auto index = getWriteOverflowPolicyIndex(_policy);
-            auto entry = _fileList.at(index);
-            String toDelete = _path + String(entry->n);
-            removeFileNode(index);
-            unlink(toDelete.c_str());
+        if (create) {
+            addSegment(sizeof(QueueFileHeader), 0);
+            _tailSealed = false;
         }
+        auto& entry = segmentAt(fileN);
+        entry.size += itemsSize;
+        entry.count += count;
+        _diskCurrent += itemsSize;
+        _itemCount += count;
         return true;
     } while (false);
 
-    close(fd);
-    unlink(filename.c_str());
+    if (create) {
+        close(fd);
+        unlink(segmentPath(fileN).c_str());
+    } else {
+        // Part of an item may have been written, take it back so that more can follow
+        _tailSealed = (0 != ftruncate(fd, segmentAt(fileN).size));
+        close(fd);
+    }
     return false;
 }
 
+bool DiskQueue::flushStaging() {
+    bool success = true;
+    size_t offset = 0;
+
+    while (_stagingUsed > offset) {
+        // Gather as many held items as the segment being written has room for
+        auto itemAt = [&](size_t at) {
+            QueueItemHeader itemHeader = {};
+            memcpy(&itemHeader, _staging + at, sizeof(itemHeader));
+            return storedSize(itemHeader);
+        };
+        size_t room = segmentLimit() - sizeof(QueueFileHeader);
+        if ((_head != _tail) && !_tailSealed &&
+            ((segmentAt(_tail - 1).size + itemAt(offset)) <= segmentLimit())) {
+            room = segmentLimit() - segmentAt(_tail - 1).size;
+        }
+
+        size_t runSize = 0;
+        size_t runCount = 0;
+        while ((_stagingUsed > (offset + runSize)) &&
+               ((0 == runCount) || ((runSize + itemAt(offset + runSize)) <= room))) {
+            runSize += itemAt(offset + runSize);
+            runCount++;
+        }
+
+        if (!appendItems(_staging + offset, runSize, nullptr, 0, runCount)) {
+            // These items are lost but the rest may still fit
+            success = false;
+        }
+        offset += runSize;
+    }
+
+    _stagingUsed = 0;
+    _stagingCount = 0;
+    return success;
+}
+
+int DiskQueue::flush() {
+    // The lock here is to prevent the reader and writer from running
+    const std::lock_guard<RecursiveMutex> lock(_lock);
+
+    return flushStaging() ? SYSTEM_ERROR_NONE : SYSTEM_ERROR_FILE;
+}
+
+void DiskQueue::tick() {
+    // The lock here is to prevent the reader and writer from running
+    const std::lock_guard<RecursiveMutex> lock(_lock);
+
+    if (_stagingCount && ((millis() - _stagingSince) >= _commitWindow)) {
+        flushStaging();
+    }
+}
+
+int DiskQueue::setCommitWindow(system_tick_t window, size_t size) {
+    // The lock here is to prevent the writer from using the staging buffer while it changes
+    const std::lock_guard<RecursiveMutex> lock(_lock);
+
+    flushStaging();
+    _commitWindow = window;
+
+    // Without a window every item is written as it is pushed
+    size_t stagingSize = (window) ? size : 0;
+    if (stagingSize != _stagingSize) {
+        delete[] _staging;
+        _staging = nullptr;
+        _stagingSize = 0;
+
+        if (stagingSize) {
+            _staging = new uint8_t[stagingSize];
+            CHECK_TRUE(_staging, SYSTEM_ERROR_NO_MEMORY);
+            _stagingSize = stagingSize;
+        }
+    }
+
+    return SYSTEM_ERROR_NONE;
+}
+
+int DiskQueue::setCompression(bool enable, const uint8_t* dictionary, size_t size) {
+    // The lock here is to prevent the reader and writer from using the codec while it changes
+    const std::lock_guard<RecursiveMutex> lock(_lock);
+
+    delete _codec;
+    _codec = nullptr;
+    _compress = false;
+    _dictionary = dictionary;
+    _dictionarySize = (dictionary) ? size : 0;
+
+    // Without compression a codec is only made if compressed items are read
+    if (enable) {
+        _codec = new DiskQueueCodec(_dictionary, _dictionarySize);
+        CHECK_TRUE(_codec, SYSTEM_ERROR_NO_MEMORY);
+        _compress = true;
+    }
+
+    return SYSTEM_ERROR_NONE;
+}
+
 bool DiskQueue::pushBack(const char* data) {
     auto size = strlen(data);
     return pushBack((uint8_t*)data, size);
@@ -327,10 +680,15 @@ bool DiskQueue::pushBack(const String& data) {
  * @return Vector<unsigned long> An array of the file numbers.
  */
 Vector<unsigned long> DiskQueue::list() {
+    // The lock here is to prevent the writer from changing the index while it is copied
+    const std::lock_guard<RecursiveMutex> lock(_lock);
+
     Vector<unsigned long> fileList;
 
-    for (auto item = _fileList.begin();item != _fileList.end();++item) {
-        fileList.append((*item)->n);
+    for (auto n = _head; _tail != n; ++n) {
+        if (segmentAt(n).size) {
+            fileList.append(n);
+        }
     }
 
     return fileList;
@@ -347,117 +705,264 @@ bool DiskQueue::dirExists(const char* path) {
     return false;
 }
 
-int DiskQueue::sortPartition(Vector<FileEntry*>& array, int begin, int end) {
-    FileEntry* last = array[end];
-    int pivot = (begin - 1);
+void DiskQueue::cleanupFiles() {
+    closeReadFile();
+
+    _head = 0;
+    _tail = 0;
+    _diskCurrent = 0;
+    _itemCount = 0;
+    _readOffset = sizeof(QueueFileHeader);
+    _tailSealed = false;
+    _stagingUsed = 0;
+    _stagingCount = 0;
+    _batchValid = false;
+}
+
+void DiskQueue::unlinkFiles() {
+    // The lock here is to prevent the reader and writer from running
+    const std::lock_guard<RecursiveMutex> lock(_lock);
+
+    closeReadFile();
 
-    for (int i = begin; i <= (end - 1); ++i) {
-        if (array[i]->n <= last->n) {
-            std::swap<FileEntry*>(array[++pivot], array[i]);
+    for (auto n = _head; _tail != n; ++n) {
+        if (segmentAt(n).size) {
+            unlink(segmentPath(n).c_str());
         }
     }
-    std::swap<FileEntry*>(array[pivot + 1], array[end]);
+    unlink((_path + QueueCursorFilename).c_str());
 
-    return (pivot + 1);
+    cleanupFiles();
 }
 
-void DiskQueue::quickSortFiles(Vector<FileEntry*>& array, int begin, int end)
-{
-    if (array.isEmpty()) {
-        // Done
-        return;
+void DiskQueue::closeReadFile() {
+    if (0 <= _readFd) {
+        close(_readFd);
+        _readFd = -1;
     }
+}
 
-    Vector<int> stack(end - begin + 1, 0);
+bool DiskQueue::reserveSegments(size_t count) {
+    if (_segmentCapacity >= count) {
+        return true;
+    }
 
-    int top = -1;
+    size_t capacity = (_segmentCapacity) ? _segmentCapacity : InitialSegmentCapacity;
+    while (capacity < count) {
+        capacity *= 2;
+    }
 
-    stack[++top] = begin;
-    stack[++top] = end;
+    auto segments = new SegmentEntry[capacity];
+    CHECK_TRUE(segments, false);
 
-    while (0 <= top) {
-        end = stack[top--];
-        begin = stack[top--];
+    // Entries are placed by segment number so they move when the mask changes
+    for (auto n = _head; _tail != n; ++n) {
+        segments[n & (capacity - 1)] = segmentAt(n);
+    }
+    delete[] _segments;
+    _segments = segments;
+    _segmentCapacity = capacity;
 
-        int pivot = sortPartition(array, begin, end);
+    return true;
+}
 
-        if ((pivot - 1) > begin) {
-            stack[++top] = begin;
-            stack[++top] = pivot - 1;
-        }
+void DiskQueue::addSegment(size_t size, size_t count) {
+    auto& entry = segmentAt(_tail++);
+    entry.size = size;
+    entry.count = count;
+    _diskCurrent += size;
+    _itemCount += count;
+}
 
-        if ((pivot + 1) < end) {
-            stack[++top] = pivot + 1;
-            stack[++top] = end;
-        }
+void DiskQueue::forgetSegment(unsigned long n) {
+    auto& entry = segmentAt(n);
+    _diskCurrent -= std::min(_diskCurrent, (size_t)entry.size);
+    _itemCount -= std::min(_itemCount, (size_t)entry.count);
+    entry.size = 0;
+    entry.count = 0;
+}
+
+void DiskQueue::removeFrontSegment() {
+    if (_head == _tail) {
+        return;
+    }
+
+    closeReadFile();
+    if (segmentAt(_head).size) {
+        unlink(segmentPath(_head).c_str());
+    }
+    forgetSegment(_head);
+    ++_head;
+
+    // The next segment is read from its start which doesn't need a cursor
+    _readOffset = sizeof(QueueFileHeader);
+    unlink((_path + QueueCursorFilename).c_str());
+
+    if (_head == _tail) {
+        _tailSealed = false;
     }
 }
 
-void DiskQueue::cleanupFiles() {
-    if (!_fileList.isEmpty()) {
-        for (auto item = _fileList.begin(); _fileList.end() != item; ++item) {
-            removeFileNode(*item);
-        }
+void DiskQueue::writeCursor() {
+    if (_head == _tail) {
+        return;
     }
 
-    _fileList.clear();
+    QueueCursor cursor = {};
+    cursor.magic = QueueCursorMagic;
+    cursor.segment = (uint32_t)_head;
+    cursor.offset = (uint32_t)_readOffset;
+    cursor.crc = crc32(0, &cursor, offsetof(QueueCursor, crc));
+
+    auto fd = open((_path + QueueCursorFilename).c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0664);
+    if (0 > fd) {
+        return;
+    }
+    write(fd, &cursor, sizeof(cursor));
+    close(fd);
 }
 
-void DiskQueue::unlinkFiles() {
-    // The lock here is to prevent the reader and writer from running
-    const std::lock_guard<RecursiveMutex> lock(_lock);
+void DiskQueue::scanFiles() {
+    String cursorPath = _path + QueueCursorFilename;
+
+    // Find where reading left off
+    QueueCursor cursor = {};
+    bool haveCursor = false;
+    auto fd = open(cursorPath.c_str(), O_RDONLY);
+    if (0 <= fd) {
+        haveCursor = ((int)sizeof(cursor) == read(fd, &cursor, sizeof(cursor))) &&
+            (QueueCursorMagic == cursor.magic) &&
+            (crc32(0, &cursor, offsetof(QueueCursor, crc)) == cursor.crc);
+        close(fd);
+    }
 
-    if (!_fileList.isEmpty()) {
-        for (auto item = _fileList.begin(); _fileList.end() != item; ++item) {
+    if (haveCursor && (_head <= cursor.segment) && (_tail > cursor.segment)) {
+        // Segments before the cursor were read completely but not removed
+        while (_head != cursor.segment) {
+            unlink(segmentPath(_head++).c_str());
+        }
+    } else {
+        haveCursor = false;
+        unlink(cursorPath.c_str());
+    }
 
-            unsigned long fileN = (*item)->n;
-            String filename = _path + String(fileN);
+    _readOffset = sizeof(QueueFileHeader);
+    _tailSealed = false;
 
-            auto fd = open(filename.c_str(), O_RDWR, 0664);
-            if(0 <= fd) {
-                // File open is succesfull so remove file and continue
-                unlink(filename.c_str());
-                continue;
+    for (auto n = _head; _tail != n; ++n) {
+        size_t from = sizeof(QueueFileHeader);
+        if ((_head == n) && haveCursor) {
+            from = std::max<size_t>(from, (size_t)cursor.offset);
+        }
+
+        size_t size = 0;
+        size_t count = 0;
+        bool appendable = false;
+        fd = open(segmentPath(n).c_str(), O_RDWR);
+        if (0 <= fd) {
+            // Only the newest segment can end in a write cut short, items in the others are
+            // checked as they are read
+            appendable = scanFile(fd, (_tail - 1) == n, from, size, count);
+            close(fd);
+        }
+
+        if (0 == size) {
+            // Missing from the sequence, can't be opened or isn't a queue file
+            if (0 <= fd) {
+                unlink(segmentPath(n).c_str());
             }
+            continue;
+        }
+
+        auto& entry = segmentAt(n);
+        entry.size = size;
+        entry.count = count;
+        _diskCurrent += size;
+        _itemCount += count;
+        if (_head == n) {
+            _readOffset = from;
         }
+        _tailSealed = !appendable;
     }
-}
 
-void DiskQueue::cleanup() {
+    // Gaps at either end don't need entries
+    while ((_head != _tail) && (0 == segmentAt(_head).size)) {
+        ++_head;
+        _readOffset = sizeof(QueueFileHeader);
+    }
+    while ((_head != _tail) && (0 == segmentAt(_tail - 1).size)) {
+        --_tail;
+        _tailSealed = false;
+    }
 }
 
-DiskQueue::FileEntry* DiskQueue::addFileNode(unsigned long n, size_t size, bool append) {
-    FileEntry* entry = new FileEntry;
-    if (!entry) {
-        return nullptr;
+bool DiskQueue::scanFile(int fd, bool newest, size_t& from, size_t& size, size_t& count) {
+    size = 0;
+    count = 0;
+
+    struct stat st = {};
+    QueueFileHeader fileHeader = {};
+    if (fstat(fd, &st) ||
+        ((int)sizeof(fileHeader) > read(fd, &fileHeader, sizeof(fileHeader))) ||
+        (QueueFileMagic != fileHeader.magic) ||
+        ((QueueFileVersion1 != fileHeader.version) && (QueueFileVersion2 != fileHeader.version))) {
+
+        return false;
     }
-    entry->n = n;
-    entry->size = size;
 
-    if (append) {
-        _fileList.append(entry);
-        _diskCurrent += size;
+    // Items before the cursor were already read so the walk starts at the cursor
+    if (from > (size_t)st.st_size) {
+        from = sizeof(fileHeader);
     }
 
-    return entry;
-}
+    size_t offset = from;
+    while ((size_t)st.st_size > offset) {
+        QueueItemHeader itemHeader = {};
+        size_t next = offset + sizeof(itemHeader);
+        if ((next > (size_t)st.st_size) ||
+            ((off_t)offset != lseek(fd, offset, SEEK_SET)) ||
+            ((int)sizeof(itemHeader) > read(fd, &itemHeader, sizeof(itemHeader))) ||
+            (QueueItemMagic != itemHeader.magic)) {
+            break;
+        }
 
-void DiskQueue::removeFileNode(FileEntry* entry) {
-    delete entry;
-}
+        next = offset + storedSize(itemHeader);
+        if ((next > (size_t)st.st_size) ||
+            (newest && !checkItem(fd, itemHeader))) {
+            break;
+        }
 
-void DiskQueue::removeFileNode(int index) {
-    if ((0 <= index) && (_fileList.size() > index)) {
-        auto entry = _fileList.at(index);
-        if (_diskCurrent >= entry->size) {
-            _diskCurrent -= entry->size;
-        } else {
-            // TODO: illegal, assert here?
-            _diskCurrent = 0;
+        if (ItemFlagActive & itemHeader.flags) {
+            count++;
         }
-        removeFileNode(entry);
-        _fileList.removeAt(index);
+        offset = next;
+    }
+
+    size = offset;
+
+    // Only the newest segment may have more items appended, once anything after the last good
+    // item, such as an item cut short by a loss of power, has been taken back.  The walk never
+    // starts before the cursor so unread items are never taken back.
+    if (!newest || (QueueFileVersion2 != fileHeader.version)) {
+        return false;
+    }
+    return ((size_t)st.st_size == offset) || (0 == ftruncate(fd, offset));
+}
+
+bool DiskQueue::checkItem(int fd, const QueueItemHeader& header) {
+    if (0 == (ItemFlagChecksum & header.flags)) {
+        // Items written before checksums were added are taken as they are
+        return true;
     }
+
+    uint32_t expected = 0;
+    uint32_t crc = crc32(0, &header, sizeof(header));
+    return ((int)sizeof(expected) == read(fd, &expected, sizeof(expected))) &&
+        readCrc32(fd, header.length, crc) &&
+        (expected == crc);
+}
+
+void DiskQueue::cleanup() {
 }
 
 int DiskQueue::getFilenames(const char* path) {
@@ -466,27 +971,53 @@ int DiskQueue::getFilenames(const char* path) {
         return SYSTEM_ERROR_NOT_FOUND;
     }
 
+    // Segments are numbered in sequence so the first and last number are enough to index them
+    bool found = false;
+    unsigned long first = 0;
+    unsigned long last = 0;
     struct dirent* ent = nullptr;
     while (nullptr != (ent = readdir(dir))) {
-        if (DT_REG != ent->d_type) {
+        unsigned long n = 0;
+        if (!segmentNumber(ent, n)) {
             continue;
         }
+        first = (found) ? std::min(first, n) : n;
+        last = (found) ? std::max(last, n) : n;
+        found = true;
+    }
 
-        String filename = String(path) + "/" + String(ent->d_name);
-        struct stat st = {};
-        stat(filename.c_str(), &st);
-        char* stop = nullptr;
-        unsigned long n = strtoul(ent->d_name, &stop, 10);
-        if (strlen(ent->d_name) == (size_t)(stop - ent->d_name)) {
-            FileEntry* entry = addFileNode(n, st.st_size);
-            CHECK_TRUE(entry, SYSTEM_ERROR_NO_MEMORY);
+    if (found && ((last - first) >= MaxSegmentSpan)) {
+        // Too far behind the newest segment to be indexed, likely left over from long ago
+        first = last - MaxSegmentSpan + 1;
+        rewinddir(dir);
+        while (nullptr != (ent = readdir(dir))) {
+            unsigned long n = 0;
+            if (segmentNumber(ent, n) && (first > n)) {
+                unlink(segmentPath(n).c_str());
+            }
         }
     }
 
-    quickSortFiles(_fileList, 0, _fileList.size() - 1);
-
     closedir(dir);
 
+    _head = first;
+    _tail = first;
+    if (found) {
+        CHECK_TRUE(reserveSegments(last - first + 1), SYSTEM_ERROR_NO_MEMORY);
+        for (_tail = first; (last + 1) != _tail; ++_tail) {
+            segmentAt(_tail) = {};
+        }
+    }
+
     return SYSTEM_ERROR_NONE;
 }
 
+bool DiskQueue::segmentNumber(const struct dirent* ent, unsigned long& n) {
+    if (DT_REG != ent->d_type) {
+        return false;
+    }
+
+    char* stop = nullptr;
+    n = strtoul(ent->d_name, &stop, 10);
+    return ('\0' != ent->d_name[0]) && (strlen(ent->d_name) == (size_t)(stop - ent->d_name));
+}
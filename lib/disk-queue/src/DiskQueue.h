@@ -17,6 +17,9 @@
 #pragma once
 
 #include "Particle.h"
+#include "DiskQueueCodec.h"
+
+struct dirent;
 
 /**
  * @brief Structure for holding status and diagnostics information
@@ -33,7 +36,15 @@ enum class DiskQueuePolicy {
 
 /**
  * @brief The <code>DiskQueue</code> class represents a disk-based queue that
+ * appends items to a log of segment files.
+ *
+ * Each segment file holds many items back to back.  Items are consumed from the oldest segment
+ * and the position of the next unread item is persisted in a small cursor file so that a restart
+ * resumes where reading left off.  A segment is removed once all of its items have been popped,
+ * or as a whole when space is needed for newer items.
  *
+ * Every item carries a CRC32.  When starting, a segment that ends in an item cut short or damaged
+ * by a loss of power is truncated back to its last good item and appended to as usual.
  */
 
 class DiskQueue {
@@ -47,6 +58,28 @@ public:
     DiskQueue(size_t diskLimit = 0)
     : _diskLimit(diskLimit),
       _diskCurrent(0),
+      _segmentSize(DefaultSegmentSize),
+      _itemCount(0),
+      _readOffset(0),
+      _readFd(-1),
+      _tailSealed(false),
+      _segments(nullptr),
+      _segmentCapacity(0),
+      _head(0),
+      _tail(0),
+      _staging(nullptr),
+      _stagingSize(0),
+      _stagingUsed(0),
+      _stagingCount(0),
+      _stagingSince(0),
+      _commitWindow(0),
+      _batchSegment(0),
+      _batchOffset(0),
+      _batchValid(false),
+      _codec(nullptr),
+      _dictionary(nullptr),
+      _dictionarySize(0),
+      _compress(false),
       _policy(DiskQueuePolicy::FifoDeleteOld),
       _running(false) {
 
@@ -59,6 +92,9 @@ public:
     ~DiskQueue() {
         cleanupFiles();
         cleanup();
+        delete[] _staging;
+        delete[] _segments;
+        delete _codec;
     }
 
     /**
@@ -115,6 +151,74 @@ public:
         return _diskLimit;
     }
 
+    /**
+     * @brief Set the preferred segment file size.  Segments are made smaller than this when the
+     * disk limit is too small to hold several of them.
+     *
+     * @param size Size in bytes.
+     */
+    void setSegmentSize(size_t size);
+
+    /**
+     * @brief Get the preferred segment file size in bytes.
+     *
+     * @return size_t Size in bytes.
+     */
+    size_t getSegmentSize() const {
+        return _segmentSize;
+    }
+
+    /**
+     * @brief Hold pushed items in RAM and write them to disk together, with a single sync, once
+     * the staging buffer fills or the oldest held item has waited for the commit window.  Held
+     * items are lost if power is lost before they are written.
+     *
+     * @param[in]   window          Longest time an item is held before being written in milliseconds, zero to write each item as it is pushed
+     * @param[in]   size            Size of the staging buffer in bytes
+     * @retval SYSTEM_ERROR_NONE
+     * @retval SYSTEM_ERROR_NO_MEMORY
+     */
+    int setCommitWindow(system_tick_t window, size_t size = DefaultStagingSize);
+
+    /**
+     * @brief Get the commit window in milliseconds.
+     *
+     * @return system_tick_t Time in milliseconds, zero if items are written as they are pushed.
+     */
+    system_tick_t getCommitWindow() const {
+        return _commitWindow;
+    }
+
+    /**
+     * @brief Compress items as they are pushed.  Items are compressed on their own, so a dictionary
+     * of data typical of the items, such as a sample item, is what makes short items smaller.
+     * Items that don't get smaller are stored as they are.  Compressed items are read back with
+     * the dictionary set when they are read, so keep it the same across restarts.  The codec takes
+     * about 8KB of heap, which is only allocated while compressing or once a compressed item is read.
+     *
+     * @param[in]   enable          Compress items pushed from now on
+     * @param[in]   dictionary      Data typical of the items, kept by reference so it must stay valid
+     * while the queue is in use, such as a constant.  May be nullptr.
+     * @param[in]   size            Size of the dictionary in bytes
+     * @retval SYSTEM_ERROR_NONE
+     * @retval SYSTEM_ERROR_NO_MEMORY
+     */
+    int setCompression(bool enable, const uint8_t* dictionary = nullptr, size_t size = 0);
+
+    /**
+     * @brief Write all held items to disk.  Call before sleeping or powering down.
+     *
+     * @retval SYSTEM_ERROR_NONE
+     * @retval SYSTEM_ERROR_FILE
+     */
+    int flush();
+
+    /**
+     * @brief Write held items once the commit window has passed.  Call periodically when a commit
+     * window is set.
+     */
+    void tick();
+
     /**
      * @brief Get the current disk usage in bytes.
      *
@@ -139,6 +243,28 @@ public:
      */
     bool peekFront(uint8_t* data, size_t& size);
 
+    /**
+     * @brief Copy items from the front of the read queue without removing them, as many as fit.
+     * Pass the number of items sent on to commitBatch() to remove them once they are no longer
+     * needed.
+     *
+     * @param[out]     data     Buffer to copy the items into, back to back
+     * @param[in]      maxBytes Size of the buffer.  The first item is cut short if it doesn't fit.
+     * @param[out]     sizes    Size of each item copied
+     * @param[in]      maxCount Most items to copy, the number of entries in sizes
+     * @return size_t Number of items copied, zero if empty
+     */
+    size_t peekBatch(uint8_t* data, size_t maxBytes, size_t* sizes, size_t maxCount);
+
+    /**
+     * @brief Remove items returned by the last peekBatch() from the front of the read queue.
+     *
+     * @param[in]      count    Number of items to remove
+     * @return true Items have been removed
+     * @return false Front of the queue has changed since the batch was peeked so nothing was removed
+     */
+    bool commitBatch(size_t count);
+
     /**
      * @brief Get size of data from read queue if available.
      *
@@ -181,20 +307,20 @@ public:
      * @return false Queue is not empty
      */
     bool isEmpty() const {
-        return _fileList.isEmpty();
+        return (0 == _itemCount) && (0 == _stagingCount);
     }
 
     /**
-     * @brief Get the size of elements on disk in bytes.
+     * @brief Get the number of items in the queue.
      *
-     * @return size_t Number of bytes on disk
+     * @return size_t Number of unread items on disk and held for writing
      */
     size_t size() const {
-        return (size_t)_fileList.size();
+        return _itemCount + _stagingCount;
     }
 
     /**
-     * @brief Destroy file number array.
+     * @brief Forget all segments without removing their files.
      *
      */
     void cleanupFiles();
@@ -212,19 +338,32 @@ public:
     void cleanup();
 
     /**
-     * @brief Get list of file numbers that represent disk queue data filenames.
+     * @brief Get list of file numbers that represent disk queue segment filenames.
      *
-     * @return Vector<unsigned long> An array of the file numbers.
+     * @return Vector<unsigned long> An array of the file numbers, oldest first.
      */
     Vector<unsigned long> list();
 
 private:
     static constexpr uint8_t QueueFileMagic = 'P';          //< Magic number that must be present at the beginning of each queue file
-    static constexpr uint8_t QueueFileVersion1 = 0x01;      //< Current version of the file
+    static constexpr uint8_t QueueFileVersion1 = 0x01;      //< Version of files holding a single item
+    static constexpr uint8_t QueueFileVersion2 = 0x02;      //< Current version of the file, a segment holding many items
     static constexpr uint8_t FileFlagReverse = (1 << 0);    //< Flag to indicate that the queue is to be popped in reverse order
 
     static constexpr uint8_t QueueItemMagic = 0xf0;         //< Magic number that must be present at the beginning of each queue item
     static constexpr uint8_t ItemFlagActive = (1 << 0);     //< Flag to indicate that the queue item is still active
+    static constexpr uint8_t ItemFlagCompressed = (1 << 1); //< Flag to indicate that the queue item data is compressed
+    static constexpr uint8_t ItemFlagChecksum = (1 << 2);   //< Flag to indicate that a CRC32 of the header and data follows the header
+
+    static constexpr uint8_t QueueCursorMagic = 'C';        //< Magic number that must be present at the beginning of the cursor file
+    static constexpr const char* QueueCursorFilename = "cursor"; //< Name of the file holding the read position
+
+    static constexpr size_t DefaultSegmentSize = 16 * 1024; //< Preferred size of a segment file
+    static constexpr size_t MinSegmentSize = 1024;          //< Smallest segment size chosen for small disk limits
+    static constexpr size_t MinSegmentsPerLimit = 8;        //< Number of segments the disk limit should hold at least
+    static constexpr size_t DefaultStagingSize = 2048;      //< Staging buffer size when a commit window is set
+    static constexpr size_t InitialSegmentCapacity = 8;     //< Number of segment entries in a new index
+    static constexpr unsigned long MaxSegmentSpan = 4096;   //< Most segment numbers indexed when starting, older files are removed
 
 #pragma pack(push,1)
     struct QueueFileHeader {
@@ -237,18 +376,34 @@ private:
         uint8_t flags;          //< Various item specific flags
         uint16_t length;        //< Length of data immediately following this structure
     };
+    struct QueueCursor {
+        uint8_t magic;          //< Magic number must be 'C'
+        uint8_t reserved[3];    //< Unused, must be zero
+        uint32_t segment;       //< File number of the segment being read
+        uint32_t offset;        //< Offset of the next unread item within the segment
+        uint32_t crc;           //< CRC32 of the fields above
+    };
 #pragma pack(pop)
 
     /**
-     * @brief A structure containing the disk based file numbers and filenames.
+     * @brief Index entry for a segment file, found by segment number in a ring.
      *
      */
-    struct FileEntry {
-        unsigned long n;
-        int fd;
-        size_t size;
+    struct SegmentEntry {
+        uint32_t size;          //< Bytes of valid items, including the file header, zero if there is no file
+        uint32_t count;         //< Number of unread items
     };
 
+    /**
+     * @brief Get the size of an item on disk.
+     *
+     * @param[in]   header          Header of the item
+     * @return size_t Size of the header, checksum and data in bytes
+     */
+    static size_t storedSize(const QueueItemHeader& header) {
+        return sizeof(header) + ((ItemFlagChecksum & header.flags) ? sizeof(uint32_t) : 0) + header.length;
+    }
+
     /**
      * @brief Detect if path exists.
      *
@@ -259,48 +414,48 @@ private:
     bool dirExists(const char* path);
 
     /**
-     * @brief Quicksort partition for file numbers.
+     * @brief Get the index entry of a segment between the head and tail.
      *
-     * @param[in,out]   array       Array of file numbers to partition
-     * @param[in]       begin       First index to consider (inclusive)
-     * @param[in]       end         Last index to consider (inclusive)
-     * @return int The pivot of the partition.
+     * @param[in]   n               File number
+     * @return SegmentEntry& Index entry
      */
-    int sortPartition(Vector<FileEntry*>& array, int begin, int end);
+    SegmentEntry& segmentAt(unsigned long n) {
+        return _segments[n & (_segmentCapacity - 1)];
+    }
 
     /**
-     * @brief Quicksort algorithm for file numbers.
+     * @brief Grow the index so that it can hold the given number of segments.
      *
-     * @param[in,out]   array       Array of file numbers to sort
-     * @param[in]       begin       First index to consider (inclusive)
-     * @param[in]       end         Last index to consider (inclusive)
+     * @param[in]   count           Number of segments
+     * @return true Index is large enough
+     * @return false Index could not be allocated
      */
-    void quickSortFiles(Vector<FileEntry*>& array, int begin, int end);
+    bool reserveSegments(size_t count);
 
     /**
-     * @brief Create (allocate) FileEntry object and initialize it with given
-     * file number and file name.  Optionally append it to file list.
+     * @brief Add an entry for a new segment after the tail.  Space must have been reserved.
      *
-     * @param[in]   n               File number, also filename
      * @param[in]   size            File size.
-     * @param[in]   append          Append to end of file list.  True to append.  False to not append.
-     * @return FileEntry* Allocated FileEntry object pointer.  nullptr if unsuccessful.
+     * @param[in]   count           Number of items in the file.
      */
-    FileEntry* addFileNode(unsigned long n, size_t size, bool append = true);
+    void addSegment(size_t size, size_t count);
 
     /**
-     * @brief Destroy FileEntry object.
+     * @brief Clear the entry for a segment and remove it from the totals.
      *
-     * @param[in]   entry           FileEntry object to delete.
+     * @param[in]   n               File number
      */
-    void removeFileNode(FileEntry* entry);
+    void forgetSegment(unsigned long n);
 
     /**
-     * @brief Remove and destroy FileEntry object from file list.
+     * @brief Parse a directory entry name as a segment file number.
      *
-     * @param[in]   index           Index into the file list.
+     * @param[in]   ent             Directory entry
+     * @param[out]  n               File number
+     * @return true Entry is a segment file
+     * @return false Entry is something else
      */
-    void removeFileNode(int index);
+    static bool segmentNumber(const struct dirent* ent, unsigned long& n);
 
     enum class ItemState {
         InvalidMagic,
@@ -309,7 +464,7 @@ private:
     };
 
     /**
-     * @brief Get the file numbers associated under the given path.
+     * @brief Index the range of file numbers associated under the given path.
      *
      * @param[in]   path            Full path for search
      * @retval SYSTEM_ERROR_NONE
@@ -319,25 +474,154 @@ private:
     int getFilenames(const char* path);
 
     /**
-     * @brief Get read index
+     * @brief Count the items in every segment, skipping those before the persisted read cursor.
+     *
+     */
+    void scanFiles();
+
+    /**
+     * @brief Count the items of a segment from the read cursor.  The newest segment also has each
+     * item checked and anything after the last good item truncated.
+     *
+     * @param[in]   fd              Segment file open for reading and writing
+     * @param[in]   newest          Segment is the newest, the only one that can hold a torn write
+     * @param[in,out] from          Offset of the first item to count, reset to the first item if
+     *                              past the end of the file
+     * @param[out]  size            Offset just past the last valid item
+     * @param[out]  count           Number of valid items from the given offset
+     * @return true Segment may be appended to
+     * @return false Segment isn't the newest, has an older version or trailing data that couldn't
+     * be truncated
+     */
+    bool scanFile(int fd, bool newest, size_t& from, size_t& size, size_t& count);
+
+    /**
+     * @brief Get the effective segment size for the current disk limit.
+     *
+     * @return size_t Size in bytes.
+     */
+    size_t segmentLimit() const;
+
+    /**
+     * @brief Read the header of the front item, discarding segments that can't be read.
+     *
+     * @param[out]  header          Header of the front item
+     * @return true Header is valid and the read file is positioned at the item data
+     * @return false No item is available
+     */
+    bool readFrontHeader(QueueItemHeader& header);
+
+    /**
+     * @brief Read the data of an item, checking and decompressing it if needed.  The file must be
+     * positioned just after the item header.
+     *
+     * @param[in]   fd              Open segment file
+     * @param[in]   header          Header of the item
+     * @param[out]  data            Buffer to copy the data into
+     * @param[in,out] size          [in] maximum buffer size available for copying data into, [out] size written
+     * @param[in]   whole           Refuse the item rather than cut it short when it doesn't fit
+     * @retval SYSTEM_ERROR_NONE
+     * @retval SYSTEM_ERROR_TOO_LARGE
+     * @retval SYSTEM_ERROR_FILE
+     * @retval SYSTEM_ERROR_BAD_DATA
+     * @retval SYSTEM_ERROR_NO_MEMORY
+     */
+    int readItem(int fd, const QueueItemHeader& header, uint8_t* data, size_t& size, bool whole);
+
+    /**
+     * @brief Check the data of an item against its CRC32 without keeping it.  The file must be
+     * positioned just after the item header.
      *
-     * @param[in]   policy          Policy to apply for read file deletion
-     * @return int Index for read deletion
+     * @param[in]   fd              Open segment file
+     * @param[in]   header          Header of the item
+     * @return true Item is intact
+     * @return false Item is damaged or couldn't be read
      */
-    int getReadPolicyIndex(DiskQueuePolicy policy);
+    bool checkItem(int fd, const QueueItemHeader& header);
 
     /**
-     * @brief Get the index to delete
+     * @brief Append encoded items to the newest segment, starting a new segment if they don't fit.
+     * The items may be passed in two parts which are written back to back.
      *
-     * @param[in]   policy          Policy to apply for write overflow file deletion
-     * @return int Index for read deletion
+     * @param[in]   first           First part of the encoded items
+     * @param[in]   firstSize       Size of the first part
+     * @param[in]   second          Second part of the encoded items, may be nullptr
+     * @param[in]   secondSize      Size of the second part, may be zero
+     * @param[in]   count           Number of items in both parts
+     * @return true Items have been written
+     * @return false Items have not been written
      */
-    int getWriteOverflowPolicyIndex(DiskQueuePolicy policy);
+    bool appendItems(const uint8_t* first, size_t firstSize, const uint8_t* second, size_t secondSize, size_t count);
+
+    /**
+     * @brief Write held items to disk, a segment at a time.
+     *
+     * @return true All held items have been written
+     * @return false Some held items could not be written and were discarded
+     */
+    bool flushStaging();
+
+    /**
+     * @brief Remove the front item without saving the read position.
+     *
+     * @return true Item has been removed
+     * @return false No item is available
+     */
+    bool popItem();
+
+    /**
+     * @brief Remove the oldest segment and all of its unread items.
+     *
+     */
+    void removeFrontSegment();
+
+    /**
+     * @brief Save the read position so that popped items stay popped across restarts.
+     *
+     */
+    void writeCursor();
+
+    /**
+     * @brief Close the file used for reading if it is open.
+     *
+     */
+    void closeReadFile();
+
+    /**
+     * @brief Get the full path of a segment file.
+     *
+     * @param[in]   n               File number
+     * @return String Full path
+     */
+    String segmentPath(unsigned long n) const {
+        return _path + String(n);
+    }
 
     RecursiveMutex _lock;
-    Vector<FileEntry*> _fileList;
     size_t _diskLimit;
     size_t _diskCurrent;
+    size_t _segmentSize;
+    size_t _itemCount;
+    size_t _readOffset;
+    int _readFd;
+    bool _tailSealed;
+    SegmentEntry* _segments;
+    size_t _segmentCapacity;
+    unsigned long _head;
+    unsigned long _tail;
+    uint8_t* _staging;
+    size_t _stagingSize;
+    size_t _stagingUsed;
+    size_t _stagingCount;
+    system_tick_t _stagingSince;
+    system_tick_t _commitWindow;
+    unsigned long _batchSegment;
+    size_t _batchOffset;
+    bool _batchValid;
+    DiskQueueCodec* _codec;
+    const uint8_t* _dictionary;
+    size_t _dictionarySize;
+    bool _compress;
     String _path;
     DiskQueuePolicy _policy;
     bool _running;
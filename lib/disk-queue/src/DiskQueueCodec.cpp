@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2023 Particle Industries, Inc.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DiskQueueCodec.h"
+
+// Compressed items are the original length, a FNV-1a checksum of the dictionary, then groups of up to eight
+// literals or back references each preceded by a byte of flags, least significant bit first.  A
+// set flag marks a two byte back reference holding the distance in its low twelve bits and the
+// length less MinMatch in its high four bits.
+
+constexpr size_t DiskQueueCodec::MaxDictionarySize;
+constexpr size_t DiskQueueCodec::MaxMatch;
+
+DiskQueueCodec::DiskQueueCodec(const uint8_t* dictionary, size_t size)
+    : _dictionarySize((dictionary) ? std::min(size, MaxDictionarySize) : 0),
+      _dictionaryChecksum(2166136261u) {
+
+    memcpy(_window, dictionary, _dictionarySize);
+    for (size_t i = 0; i < _dictionarySize; i++) {
+        _dictionaryChecksum = (_dictionaryChecksum ^ _window[i]) * 16777619u;
+    }
+
+    // Chains through the dictionary are the same for every item so they are only built once
+    for (auto& head: _head) {
+        head = -1;
+    }
+    for (size_t position = 0; (position + MinMatch) <= _dictionarySize; position++) {
+        insert(position);
+    }
+    memcpy(_dictionaryHead, _head, sizeof(_head));
+}
+
+size_t DiskQueueCodec::compress(const uint8_t* data, size_t size) {
+    if ((MaxItemSize < size) || (HeaderSize >= size)) {
+        return 0;
+    }
+
+    memcpy(_window + _dictionarySize, data, size);
+    memcpy(_head, _dictionaryHead, sizeof(_head));
+
+    _buffer[0] = (uint8_t)size;
+    _buffer[1] = (uint8_t)(size >> 8);
+    memcpy(_buffer + 2, &_dictionaryChecksum, sizeof(_dictionaryChecksum));
+
+    // Give up once the output is no smaller than the input
+    size_t limit = size;
+    size_t out = HeaderSize;
+    size_t flags = 0;
+    unsigned int bit = 8;
+    size_t position = _dictionarySize;
+    size_t end = _dictionarySize + size;
+
+    while (end > position) {
+        if (8 == bit) {
+            if (limit <= out) {
+                return 0;
+            }
+            flags = out++;
+            _buffer[flags] = 0;
+            bit = 0;
+        }
+
+        size_t bestLength = 0;
+        size_t bestDistance = 0;
+        if ((end - position) >= MinMatch) {
+            auto longest = std::min(MaxMatch, end - position);
+            auto candidate = _head[hash(_window + position)];
+            for (size_t chain = 0; (0 <= candidate) && (MaxChain > chain); chain++) {
+                auto distance = position - (size_t)candidate;
+                if (MaxDistance < distance) {
+                    break;
+                }
+                size_t length = 0;
+                while ((longest > length) && (_window[candidate + length] == _window[position + length])) {
+                    length++;
+                }
+                if (bestLength < length) {
+                    bestLength = length;
+                    bestDistance = distance;
+                    if (longest == length) {
+                        break;
+                    }
+                }
+                candidate = _prev[candidate];
+            }
+        }
+
+        if (MinMatch <= bestLength) {
+            if (limit < (out + 2)) {
+                return 0;
+            }
+            _buffer[flags] |= (uint8_t)(1 << bit);
+            _buffer[out++] = (uint8_t)bestDistance;
+            _buffer[out++] = (uint8_t)(((bestLength - MinMatch) << 4) | (bestDistance >> 8));
+        } else {
+            if (limit < (out + 1)) {
+                return 0;
+            }
+            bestLength = 1;
+            _buffer[out++] = _window[position];
+        }
+        bit++;
+
+        for (size_t i = 0; i < bestLength; i++, position++) {
+            if ((position + MinMatch) <= end) {
+                insert(position);
+            }
+        }
+    }
+
+    return (limit > out) ? out : 0;
+}
+
+const uint8_t* DiskQueueCodec::decompress(const uint8_t* data, size_t size, size_t& decodedSize) {
+    if ((HeaderSize > size) || memcmp(data + 2, &_dictionaryChecksum, sizeof(_dictionaryChecksum))) {
+        return nullptr;
+    }
+
+    decodedSize = originalSize(data);
+    if (MaxItemSize < decodedSize) {
+        return nullptr;
+    }
+
+    size_t in = HeaderSize;
+    size_t position = _dictionarySize;
+    size_t end = _dictionarySize + decodedSize;
+
+    while (end > position) {
+        if (size <= in) {
+            return nullptr;
+        }
+        auto flags = data[in++];
+
+        for (unsigned int bit = 0; (8 > bit) && (end > position); bit++) {
+            if (0 == (flags & (1 << bit))) {
+                if (size <= in) {
+                    return nullptr;
+                }
+                _window[position++] = data[in++];
+                continue;
+            }
+
+            if (size < (in + 2)) {
+                return nullptr;
+            }
+            size_t distance = data[in] | ((size_t)(data[in + 1] & 0x0f) << 8);
+            size_t length = (data[in + 1] >> 4) + MinMatch;
+            in += 2;
+            if ((0 == distance) || (position < distance) || (end < (position + length))) {
+                return nullptr;
+            }
+
+            // Copied a byte at a time since the reference may overlap what it produces
+            for (size_t i = 0; i < length; i++, position++) {
+                _window[position] = _window[position - distance];
+            }
+        }
+    }
+
+    return _window + _dictionarySize;
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2023 Particle Industries, Inc.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "Particle.h"
+
+/**
+ * @brief The <code>DiskQueueCodec</code> class compresses queue items with an LZSS scheme whose
+ * window starts out holding a preset dictionary.
+ *
+ * Short items with the same structure as the dictionary, such as JSON events with the same keys,
+ * compress well because even their first occurrence of a key can refer back into the dictionary.
+ * Each compressed item starts with its original length and a checksum of the dictionary so
+ * that items written with a different dictionary are rejected rather than decoded wrongly.
+ */
+class DiskQueueCodec {
+
+public:
+    static constexpr size_t MaxItemSize = 1024;             //< Largest item that is compressed
+    static constexpr size_t MaxDictionarySize = 1024;       //< Longer dictionaries are cut short
+    static constexpr size_t HeaderSize = 6;                 //< Original length and dictionary checksum
+
+    /**
+     * @brief Construct a new DiskQueueCodec object for the given dictionary.
+     *
+     * @param[in]   dictionary      Data typical of the items, copied by the codec.  May be nullptr.
+     * @param[in]   size            Size of the dictionary
+     */
+    DiskQueueCodec(const uint8_t* dictionary, size_t size);
+
+    /**
+     * @brief Compress an item into the codec buffer.
+     *
+     * @param[in]   data            Item to compress
+     * @param[in]   size            Size of the item
+     * @return size_t Size of the compressed item in buffer(), zero if the item is too large or
+     * doesn't get smaller
+     */
+    size_t compress(const uint8_t* data, size_t size);
+
+    /**
+     * @brief Decompress an item.
+     *
+     * @param[in]   data            Compressed item, may be buffer()
+     * @param[in]   size            Size of the compressed item
+     * @param[out]  decodedSize     Size of the original item
+     * @return const uint8_t* Original item, valid until the codec is next used.  nullptr if the
+     * item is damaged or was written with a different dictionary.
+     */
+    const uint8_t* decompress(const uint8_t* data, size_t size, size_t& decodedSize);
+
+    /**
+     * @brief Get the original size of a compressed item from its header.
+     *
+     * @param[in]   header          First HeaderSize bytes of the compressed item
+     * @return size_t Size of the original item
+     */
+    static size_t originalSize(const uint8_t* header) {
+        return (size_t)header[0] | ((size_t)header[1] << 8);
+    }
+
+    /**
+     * @brief Get the buffer holding compressed items.
+     *
+     * @return uint8_t* Buffer of bufferSize() bytes
+     */
+    uint8_t* buffer() {
+        return _buffer;
+    }
+
+    /**
+     * @brief Get the size of the buffer holding compressed items.
+     *
+     * @return size_t Size in bytes
+     */
+    static constexpr size_t bufferSize() {
+        return HeaderSize + MaxItemSize;
+    }
+
+private:
+    static constexpr size_t MinMatch = 3;                   //< Shortest back reference
+    static constexpr size_t MaxMatch = 18;                  //< Longest back reference, four bits of length
+    static constexpr size_t MaxDistance = 4095;             //< Farthest back reference, twelve bits of distance
+    static constexpr size_t MaxChain = 32;                  //< Most earlier positions tried for each match
+    static constexpr size_t HashSize = 256;                 //< Number of hash chains
+
+    static size_t hash(const uint8_t* data) {
+        return ((data[0] << 4) ^ (data[1] << 2) ^ data[2]) & (HashSize - 1);
+    }
+
+    void insert(size_t position) {
+        auto& head = _head[hash(_window + position)];
+        _prev[position] = head;
+        head = (int16_t)position;
+    }
+
+    size_t _dictionarySize;
+    uint32_t _dictionaryChecksum;
+    int16_t _dictionaryHead[HashSize];
+    int16_t _head[HashSize];
+    int16_t _prev[MaxDictionarySize + MaxItemSize];
+    uint8_t _window[MaxDictionarySize + MaxItemSize];
+    uint8_t _buffer[HeaderSize + MaxItemSize];
+};
@@ -0,0 +1,11 @@
+#include "Particle.h"
+
+static system_tick_t mockTime = 1000;
+
+void mockAdvanceMillis(system_tick_t delta) {
+    mockTime += delta;
+}
+
+system_tick_t millis() {
+    return mockTime;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// List of the system errors used by the library
+#define SYSTEM_ERROR_NONE                   (0)
+#define SYSTEM_ERROR_UNKNOWN                (-100)
+#define SYSTEM_ERROR_NOT_FOUND              (-170)
+#define SYSTEM_ERROR_TOO_LARGE              (-190)
+#define SYSTEM_ERROR_INVALID_STATE          (-210)
+#define SYSTEM_ERROR_FILE                   (-225)
+#define SYSTEM_ERROR_NO_MEMORY              (-260)
+#define SYSTEM_ERROR_BAD_DATA               (-280)
+
+#define CHECK_TRUE(_expr, _ret) \
+        do { \
+            if (!(_expr)) { \
+                return _ret; \
+            } \
+        } while (false)
+
+#define CHECK_FALSE(_expr, _ret) CHECK_TRUE(!(_expr), _ret)
+
+#include "spark_wiring_vector.h"
+
+using namespace spark;
+
+typedef uint32_t system_tick_t;
+
+// Simulated clock, advanced explicitly by tests
+void mockAdvanceMillis(system_tick_t delta);
+system_tick_t millis();
+
+class RecursiveMutex : public std::recursive_mutex {
+};
+
+class String {
+public:
+    String() = default;
+    String(const char* str) : _str(str) {}
+    explicit String(unsigned long value) : _str(std::to_string(value)) {}
+
+    const char* c_str() const {
+        return _str.c_str();
+    }
+
+    unsigned int length() const {
+        return (unsigned int)_str.length();
+    }
+
+    String operator+(const String& other) const {
+        String result(*this);
+        result._str += other._str;
+        return result;
+    }
+
+    String operator+(const char* other) const {
+        return *this + String(other);
+    }
+
+private:
+    std::string _str;
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdio>
+#include <dirent.h>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Contents of the files in a directory, captured so that the directory can be put back
+ * into that state or a damaged version of it.
+ */
+class DiskImage {
+public:
+    std::map<std::string, std::vector<uint8_t>> files;
+
+    static DiskImage capture(const std::string& path) {
+        DiskImage image;
+        auto dir = opendir(path.c_str());
+        struct dirent* ent = nullptr;
+        while (dir && (nullptr != (ent = readdir(dir)))) {
+            if (DT_REG != ent->d_type) {
+                continue;
+            }
+            auto& data = image.files[ent->d_name];
+            auto file = std::fopen((path + "/" + ent->d_name).c_str(), "rb");
+            int c = 0;
+            while (file && (EOF != (c = std::fgetc(file)))) {
+                data.push_back((uint8_t)c);
+            }
+            if (file) {
+                std::fclose(file);
+            }
+        }
+        if (dir) {
+            closedir(dir);
+        }
+        return image;
+    }
+
+    void restore(const std::string& path) const {
+        auto current = capture(path);
+        for (auto& entry: current.files) {
+            std::remove((path + "/" + entry.first).c_str());
+        }
+        for (auto& entry: files) {
+            auto file = std::fopen((path + "/" + entry.first).c_str(), "wb");
+            std::fwrite(entry.second.data(), 1, entry.second.size(), file);
+            std::fclose(file);
+        }
+    }
+};
+
+/**
+ * @brief Call check with every state a directory could be left in if power were lost part way
+ * through the writes that took it from one image to the next.
+ *
+ * Queue files are either appended to or rewritten from the start, so each file that changed is
+ * cut short at every offset that was written.  The bytes after the cut are either missing or
+ * noise, as flash that was being programmed may read back either way.  Other files are left as
+ * they were before.
+ *
+ * @param before Image before the writes
+ * @param after Image after the writes
+ * @param check Called with the damaged image, the name of the file cut short and the offset of the cut
+ */
+template <typename Check>
+void forEachPowerCut(const DiskImage& before, const DiskImage& after, Check check) {
+    std::mt19937 random(1234);
+
+    for (auto& entry: after.files) {
+        auto& name = entry.first;
+        auto& written = entry.second;
+
+        size_t from = 0;
+        auto previous = before.files.find(name);
+        if ((before.files.end() != previous) && (previous->second.size() <= written.size()) &&
+            std::equal(previous->second.begin(), previous->second.end(), written.begin())) {
+            if (previous->second.size() == written.size()) {
+                continue; // Unchanged
+            }
+            from = previous->second.size();
+        }
+
+        for (size_t offset = from; offset < written.size(); offset++) {
+            auto image = before;
+            auto& cut = image.files[name];
+            cut.assign(written.begin(), written.begin() + offset);
+            check(image, name, offset);
+
+            while (cut.size() < written.size()) {
+                cut.push_back((uint8_t)random());
+            }
+            check(image, name, offset);
+        }
+    }
+}
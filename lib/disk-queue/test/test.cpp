@@ -0,0 +1,691 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <string>
+
+#include "DiskQueue.h"
+#include "PowerCut.h"
+
+// The library's error checking macros share names with Catch assertions
+#undef CHECK_TRUE
+#undef CHECK_FALSE
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+// Fresh directory for each queue under test
+class QueueDir {
+public:
+    QueueDir() {
+        char name[] = "/tmp/disk-queue-XXXXXX";
+        _path = mkdtemp(name);
+    }
+
+    ~QueueDir() {
+        std::string command = "rm -rf " + _path;
+        std::system(command.c_str());
+    }
+
+    const char* path() const {
+        return _path.c_str();
+    }
+
+    std::string file(const char* name) const {
+        return _path + "/" + name;
+    }
+
+    bool exists(const char* name) const {
+        struct stat st = {};
+        return !stat(file(name).c_str(), &st);
+    }
+
+private:
+    std::string _path;
+};
+
+static std::string item(int n) {
+    return "{\"cmd\":\"loc\",\"time\":" + std::to_string(1000000 + n) + ",\"loc\":{\"lat\":37.7,\"lon\":-122.4}}";
+}
+
+static std::string front(DiskQueue& queue) {
+    uint8_t buffer[256] = {};
+    size_t size = queue.peekFrontSize();
+    if (!queue.peekFront(buffer, size)) {
+        return "";
+    }
+    return std::string((const char*)buffer, size);
+}
+
+TEST_CASE("Items are kept in order across segments") {
+    QueueDir dir;
+    DiskQueue queue;
+    REQUIRE(SYSTEM_ERROR_NONE == queue.start(dir.path(), 64 * 1024));
+
+    for (int i = 0; i < 500; i++) {
+        REQUIRE(queue.pushBack(item(i).c_str()));
+    }
+    CHECK(queue.size() == 500);
+
+    // Many items share each file
+    auto segments = queue.list().size();
+    CHECK(segments > 1);
+    CHECK(segments < 20);
+    CHECK(queue.getCurrentDiskUsage() <= 64 * 1024);
+
+    for (int i = 0; i < 500; i++) {
+        REQUIRE(queue.peekFrontSize() == item(i).length());
+        REQUIRE(front(queue) == item(i));
+        queue.popFront();
+    }
+    CHECK(queue.isEmpty());
+    CHECK(queue.list().isEmpty());
+    CHECK(queue.getCurrentDiskUsage() == 0);
+    CHECK_FALSE(dir.exists("cursor"));
+}
+
+TEST_CASE("Read position survives a restart") {
+    QueueDir dir;
+    {
+        DiskQueue queue;
+        REQUIRE(SYSTEM_ERROR_NONE == queue.start(dir.path(), 64 * 1024));
+        for (int i = 0; i < 10; i++) {
+            REQUIRE(queue.pushBack(item(i).c_str()));
+        }
+        for (int i = 0; i < 3; i++) {
+            queue.popFront();
+        }
+        queue.stop();
+    }
+
+    DiskQueue queue;
+    REQUIRE(SYSTEM_ERROR_NONE == queue.start(dir.path(), 64 * 1024));
+    CHECK(queue.size() == 7);
+    CHECK(front(queue) == item(3));
+
+    // New items are appended after the existing ones
+    REQUIRE(queue.pushBack(item(10).c_str()));
+    for (int i = 3; i <= 10; i++) {
+        REQUIRE(front(queue) == item(i));
+        queue.popFront();
+    }
+    CHECK(queue.isEmpty());
+}
+
+TEST_CASE("Disk limit") {
+    QueueDir dir;
+    DiskQueue queue;
+    const size_t limit = 8 * 1024;
+
+    SECTION("Oldest segments are dropped") {
+        REQUIRE(SYSTEM_ERROR_NONE == queue.start(dir.path(), limit, DiskQueuePolicy::FifoDeleteOld));
+        for (int i = 0; i < 500; i++) {
+            REQUIRE(queue.pushBack(item(i).c_str()));
+            REQUIRE(queue.getCurrentDiskUsage() <= limit);
+        }
+        CHECK(queue.size() < 500);
+        CHECK(queue.size() > 100);
+
+        // Whatever is left is the newest items, in order
+        int first = 500 - (int)queue.size();
+        CHECK(front(queue) == item(first));
+    }
+
+    SECTION("Newest items are refused") {
+        REQUIRE(SYSTEM_ERROR_NONE == queue.start(dir.path(), limit, DiskQueuePolicy::FifoDeleteNew));
+        int pushed = 0;
+        while (queue.pushBack(item(pushed).c_str())) {
+            pushed++;
+        }
+        CHECK(queue.size() == (size_t)pushed);
+        CHECK(queue.getCurrentDiskUsage() <= limit);
+        CHECK(front(queue) == item(0));
+    }
+}
+
+TEST_CASE("Single item files from the previous format are read") {
+    QueueDir dir;
+    for (int i = 0; i < 3; i++) {
+        auto data = item(i);
+        uint8_t headers[] = {'P', 0x01, 0x00, 0xf0, 0x01, (uint8_t)data.length(), 0x00};
+        auto fd = open(dir.file(std::to_string(i).c_str()).c_str(), O_CREAT | O_WRONLY, 0664);
+        REQUIRE(0 <= fd);
+        REQUIRE(sizeof(headers) == (size_t)write(fd, headers, sizeof(headers)));
+        REQUIRE(data.length() == (size_t)write(fd, data.c_str(), data.length()));
+        close(fd);
+    }
+
+    DiskQueue queue;
+    REQUIRE(SYSTEM_ERROR_NONE == queue.start(dir.path(), 64 * 1024));
+    CHECK(queue.size() == 3);
+
+    // Old files are never appended to
+    REQUIRE(queue.pushBack(item(3).c_str()));
+    CHECK(queue.list().size() == 4);
+
+    for (int i = 0; i < 4; i++) {
+        REQUIRE(front(queue) == item(i));
+        queue.popFront();
+    }
+    CHECK(queue.isEmpty());
+}
+
+TEST_CASE("Files that aren't queue segments are discarded") {
+    QueueDir dir;
+    auto fd = open(dir.file("0").c_str(), O_CREAT | O_WRONLY, 0664);
+    REQUIRE(0 <= fd);
+    REQUIRE(5 == write(fd, "hello", 5));
+    close(fd);
+
+    DiskQueue queue;
+    REQUIRE(SYSTEM_ERROR_NONE == queue.start(dir.path(), 64 * 1024));
+    CHECK(queue.isEmpty());
+    CHECK_FALSE(dir.exists("0"));
+}
+
+TEST_CASE("Commit window") {
+    QueueDir dir;
+    DiskQueue queue;
+    REQUIRE(SYSTEM_ERROR_NONE == queue.start(dir.path(), 64 * 1024));
+    REQUIRE(SYSTEM_ERROR_NONE == queue.setCommitWindow(5000, 1024));
+
+    SECTION("Items are held until the window passes") {
+        for (int i = 0; i < 5; i++) {
+            REQUIRE(queue.pushBack(item(i).c_str()));
+        }
+        CHECK(queue.size() == 5);
+        CHECK(queue.list().isEmpty());
+
+        mockAdvanceMillis(4000);
+        queue.tick();
+        CHECK(queue.list().isEmpty());
+
+        mockAdvanceMillis(1000);
+        queue.tick();
+        CHECK(queue.list().size() == 1);
+        CHECK(queue.getCurrentDiskUsage() > 0);
+        CHECK(queue.size() == 5);
+    }
+
+    SECTION("A full staging buffer is written") {
+        int pushed = 0;
+        while (queue.list().isEmpty()) {
+            REQUIRE(queue.pushBack(item(pushed++).c_str()));
+        }
+        CHECK(pushed > 5);
+        CHECK(queue.size() == (size_t)pushed);
+    }
+
+    SECTION("Readers see held items in order") {
+        REQUIRE(queue.setCommitWindow(0) == SYSTEM_ERROR_NONE);
+        REQUIRE(queue.pushBack(item(0).c_str()));
+        REQUIRE(queue.setCommitWindow(5000, 1024) == SYSTEM_ERROR_NONE);
+        for (int i = 1; i < 4; i++) {
+            REQUIRE(queue.pushBack(item(i).c_str()));
+        }
+        for (int i = 0; i < 4; i++) {
+            REQUIRE(front(queue) == item(i));
+            queue.popFront();
+        }
+        CHECK(queue.isEmpty());
+    }
+
+    SECTION("Held items are written when stopping") {
+        for (int i = 0; i < 3; i++) {
+            REQUIRE(queue.pushBack(item(i).c_str()));
+        }
+        queue.stop();
+
+        DiskQueue restarted;
+        REQUIRE(SYSTEM_ERROR_NONE == restarted.start(dir.path(), 64 * 1024));
+        CHECK(restarted.size() == 3);
+        CHECK(front(restarted) == item(0));
+    }
+}
+
+TEST_CASE("Segment index") {
+    QueueDir dir;
+    {
+        DiskQueue queue;
+        queue.setSegmentSize(1024);
+        REQUIRE(SYSTEM_ERROR_NONE == queue.start(dir.path(), 1024 * 1024));
+        for (int i = 0; i < 3000; i++) {
+            REQUIRE(queue.pushBack(item(i).c_str()));
+        }
+        CHECK(queue.list().size() > 100);
+        queue.stop();
+    }
+
+    SECTION("Many segments are indexed on start") {
+        DiskQueue queue;
+        REQUIRE(SYSTEM_ERROR_NONE == queue.start(dir.path(), 1024 * 1024));
+        CHECK(queue.size() == 3000);
+        for (int i = 0; i < 3000; i++) {
+            REQUIRE(front(queue) == item(i));
+            queue.popFront();
+        }
+        CHECK(queue.isEmpty());
+    }
+
+    SECTION("Missing segments are skipped") {
+        DiskQueue queue;
+        REQUIRE(SYSTEM_ERROR_NONE == queue.start(dir.path(), 1024 * 1024));
+        auto segments = queue.list();
+        queue.stop();
+
+        REQUIRE(0 == unlink(dir.file(std::to_string(segments[0]).c_str()).c_str()));
+        REQUIRE(0 == unlink(dir.file(std::to_string(segments[5]).c_str()).c_str()));
+        REQUIRE(0 == unlink(dir.file(std::to_string(segments[segments.size() - 1]).c_str()).c_str()));
+
+        REQUIRE(SYSTEM_ERROR_NONE == queue.start(dir.path(), 1024 * 1024));
+        CHECK(queue.list().size() == segments.size() - 3);
+
+        int previous = -1;
+        while (!queue.isEmpty()) {
+            auto data = front(queue);
+            REQUIRE(data.length() > 0);
+            auto n = std::stoi(data.substr(data.find("time\":") + 6)) - 1000000;
+            REQUIRE(n > previous);
+            previous = n;
+            queue.popFront();
+        }
+
+        // Numbering carries on after the last segment
+        REQUIRE(queue.pushBack(item(0).c_str()));
+        CHECK(queue.list()[0] == segments[segments.size() - 2] + 1);
+    }
+}
+
+TEST_CASE("Batches") {
+    QueueDir dir;
+    DiskQueue queue;
+    queue.setSegmentSize(1024);
+    REQUIRE(SYSTEM_ERROR_NONE == queue.start(dir.path(), 64 * 1024));
+    for (int i = 0; i < 40; i++) {
+        REQUIRE(queue.pushBack(item(i).c_str()));
+    }
+
+    uint8_t buffer[1500] = {};
+    size_t sizes[32] = {};
+
+    SECTION("Items are copied across segments until the buffer is full") {
+        auto count = queue.peekBatch(buffer, sizeof(buffer), sizes, 32);
+        REQUIRE(count == sizeof(buffer) / item(0).length());
+        size_t offset = 0;
+        for (size_t i = 0; i < count; i++) {
+            REQUIRE(std::string((const char*)buffer + offset, sizes[i]) == item(i));
+            offset += sizes[i];
+        }
+
+        // Nothing is removed until the batch is committed
+        CHECK(queue.size() == 40);
+        CHECK(front(queue) == item(0));
+        REQUIRE(queue.commitBatch(count));
+        CHECK(queue.size() == 40 - count);
+        CHECK(front(queue) == item(count));
+    }
+
+    SECTION("Count is limited") {
+        CHECK(queue.peekBatch(buffer, sizeof(buffer), sizes, 3) == 3);
+        REQUIRE(queue.commitBatch(3));
+        CHECK(front(queue) == item(3));
+    }
+
+    SECTION("Committed position survives a restart") {
+        auto count = queue.peekBatch(buffer, sizeof(buffer), sizes, 5);
+        REQUIRE(queue.commitBatch(count));
+        queue.stop();
+        REQUIRE(SYSTEM_ERROR_NONE == queue.start(dir.path(), 64 * 1024));
+        CHECK(queue.size() == 35);
+        CHECK(front(queue) == item(5));
+    }
+
+    SECTION("A large first item is cut short") {
+        CHECK(queue.peekBatch(buffer, 10, sizes, 32) == 1);
+        CHECK(sizes[0] == 10);
+    }
+
+    SECTION("Nothing is removed if the front changed") {
+        auto count = queue.peekBatch(buffer, sizeof(buffer), sizes, 32);
+        queue.popFront();
+        CHECK_FALSE(queue.commitBatch(count));
+        CHECK(queue.size() == 39);
+        CHECK(front(queue) == item(1));
+    }
+}
+
+// Location event with every field filled in, varying the way a moving device would
+static std::string fullItem(int n) {
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer),
+        "{\"cmd\":\"loc\",\"time\":%d,\"loc\":{\"lck\":1,\"time\":%d,\"lat\":%.8f,\"lon\":%.8f,"
+        "\"alt\":%.3f,\"hd\":%.2f,\"spd\":%.2f,\"h_acc\":%.3f,\"hdop\":%.1f,\"v_acc\":%.3f,\"vdop\":%.1f,"
+        "\"batt\":%.1f,\"temp\":%.1f},\"trig\":[\"time\"],\"req_id\":%d}",
+        1697000000 + n * 30, 1697000000 + n * 30, 37.77490123 + n * 0.00013, -122.41941456 - n * 0.00021,
+        15.123 + (n % 7), (n * 37) % 360 + 0.25, 3.5 + (n % 5), 4.25 + (n % 3), 0.9, 6.5 + (n % 4), 1.3,
+        88.5 - n * 0.1, 21.5 + (n % 3), 100 + n);
+    return buffer;
+}
+
+static const char fullDictionary[] =
+    "{\"cmd\":\"loc\",\"time\":1697000000,\"loc\":{\"lck\":1,\"time\":1697000000,\"lat\":37.77490123,"
+    "\"lon\":-122.41941456,\"alt\":15.123,\"hd\":180.25,\"spd\":3.50,\"h_acc\":4.250,\"hdop\":0.9,"
+    "\"v_acc\":6.500,\"vdop\":1.3,\"batt\":88.5,\"temp\":21.5},\"trig\":[\"time\"],\"req_id\":100}";
+
+TEST_CASE("Codec") {
+    DiskQueueCodec codec((const uint8_t*)fullDictionary, sizeof(fullDictionary) - 1);
+
+    SECTION("Items are restored exactly") {
+        size_t original = 0;
+        size_t compressed = 0;
+        for (int i = 0; i < 200; i++) {
+            auto data = fullItem(i);
+            auto packed = codec.compress((const uint8_t*)data.data(), data.length());
+            REQUIRE(packed > 0);
+            original += data.length();
+            compressed += packed;
+
+            size_t size = 0;
+            auto decoded = codec.decompress(codec.buffer(), packed, size);
+            REQUIRE(decoded);
+            REQUIRE(std::string((const char*)decoded, size) == data);
+        }
+
+        // Most of each event is found in the dictionary
+        CHECK((original / compressed) >= 3);
+    }
+
+    SECTION("Items that don't get smaller are refused") {
+        uint8_t noise[200];
+        uint32_t state = 12345;
+        for (auto& byte: noise) {
+            state = state * 1103515245 + 12345;
+            byte = (uint8_t)(state >> 16);
+        }
+        CHECK(codec.compress(noise, sizeof(noise)) == 0);
+
+        std::string large(DiskQueueCodec::MaxItemSize + 1, 'a');
+        CHECK(codec.compress((const uint8_t*)large.data(), large.length()) == 0);
+    }
+
+    SECTION("Repeats within an item are found without a dictionary") {
+        DiskQueueCodec plain(nullptr, 0);
+        std::string data(500, 'x');
+        auto packed = plain.compress((const uint8_t*)data.data(), data.length());
+        REQUIRE(packed > 0);
+        CHECK(packed < 100);
+        size_t size = 0;
+        auto decoded = plain.decompress(plain.buffer(), packed, size);
+        REQUIRE(decoded);
+        CHECK(std::string((const char*)decoded, size) == data);
+    }
+
+    SECTION("Damaged items are rejected") {
+        auto data = fullItem(1);
+        auto packed = codec.compress((const uint8_t*)data.data(), data.length());
+        REQUIRE(packed > 0);
+        size_t size = 0;
+        CHECK_FALSE(codec.decompress(codec.buffer(), packed - 1, size));
+
+        // A different dictionary can't decode it
+        DiskQueueCodec other(nullptr, 0);
+        CHECK_FALSE(other.decompress(codec.buffer(), packed, size));
+
+        // Nor can one that differs only in the order of its bytes
+        std::string swapped(fullDictionary, sizeof(fullDictionary) - 1);
+        std::swap(swapped[1], swapped[2]);
+        DiskQueueCodec reordered((const uint8_t*)swapped.data(), swapped.length());
+        CHECK_FALSE(reordered.decompress(codec.buffer(), packed, size));
+    }
+}
+
+TEST_CASE("Compression") {
+    QueueDir dir;
+    DiskQueue queue;
+    REQUIRE(SYSTEM_ERROR_NONE == queue.setCompression(true, (const uint8_t*)fullDictionary, sizeof(fullDictionary) - 1));
+    REQUIRE(SYSTEM_ERROR_NONE == queue.start(dir.path(), 64 * 1024));
+    for (int i = 0; i < 100; i++) {
+        REQUIRE(queue.pushBack(fullItem(i).c_str()));
+    }
+
+    SECTION("Items take less space") {
+        size_t original = 0;
+        for (int i = 0; i < 100; i++) {
+            original += fullItem(i).length();
+        }
+        CHECK((queue.getCurrentDiskUsage() * 2) < original);
+    }
+
+    SECTION("Items are read back in their original form") {
+        uint8_t buffer[512] = {};
+        for (int i = 0; i < 100; i++) {
+            REQUIRE(queue.peekFrontSize() == fullItem(i).length());
+            size_t size = sizeof(buffer);
+            REQUIRE(queue.peekFront(buffer, size));
+            REQUIRE(std::string((const char*)buffer, size) == fullItem(i));
+            queue.popFront();
+        }
+        CHECK(queue.isEmpty());
+    }
+
+    SECTION("Batches hold whole original items") {
+        uint8_t buffer[1000] = {};
+        size_t sizes[32] = {};
+        auto count = queue.peekBatch(buffer, sizeof(buffer), sizes, 32);
+        REQUIRE(count == sizeof(buffer) / fullItem(0).length());
+        size_t offset = 0;
+        for (size_t i = 0; i < count; i++) {
+            REQUIRE(std::string((const char*)buffer + offset, sizes[i]) == fullItem(i));
+            offset += sizes[i];
+        }
+    }
+
+    SECTION("Uncompressed items are still read") {
+        queue.setCompression(false, (const uint8_t*)fullDictionary, sizeof(fullDictionary) - 1);
+        REQUIRE(queue.pushBack(item(0).c_str()));
+        for (int i = 0; i < 100; i++) {
+            queue.popFront();
+        }
+        CHECK(front(queue) == item(0));
+    }
+
+    SECTION("Compressed items are read with compression turned off") {
+        queue.setCompression(false, (const uint8_t*)fullDictionary, sizeof(fullDictionary) - 1);
+        uint8_t buffer[512] = {};
+        for (int i = 0; i < 100; i++) {
+            size_t size = sizeof(buffer);
+            REQUIRE(queue.peekFront(buffer, size));
+            REQUIRE(std::string((const char*)buffer, size) == fullItem(i));
+            queue.popFront();
+        }
+    }
+
+    SECTION("Items that can't be decoded are dropped") {
+        queue.stop();
+        DiskQueue other;
+        REQUIRE(SYSTEM_ERROR_NONE == other.start(dir.path(), 64 * 1024));
+        REQUIRE(other.pushBack(item(0).c_str()));
+        CHECK(front(other) == item(0));
+        CHECK(other.size() == 1);
+    }
+}
+
+// Read and remove everything in the queue
+static std::vector<std::string> drain(DiskQueue& queue) {
+    std::vector<std::string> items;
+    while (!queue.isEmpty()) {
+        uint8_t buffer[256] = {};
+        size_t size = sizeof(buffer);
+        if (!queue.peekFront(buffer, size)) {
+            break;
+        }
+        items.push_back(std::string((const char*)buffer, size));
+        queue.popFront();
+    }
+    return items;
+}
+
+TEST_CASE("Damaged items") {
+    QueueDir dir;
+    DiskQueue queue;
+    REQUIRE(SYSTEM_ERROR_NONE == queue.start(dir.path(), 64 * 1024));
+    for (int i = 0; i < 3; i++) {
+        REQUIRE(queue.pushBack(item(i).c_str()));
+    }
+    auto segment = dir.file(std::to_string(queue.list()[0]).c_str());
+
+    // File header, then the header and checksum of each item ahead of its data
+    auto damage = [&](int n) {
+        auto offset = 3 + n * (8 + item(0).length()) + 8 + 5;
+        auto fd = open(segment.c_str(), O_WRONLY);
+        REQUIRE(fd >= 0);
+        REQUIRE(lseek(fd, offset, SEEK_SET) == (off_t)offset);
+        REQUIRE(write(fd, "#", 1) == 1);
+        close(fd);
+    };
+
+    SECTION("Are skipped when read") {
+        damage(1);
+        CHECK(drain(queue) == std::vector<std::string>({item(0), item(2)}));
+    }
+
+    SECTION("End the segment when starting") {
+        queue.stop();
+        damage(1);
+        REQUIRE(SYSTEM_ERROR_NONE == queue.start(dir.path(), 64 * 1024));
+        CHECK(queue.size() == 1);
+        REQUIRE(queue.pushBack(item(3).c_str()));
+        CHECK(drain(queue) == std::vector<std::string>({item(0), item(3)}));
+    }
+
+    SECTION("Before the read position don't discard unread items") {
+        queue.popFront();
+        queue.stop();
+
+        // Break the magic of the first item's header
+        auto fd = open(segment.c_str(), O_WRONLY);
+        REQUIRE(fd >= 0);
+        REQUIRE(lseek(fd, 3, SEEK_SET) == 3);
+        REQUIRE(write(fd, "#", 1) == 1);
+        close(fd);
+
+        REQUIRE(SYSTEM_ERROR_NONE == queue.start(dir.path(), 64 * 1024));
+        CHECK(queue.size() == 2);
+        CHECK(drain(queue) == std::vector<std::string>({item(1), item(2)}));
+    }
+}
+
+TEST_CASE("Damaged items in older segments") {
+    QueueDir dir;
+    DiskQueue queue;
+    queue.setSegmentSize(1024);
+    REQUIRE(SYSTEM_ERROR_NONE == queue.start(dir.path(), 64 * 1024));
+    for (int i = 0; i < 20; i++) {
+        REQUIRE(queue.pushBack(item(i).c_str()));
+    }
+    REQUIRE(queue.list().size() > 1);
+    auto segment = dir.file(std::to_string(queue.list()[0]).c_str());
+    queue.stop();
+
+    // Older segments aren't checked when starting, the damaged item is skipped when it is read
+    auto offset = 3 + 8 + 5;
+    auto fd = open(segment.c_str(), O_WRONLY);
+    REQUIRE(fd >= 0);
+    REQUIRE(lseek(fd, offset, SEEK_SET) == (off_t)offset);
+    REQUIRE(write(fd, "#", 1) == 1);
+    close(fd);
+
+    REQUIRE(SYSTEM_ERROR_NONE == queue.start(dir.path(), 64 * 1024));
+    CHECK(queue.size() == 20);
+    auto items = drain(queue);
+    REQUIRE(items.size() == 19);
+    CHECK(items.front() == item(1));
+    CHECK(items.back() == item(19));
+}
+
+TEST_CASE("Power loss") {
+    QueueDir dir;
+    QueueDir copy;
+    DiskQueue queue;
+    queue.setSegmentSize(1024);
+    REQUIRE(SYSTEM_ERROR_NONE == queue.start(dir.path(), 64 * 1024));
+
+    std::vector<std::string> pushed;
+    auto push = [&](int n) {
+        REQUIRE(queue.pushBack(item(n).c_str()));
+        pushed.push_back(item(n));
+    };
+
+    // Start a queue on what was left behind and read it all back, with one more item to show
+    // that it can still be appended to
+    auto recover = [&](const DiskImage& image) {
+        image.restore(copy.path());
+        DiskQueue recovered;
+        recovered.setSegmentSize(1024);
+        REQUIRE(SYSTEM_ERROR_NONE == recovered.start(copy.path(), 64 * 1024));
+        REQUIRE(recovered.pushBack("last"));
+        auto items = drain(recovered);
+        REQUIRE_FALSE(items.empty());
+        REQUIRE(items.back() == "last");
+        items.pop_back();
+        return items;
+    };
+
+    SECTION("Appending items one at a time") {
+        // Enough to fill the first segment and start the next
+        for (int i = 0; i < 20; i++) {
+            auto before = DiskImage::capture(dir.path());
+            auto expected = pushed;
+            push(i);
+            auto after = DiskImage::capture(dir.path());
+
+            forEachPowerCut(before, after, [&](const DiskImage& image, const std::string& name, size_t offset) {
+                INFO("item " << i << " cut in " << name << " at " << offset);
+                REQUIRE(recover(image) == expected);
+            });
+        }
+    }
+
+    SECTION("Writing held items together") {
+        for (int i = 0; i < 4; i++) {
+            push(i);
+        }
+        queue.setCommitWindow(60000);
+        for (int i = 4; i < 10; i++) {
+            push(i);
+        }
+
+        auto before = DiskImage::capture(dir.path());
+        REQUIRE(SYSTEM_ERROR_NONE == queue.flush());
+        auto after = DiskImage::capture(dir.path());
+
+        // Items written whole before the cut survive
+        forEachPowerCut(before, after, [&](const DiskImage& image, const std::string& name, size_t offset) {
+            INFO("cut in " << name << " at " << offset);
+            auto items = recover(image);
+            REQUIRE(items.size() >= 4);
+            REQUIRE(items.size() < pushed.size());
+            REQUIRE(std::equal(items.begin(), items.end(), pushed.begin()));
+        });
+    }
+
+    SECTION("Saving the read position") {
+        for (int i = 0; i < 10; i++) {
+            push(i);
+        }
+        for (int i = 0; i < 3; i++) {
+            queue.popFront();
+        }
+
+        auto before = DiskImage::capture(dir.path());
+        queue.popFront();
+        auto after = DiskImage::capture(dir.path());
+
+        // Reading may start again from an earlier item but nothing unread is lost
+        forEachPowerCut(before, after, [&](const DiskImage& image, const std::string& name, size_t offset) {
+            INFO("cut in " << name << " at " << offset);
+            auto items = recover(image);
+            REQUIRE(items.size() >= 6);
+            REQUIRE(std::equal(items.rbegin(), items.rend(), pushed.rbegin()));
+        });
+    }
+}
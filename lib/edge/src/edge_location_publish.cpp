@@ -21,10 +21,49 @@
 constexpr int HIGH_PRIORITY = 0;
 constexpr int LOW_PRIORITY = 1;
 const int DEFAULT_DISK_LIMIT = 64;//In KB
+const int DEFAULT_ALARM_DISK_LIMIT = 16;//In KB
 const size_t KILOBYTE_CONSTANT = 1024;
-const char STORE_QUEUE_FILE_PATH[] = "/usr/store_queue";
+
+constexpr size_t MAX_DRAIN_RECORDS = 8; // Most stored messages packed into one loc_batch event
+constexpr system_tick_t DRAIN_ACK_MARGIN_MS = 5000; // Wait past the publish timeout before giving up on an ack
+const char LOC_BATCH_PREFIX[] = "{\"cmd\":\"loc_batch\",\"time\":%lu,\"locs\":[";
 
 uint8_t store_msg_buffer[particle::protocol::MAX_EVENT_DATA_LENGTH + 1] = {0};
+char store_batch_buffer[particle::protocol::MAX_EVENT_DATA_LENGTH + 1] = {0};
+
+// Typical location event that stored messages are compressed against, changing it makes
+// messages stored by earlier firmware unreadable
+const char STORE_DICTIONARY[] =
+    "\"towers\":[{\"rat\":\"lte\",\"mcc\":310,\"mnc\":410,\"lac\":11015,\"cid\":145722401,\"str\":-97.00},"
+    "{\"nid\":301,\"ch\":5110,\"str\":-105.00}],\"wps\":[{\"bssid\":\"a4:2b:b0:c1:2e:10\",\"ch\":6,\"str\":-71}],"
+    "\"trig\":[\"err\",\"lock\",\"imu_m\",\"temp_h\",\"batt_low\",\"radius\",\"time\"],\"loc_cb\":true,"
+    "{\"cmd\":\"loc\",\"time\":1697000000,\"loc\":{\"lck\":1,\"time\":1697000000,\"lat\":37.77490123,"
+    "\"lon\":-122.41941456,\"alt\":15.123,\"hd\":180.25,\"spd\":0.50,\"h_acc\":4.250,\"hdop\":0.9,"
+    "\"v_acc\":6.500,\"vdop\":1.3,\"satu\":12,\"satv\":24,\"satmin\":18,\"satmax\":44,\"satmean\":31,"
+    "\"batt\":88.5,\"temp\":21.5},\"trig\":[\"time\"],\"req_id\":100}";
+
+// Typical Modbus results event that stored results are compressed against
+const char MODBUS_DICTIONARY[] =
+    "{\"t\":1697000000,\"modbus\":[{\"n\":\"temp\",\"v\":21.5,\"d\":0},{\"n\":\"flow\",\"v\":0.125,\"d\":100},"
+    "{\"n\":\"level\",\"r\":226,\"d\":1000},{\"n\":\"pressure\",\"v\":-1,\"d\":10000}]}";
+
+// Triggers that put a location publish in the alarm lane, entries ending in '_' match as a prefix
+const char* const ALARM_TRIGGERS[] = {"io_", "temp_h", "temp_l", "batt_low", "batt_warn"};
+
+struct StoreLaneInfo {
+    const char* path;
+    const char* event_name;
+    const char* dictionary;
+    size_t dictionary_size;
+    unsigned int share; // Sends in a row before yielding one to a waiting lower lane, zero never yields
+};
+
+// In StoreLane order, highest priority first
+const StoreLaneInfo STORE_LANES[STORE_LANE_COUNT] = {
+    {"/usr/store_alarm", "loc", STORE_DICTIONARY, sizeof(STORE_DICTIONARY) - 1, 0},
+    {"/usr/store_queue", "loc", STORE_DICTIONARY, sizeof(STORE_DICTIONARY) - 1, 4},
+    {"/usr/modbus_queue", "modbus", MODBUS_DICTIONARY, sizeof(MODBUS_DICTIONARY) - 1, 1},
+};
 
 void locationGenerationCallback(JSONWriter &writer,
     LocationPoint &point, const void *context);
@@ -36,68 +75,264 @@ void EdgeLocationPublish::init() {
         ConfigStringEnum("policy", {
                 {"drop_old", (int32_t) DiskQueuePolicy::FifoDeleteOld},
                 {"drop_new", (int32_t) DiskQueuePolicy::FifoDeleteNew}
-            }, &store_config.policy)
+            }, &store_config.policy),
+        ConfigInt("window", &store_config.window, 0, 3600),
+        ConfigBool("batch", &store_config.batch),
+        ConfigBool("compress", &store_config.compress),
+        ConfigObject("alarm", {
+            ConfigInt("quota", &store_config.alarm.quota, 0, 4000),
+            ConfigStringEnum("policy", {
+                    {"drop_old", (int32_t) DiskQueuePolicy::FifoDeleteOld},
+                    {"drop_new", (int32_t) DiskQueuePolicy::FifoDeleteNew}
+                }, &store_config.alarm.policy)
+        }),
+        ConfigObject("modbus", {
+            ConfigInt("quota", &store_config.modbus.quota, 0, 4000),
+            ConfigStringEnum("policy", {
+                    {"drop_old", (int32_t) DiskQueuePolicy::FifoDeleteOld},
+                    {"drop_new", (int32_t) DiskQueuePolicy::FifoDeleteNew}
+                }, &store_config.modbus.policy)
+        })
     });
 
     ConfigService::instance().registerModule(store_forward);
 
-    if(store_config.enable) {
-        start();
-    }
+    // Messages held for the commit window would be lost over sleep
+    EdgeSleep::instance().registerSleepPrepare([this](EdgeSleepContext context) {
+        for(auto& lane : lanes) {
+            lane.queue.flush();
+        }
+    });
+
+    start();
 
     Edge::instance().location.regLocGenCallback(locationGenerationCallback);
 }
 
 void EdgeLocationPublish::start() {
-    if(store_msg_queue.start(STORE_QUEUE_FILE_PATH,
-                        store_config.quota*KILOBYTE_CONSTANT,
-                        store_config.policy) != SYSTEM_ERROR_NONE) {
-        Log.error("Failed to start location publish disk queue");
+    for(size_t i = 0; i < STORE_LANE_COUNT; i++) {
+        if(!isLaneEnabled((StoreLane)i)) {
+            continue;
+        }
+
+        auto& info = STORE_LANES[i];
+        auto& queue = lanes[i].queue;
+        StoreLaneConfig config = {store_config.quota, store_config.policy};
+        if(StoreLane::ALARM == (StoreLane)i) {
+            config = store_config.alarm;
+        }
+        else if(StoreLane::MODBUS == (StoreLane)i) {
+            config = store_config.modbus;
+        }
+
+        //a running queue only takes a new quota and policy when started again
+        queue.stop();
+
+        // The dictionary is kept even when not compressing so that stored messages can still be read
+        if(queue.setCompression(store_config.compress,
+                            (const uint8_t*)info.dictionary,
+                            info.dictionary_size) != SYSTEM_ERROR_NONE) {
+            Log.error("Failed to set %s disk queue compression", info.path);
+        }
+
+        if(queue.start(info.path,
+                            config.quota*KILOBYTE_CONSTANT,
+                            config.policy) != SYSTEM_ERROR_NONE) {
+            Log.error("Failed to start %s disk queue", info.path);
+        }
+
+        if(queue.setCommitWindow(store_config.window * 1000) != SYSTEM_ERROR_NONE) {
+            Log.error("Failed to set %s disk queue commit window", info.path);
+        }
+    }
+}
+
+bool EdgeLocationPublish::isLaneEnabled(StoreLane lane) const {
+    switch(lane) {
+        case StoreLane::ALARM:
+            return store_config.enable && (store_config.alarm.quota > 0);
+
+        case StoreLane::MODBUS:
+            return store_config.enable && (store_config.modbus.quota > 0);
+
+        default:
+            return store_config.enable;
     }
 }
 
 void EdgeLocationPublish::tick() {
     static StoreConfig current_config = store_config;
 
-    //check if settings changed, if still enabled re-run start,
-    //if disabled stop the disk queue
+    //check if settings changed, re-run start for the lanes still enabled
+    //and delete the files of those that are now disabled
     if(current_config != store_config) {
-        if(store_config.enable) {
-            start();
-        }
-        else {
-            factoryReset();
+        start();
+        for(size_t i = 0; i < STORE_LANE_COUNT; i++) {
+            if(!isLaneEnabled((StoreLane)i)) {
+                resetLane((StoreLane)i);
+            }
         }
         current_config = store_config;
     }
 
-    //check if DiskQueue has messages to retry
-    if(!store_msg_queue.isEmpty() && isStoreEnabled() && Particle.connected()) {
-        CloudServicePublishFlags cloud_flags =
-            (EdgeLocation::instance().isProcessAckEnabled()) ?
-                CloudServicePublishFlags::FULL_ACK : CloudServicePublishFlags::NONE;
+    //write out messages held longer than the commit window
+    for(auto& lane : lanes) {
+        lane.queue.tick();
+    }
+
+    //an ack that never arrives would stop the queues from draining
+    if(drain_count &&
+        ((millis() - drain_sent) >= (CLOUD_DEFAULT_TIMEOUT_MS + DRAIN_ACK_MARGIN_MS))) {
+        drain_count = 0;
+    }
+
+    //check if any lane has messages to retry, one send at a time
+    if(!drain_count && Particle.connected()) {
+        drain();
+    }
+}
+
+bool EdgeLocationPublish::store(StoreLane lane, const char* data) {
+    if(!isLaneEnabled(lane)) {
+        return false;
+    }
+    return lanes[(size_t)lane].queue.pushBack(data);
+}
 
-        auto size = store_msg_queue.peekFrontSize();
-        if (size > particle::protocol::MAX_EVENT_DATA_LENGTH) {
+StoreLane EdgeLocationPublish::classify(const String &req_event) {
+    auto root = JSONValue::parseCopy(req_event.c_str(), req_event.length());
+    JSONObjectIterator it(root);
+    while(it.next()) {
+        if(it.name() != "trig") {
+            continue;
+        }
+        JSONArrayIterator triggers(it.value());
+        while(triggers.next()) {
+            auto trigger = triggers.value().toString();
+            for(auto alarm : ALARM_TRIGGERS) {
+                auto length = strlen(alarm);
+                bool prefix = ('_' == alarm[length - 1]);
+                if(prefix ? !strncmp(trigger.data(), alarm, length) : (trigger == alarm)) {
+                    return StoreLane::ALARM;
+                }
+            }
+        }
+    }
+    return StoreLane::LOCATION;
+}
+
+size_t EdgeLocationPublish::nextLane() {
+    for(int round = 0; round < 2; round++) {
+        for(size_t i = 0; i < STORE_LANE_COUNT; i++) {
+            if(!isLaneEnabled((StoreLane)i) || lanes[i].queue.isEmpty()) {
+                continue;
+            }
+            if(!STORE_LANES[i].share) {
+                return i;
+            }
+            if(lanes[i].credit) {
+                lanes[i].credit--;
+                return i;
+            }
+        }
+
+        //every waiting lane has had its share, start another round
+        for(size_t i = 0; i < STORE_LANE_COUNT; i++) {
+            lanes[i].credit = STORE_LANES[i].share;
+        }
+    }
+    return STORE_LANE_COUNT;
+}
+
+void EdgeLocationPublish::drain() {
+    auto index = nextLane();
+    if(STORE_LANE_COUNT == index) {
+        return;
+    }
+    auto lane = (StoreLane)index;
+    auto& queue = lanes[index].queue;
+    bool location = (StoreLane::MODBUS != lane);
+
+    size_t sizes[MAX_DRAIN_RECORDS] = {};
+    size_t count = 0;
+    const char* data = (const char*)store_msg_buffer;
+    const char* event_name = STORE_LANES[index].event_name;
+    CloudServicePublishFlags cloud_flags =
+        (location && EdgeLocation::instance().isProcessAckEnabled()) ?
+            CloudServicePublishFlags::FULL_ACK : CloudServicePublishFlags::NONE;
+
+    //leave room for the batch envelope and a comma between messages
+    int prefix = snprintf(store_batch_buffer, sizeof(store_batch_buffer),
+        LOC_BATCH_PREFIX, (unsigned long)Time.now());
+    size_t batch_bytes = particle::protocol::MAX_EVENT_DATA_LENGTH -
+        (prefix + (MAX_DRAIN_RECORDS - 1) + 2);
+
+    if(location && store_config.batch && (queue.peekFrontSize() <= batch_bytes)) {
+        count = queue.peekBatch(store_msg_buffer, batch_bytes,
+            sizes, MAX_DRAIN_RECORDS);
+    }
+    else {
+        if (queue.peekFrontSize() > particle::protocol::MAX_EVENT_DATA_LENGTH) {
             Log.warn("Disk queue file size exceeds maximum message length; truncating");
-            size = particle::protocol::MAX_EVENT_DATA_LENGTH;
         }
-        store_msg_queue.peekFront(store_msg_buffer, size);
-        store_msg_queue.popFront(); //ok to pop, disk_queue_cb will throw it back
-        //on if it fails again and there's space in the disk queue
+        count = queue.peekBatch(store_msg_buffer,
+            particle::protocol::MAX_EVENT_DATA_LENGTH, sizes, 1);
+    }
+    if(!count) {
+        return;
+    }
+
+    if(1 == count) {
+        store_msg_buffer[sizes[0]] = '\0'; // file data are not null terminated, but CloudService::send expects it
+    }
+    else {
+        //stored messages are whole loc events so they can be packed as they are
+        size_t used = prefix;
+        size_t offset = 0;
+        for(size_t i = 0; i < count; i++) {
+            if(i) {
+                store_batch_buffer[used++] = ',';
+            }
+            memcpy(store_batch_buffer + used, store_msg_buffer + offset, sizes[i]);
+            used += sizes[i];
+            offset += sizes[i];
+        }
+        store_batch_buffer[used++] = ']';
+        store_batch_buffer[used++] = '}';
+        store_batch_buffer[used] = '\0';
+
+        data = store_batch_buffer;
+        event_name = "loc_batch";
+        //the batch has no request id of its own to be acknowledged with
+        cloud_flags = CloudServicePublishFlags::NONE;
+    }
 
-        store_msg_buffer[size] = '\0'; // file data are not null terminated, but CloudService::send expects it
+    //Priority level set to normal. don't want these to be high priority.
+    //Messages stay in the disk queue until the send is acknowledged.
+    auto rval = CloudService::instance().send(data,
+        WITH_ACK,
+        cloud_flags,
+        [this, lane, count](CloudServiceStatus status, String&& req_event) {
+            return drain_cb(status, lane, count);
+        },
+        CLOUD_DEFAULT_TIMEOUT_MS, event_name, 0, 1);
+    if(!rval) {
+        drain_count = count;
+        drain_sent = millis();
+    }
+}
 
-        //Priority level set to normal. don't want these to be high priority
-        regPendingLocPubCallback(); //use the pending callback for this since
-        //the exchange between pending vs the current hasn't occured yet
-        CloudService::instance().send((const char*)store_msg_buffer,
-            WITH_ACK,
-            cloud_flags,
-            std::bind(&EdgeLocation::location_publish_cb, &EdgeLocation::instance(),
-                std::placeholders::_1, std::placeholders::_2, System.uptime()),
-            CLOUD_DEFAULT_TIMEOUT_MS, "loc", 0, 1);
+int EdgeLocationPublish::drain_cb(CloudServiceStatus status, StoreLane lane, size_t count) {
+    if(CloudServiceStatus::SUCCESS == status) {
+        if(!lanes[(size_t)lane].queue.commitBatch(count)) {
+            Log.warn("Stored %s messages changed while being sent", STORE_LANES[(size_t)lane].event_name);
+        }
     }
+    else {
+        Log.info("Stored %s messages not sent, will retry", STORE_LANES[(size_t)lane].event_name);
+    }
+    drain_count = 0;
+    return 0;
 }
 
 void EdgeLocationPublish::regLocPubCallback() {
@@ -113,7 +348,7 @@ void EdgeLocationPublish::regPendingLocPubCallback() {
 int EdgeLocationPublish::disk_queue_cb(CloudServiceStatus status,
                                    const String &req_event) {
     if((CloudServiceStatus::SUCCESS != status) && store_config.enable) {
-        if(!store_msg_queue.pushBack(req_event)) {
+        if(!store(classify(req_event), req_event.c_str())) {
             Log.warn("Unable to write location message to DiskQueue, discarding");
         }
     }
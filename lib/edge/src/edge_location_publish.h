@@ -21,15 +21,46 @@
 #include "cloud_service.h"
 
 extern const int DEFAULT_DISK_LIMIT; //in KB
+extern const int DEFAULT_ALARM_DISK_LIMIT; //in KB
 extern const size_t KILOBYTE_CONSTANT;
 
+/**
+ * @brief Lanes that stored messages are kept in, highest priority first
+ *
+ */
+enum class StoreLane {
+    ALARM,      // Location publishes with an alarm trigger such as io_*, temp_h or batt_low
+    LOCATION,   // Other location publishes, mostly periodic
+    MODBUS,     // Modbus results
+    COUNT
+};
+
+constexpr size_t STORE_LANE_COUNT = (size_t)StoreLane::COUNT;
+
+struct StoreLaneConfig {
+    int quota; //in KB, zero stores nothing in the lane
+    DiskQueuePolicy policy;
+
+    bool operator!=(const StoreLaneConfig& other) const {
+        return (quota != other.quota) || (policy != other.policy);
+    }
+};
+
 struct StoreConfig {
     int quota{DEFAULT_DISK_LIMIT};
     DiskQueuePolicy policy {DiskQueuePolicy::FifoDeleteOld};
+    StoreLaneConfig alarm{DEFAULT_ALARM_DISK_LIMIT, DiskQueuePolicy::FifoDeleteOld};
+    StoreLaneConfig modbus{DEFAULT_DISK_LIMIT, DiskQueuePolicy::FifoDeleteOld};
+    int window{0}; // Seconds that stored messages may be held in RAM before being written
+    bool batch{false}; // Pack several stored messages into each loc_batch event
+    bool compress{false}; // Compress stored messages against a typical location event
     bool enable{false};
 
     bool operator!=(const StoreConfig& other) const {
         if((quota != other.quota) || (policy != other.policy) ||
+            (window != other.window) || (batch != other.batch) ||
+            (compress != other.compress) ||
+            (alarm != other.alarm) || (modbus != other.modbus) ||
             (enable != other.enable)) {return true;}
         else {return false;}
     }
@@ -47,28 +78,70 @@ public:
      *
      * @details creates the ConfigObject for the store forward feature, and
      * registers the object. Will also call start() if the store forward feature
-     * is enabled
+     * is enabled. Held messages are written out before the device sleeps.
      */
     void init();
 
     /**
-     * @brief Start the DiskQueue
+     * @brief Start the DiskQueue of each enabled lane
      *
-     * @details Calls DiskQueue::start() for store_msg_queue. This will get
-     * the DiskQueue started with the quota and policy desired. Can be called
-     * again if there is a change to the policy or size.
+     * @details Calls DiskQueue::start() for the queue of every lane that is
+     * enabled. This will get each DiskQueue started with the quota, policy and
+     * commit window desired. Can be called again if there is a change to the
+     * policy or size.
      */
     void start();
 
     /**
-     * @brief Called once a second to consume the store_msg_queue if there
+     * @brief Called once a second to consume the lane queues if there
      * is data to send
      *
      * @details Call this function once a second to consume messages saved in the
-     * store_msg_queue. This setsup the the entire callback system to run again
+     * lane queues. One send is outstanding at a time and its messages are
+     * only removed from their queue once it is acknowledged.
      */
     void tick();
 
+    /**
+     * @brief Send the oldest stored messages of the next lane due
+     *
+     * @details Sends the front message of the lane's queue as it was
+     * stored, or when batching is enabled packs as many location messages as
+     * fit into one loc_batch event.
+     */
+    void drain();
+
+    /**
+     * @brief Remove sent messages from their lane once acknowledged
+     *
+     * @param[in] status of the stored message publish
+     * @param[in] lane the messages were sent from
+     * @param[in] count number of stored messages in the publish
+     *
+     * @return 0 for success
+     */
+    int drain_cb(CloudServiceStatus status, StoreLane lane, size_t count);
+
+    /**
+     * @brief Store a message to be sent once the cloud can be reached
+     *
+     * @param[in] lane to store the message in
+     * @param[in] data of the message in JSON format
+     *
+     * @return TRUE if stored, FALSE if the lane is disabled or full
+     */
+    bool store(StoreLane lane, const char* data);
+
+    /**
+     * @brief Choose the lane for a location publish from its triggers
+     *
+     * @param[in] req_event data containing the message in JSON format
+     *
+     * @return StoreLane::ALARM if any trigger is an alarm, otherwise
+     * StoreLane::LOCATION
+     */
+    static StoreLane classify(const String &req_event);
+
     /**
      * @brief Register the callback to be called from every generated location
      * publish
@@ -93,7 +166,7 @@ public:
      *
      * @details Checks to see if the status of the message publish is not
      * SUCCESS. If the store forward feature is enabled, and there is data,
-     * push the message on to the store_msg_queue
+     * push the message on to the lane for its triggers
      *
      * @param[in] status of the message that was published
      * @param[in] rsp_root JSON root of the message
@@ -117,14 +190,25 @@ public:
     }
 
     /**
-     * @brief Called to cleanup the store_msg_queue. Is called if you disable the
-     * store forward feature, or reset the device to factory
+     * @brief Is the lane storing messages
+     *
+     * @param[in] lane to check
+     *
+     * @return TRUE if enabled, FALSE if not
+     */
+    bool isLaneEnabled(StoreLane lane) const;
+
+    /**
+     * @brief Called to cleanup the lane queues. Is called to reset the device
+     * to factory
      *
-     * @details Flushes, Closes out, and deletes the store_msg_queue files
+     * @details Flushes, Closes out, and deletes the files of every lane
      */
     void factoryReset() {
-        store_msg_queue.unlinkFiles(); //unlink the files first
-        store_msg_queue.stop(); //then clear the files from _fileList
+        for(size_t i = 0; i < STORE_LANE_COUNT; i++) {
+            resetLane((StoreLane)i);
+        }
+        drain_count = 0;
     }
 
     //remove copy and assignment operators
@@ -132,8 +216,36 @@ public:
     void operator=(EdgeLocationPublish const&)  = delete;
 
 private:
-    EdgeLocationPublish() : store_msg_queue () {}
+    EdgeLocationPublish() {}
+
+    /**
+     * @brief Delete the files of a lane and stop its queue
+     *
+     * @param[in] lane to reset
+     */
+    void resetLane(StoreLane lane) {
+        auto& queue = lanes[(size_t)lane].queue;
+        queue.unlinkFiles(); //unlink the files first
+        queue.stop(); //then clear the segment index
+    }
+
+    /**
+     * @brief Choose the lane to send from next
+     *
+     * @details Lanes are drained highest priority first, except that a lane
+     * which has had its share of sends in a row yields to waiting lanes below it.
+     *
+     * @return Index of the lane, or STORE_LANE_COUNT if nothing is waiting
+     */
+    size_t nextLane();
+
+    struct Lane {
+        DiskQueue queue;
+        unsigned int credit{0}; // Sends left before yielding to lower lanes
+    };
 
-    DiskQueue store_msg_queue;
+    Lane lanes[STORE_LANE_COUNT];
     StoreConfig store_config;
+    size_t drain_count{0}; // Stored messages in the send waiting for an ack
+    system_tick_t drain_sent{0};
 };
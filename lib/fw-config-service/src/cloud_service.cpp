@@ -47,6 +47,186 @@ shared_function<std::decay_t<F>> make_shared_function(F&& f) {
     return std::forward<F>(f);
 }
 
+// fnv-1a
+uint32_t CloudCommandTable::hash(const char *name)
+{
+    uint32_t hash = 0x811c9dc5;
+    while(*name)
+    {
+        hash = (hash ^ (uint8_t) *name++) * 0x01000193;
+    }
+    return hash;
+}
+
+int CloudCommandTable::add(const char *name, std::function<int(JSONValue *)> handler)
+{
+    if(find(name))
+    {
+        return -EEXIST;
+    }
+
+    // keep at least one entry free so that lookups of unknown commands end
+    if(_count >= CLOUD_MAX_COMMANDS - 1)
+    {
+        return -ENOSPC;
+    }
+
+    uint32_t name_hash = hash(name);
+    size_t i = name_hash & (CLOUD_MAX_COMMANDS - 1);
+    while(_entries[i].name[0])
+    {
+        i = (i + 1) & (CLOUD_MAX_COMMANDS - 1);
+    }
+
+    _entries[i].hash = name_hash;
+    strlcpy(_entries[i].name, name, sizeof(_entries[i].name));
+    _entries[i].handler = handler;
+    _count++;
+
+    return 0;
+}
+
+std::function<int(JSONValue *)> *CloudCommandTable::find(const char *name)
+{
+    uint32_t name_hash = hash(name);
+
+    for(size_t i = name_hash & (CLOUD_MAX_COMMANDS - 1); _entries[i].name[0]; i = (i + 1) & (CLOUD_MAX_COMMANDS - 1))
+    {
+        if(_entries[i].hash == name_hash && !strcmp(_entries[i].name, name))
+        {
+            return &_entries[i].handler;
+        }
+    }
+
+    return nullptr;
+}
+
+int CloudAckTable::add(cloud_service_ack_context&& context)
+{
+    if(_count == CLOUD_MAX_PENDING_ACKS)
+    {
+        return -ENOSPC;
+    }
+
+    // req_ids are handed out in sequence so they rarely collide
+    size_t i = context.req_id & mask;
+    while(_entries[i].used)
+    {
+        i = (i + 1) & mask;
+    }
+
+    _entries[i].context = std::move(context);
+    _entries[i].used = true;
+    _entries[i].heap = _count;
+    _heap[_count] = i;
+    sift_up(_count++);
+
+    return 0;
+}
+
+bool CloudAckTable::take(uint32_t req_id, cloud_service_ack_context &context)
+{
+    for(size_t i = req_id & mask; _entries[i].used; i = (i + 1) & mask)
+    {
+        if(_entries[i].context.req_id == req_id)
+        {
+            context = std::move(_entries[i].context);
+            remove(i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const cloud_service_ack_context *CloudAckTable::earliest()
+{
+    return _count ? &_entries[_heap[0]].context : nullptr;
+}
+
+bool CloudAckTable::take_earliest(cloud_service_ack_context &context)
+{
+    if(!_count)
+    {
+        return false;
+    }
+
+    size_t i = _heap[0];
+    context = std::move(_entries[i].context);
+    remove(i);
+    return true;
+}
+
+// drops the entry from the heap and then closes the gap it leaves in the
+// table by moving back later entries of the same probe run
+void CloudAckTable::remove(size_t index)
+{
+    size_t pos = _entries[index].heap;
+    if(pos != --_count)
+    {
+        swap(pos, _count);
+        sift_down(pos);
+        sift_up(pos);
+    }
+
+    for(size_t j = (index + 1) & mask; _entries[j].used; j = (j + 1) & mask)
+    {
+        size_t home = _entries[j].context.req_id & mask;
+        if(((j - home) & mask) >= ((j - index) & mask))
+        {
+            _entries[index] = std::move(_entries[j]);
+            _heap[_entries[index].heap] = index;
+            index = j;
+        }
+    }
+
+    _entries[index].context = cloud_service_ack_context();
+    _entries[index].used = false;
+}
+
+bool CloudAckTable::before(size_t a, size_t b)
+{
+    return _entries[_heap[a]].context.timeout < _entries[_heap[b]].context.timeout;
+}
+
+void CloudAckTable::swap(size_t a, size_t b)
+{
+    std::swap(_heap[a], _heap[b]);
+    _entries[_heap[a]].heap = a;
+    _entries[_heap[b]].heap = b;
+}
+
+void CloudAckTable::sift_up(size_t pos)
+{
+    while(pos && before(pos, (pos - 1) / 2))
+    {
+        swap(pos, (pos - 1) / 2);
+        pos = (pos - 1) / 2;
+    }
+}
+
+void CloudAckTable::sift_down(size_t pos)
+{
+    while(true)
+    {
+        size_t child = pos * 2 + 1;
+        if(child >= _count)
+        {
+            break;
+        }
+        if(child + 1 < _count && before(child + 1, child))
+        {
+            child++;
+        }
+        if(!before(child, pos))
+        {
+            break;
+        }
+        swap(pos, child);
+        pos = child;
+    }
+}
+
 CloudService *CloudService::_instance = nullptr;
 
 CloudService::CloudService() :
@@ -59,6 +239,15 @@ void CloudService::init(const char *cmd)
     // use default function name if not provided on init
     Particle.function(cmd ? cmd : CLOUD_DEFAULT_FUNCTION_NAME,
         &CloudService::dispatchCommand, this);
+    // keep several publishes outstanding so a backlog isn't held to one
+    // cloud round trip at a time
+    // the low priority queue carries stored location publishes and Modbus
+    // results, which are kept in the order they were recorded
+    // the normal queue stays pipelined as its events don't depend on their
+    // order: a config module is in at most one cfg event awaiting its ack,
+    // acks each answer their own request, and loc events carry their time
+    background_publish.set_pipeline_depth(BackgroundPublish<>::max_in_flight);
+    background_publish.set_ordered(1u, true);
     background_publish.start();
 }
 
@@ -84,14 +273,11 @@ void CloudService::tick_sec()
 {
     uint32_t ms_now = millis();
 
-    // timeout ack handlers
-    for (auto it = ack_handlers.begin(); it != ack_handlers.end();) {
-        if (ms_now > it->timeout) {
-            it->callback(CloudServiceStatus::TIMEOUT, std::move(it->data));
-            it = ack_handlers.erase(it);
-        } else {
-            ++it;
-        }
+    // timeout ack handlers, earliest first
+    cloud_service_ack_context context;
+    for (auto earliest = ack_handlers.earliest(); earliest && ms_now > earliest->timeout; earliest = ack_handlers.earliest()) {
+        ack_handlers.take_earliest(context);
+        context.callback(CloudServiceStatus::TIMEOUT, std::move(context.data));
     }
 }
 
@@ -112,14 +298,26 @@ int CloudService::registerCommand(const char *cmd, std::function<int(JSONValue *
     if (!cmd || (strnlen(cmd, 1 + CLOUD_MAX_CMD_LEN) > CLOUD_MAX_CMD_LEN) || !handler) {
         return -EINVAL;
     }
-    command_handlers.push_back(std::make_pair(String(cmd), handler));
-    return 0;
+    int rval = command_handlers.add(cmd, handler);
+    if (rval == -EEXIST) {
+        Log.error("command %s is already registered", cmd);
+    } else if (rval == -ENOSPC) {
+        Log.error("unable to register command %s, %d commands at most", cmd, CLOUD_MAX_COMMANDS - 1);
+    }
+    return rval;
 }
 
 int CloudService::registerAckCallback(cloud_service_ack_context&& context)
 {
     std::lock_guard<RecursiveMutex> lg(mutex);
-    ack_handlers.push_back(std::move(context));
+
+    // give up on the ack closest to timing out to make room
+    cloud_service_ack_context earliest;
+    if (ack_handlers.add(std::move(context)) == -ENOSPC && ack_handlers.take_earliest(earliest)) {
+        Log.warn("%d acks pending, giving up on req_id %lu", CLOUD_MAX_PENDING_ACKS, (unsigned long) earliest.req_id);
+        earliest.callback(CloudServiceStatus::TIMEOUT, std::move(earliest.data));
+        return ack_handlers.add(std::move(context));
+    }
     return 0;
 }
 
@@ -221,23 +419,18 @@ int CloudService::dispatchCommand(String data)
  
     std::lock_guard<RecursiveMutex> lg(mutex);
 
-    for (auto& [cmd_name, handler]: command_handlers) {
-        if (cmd_name == cmd) {
-            return handler(&root);
-        }
+    auto handler = command_handlers.find(cmd);
+    if (handler) {
+        return (*handler)(&root);
     }
 
     // Process ack messages
     if (strncmp(cmd, "ack", 1 + sizeof("ack"))) {
         return -ENOENT;
     }
-    for (auto it = ack_handlers.begin(); it != ack_handlers.end();) {
-        if (req_id == it->req_id) {
-            rval = it->callback(CloudServiceStatus::SUCCESS, std::move(it->data));
-            it = ack_handlers.erase(it);
-        } else {
-            ++it;
-        }
+    cloud_service_ack_context context;
+    if (ack_handlers.take(req_id, context)) {
+        rval = context.callback(CloudServiceStatus::SUCCESS, std::move(context.data));
     }
 
     return rval;
@@ -254,7 +447,14 @@ int CloudService::beginCommand(const char *cmd)
     // I2C device in order to format into the output command)
     mutex.lock();
 
-    _writer = JSONBufferWriter(json_buf, sizeof(json_buf)); // reset the output
+    // format directly into a publish slot when one is available so that send()
+    // doesn't have to copy the finished command
+    char *buf = background_publish.claimed(_writer.buffer()) ? _writer.buffer() : background_publish.claim();
+    if(!buf)
+    {
+        buf = json_buf;
+    }
+    _writer = JSONBufferWriter(buf, sizeof(json_buf)); // reset the output
 
     writer().beginObject();
     writer().name(CLOUD_KEY_CMD).value(cmd);
@@ -313,6 +513,11 @@ int CloudService::send(const char *data,
         if(!event_name)
         {
             Log.info("Event Name failed: %s", data);
+            // give back the publish slot the command was formatted into
+            if(background_publish.claimed(data))
+            {
+                background_publish.release();
+            }
             return -EINVAL;
         }
     }    
@@ -322,7 +527,7 @@ int CloudService::send(const char *data,
     // much simpler if there is no callback and can just publish into the void
     if(!cb)
     {
-        if (!background_publish.publish(_writer_event_name, data, PRIVATE, priority))
+        if (!publish(data, PRIVATE, priority))
         {
             rval = -EBUSY;
         }
@@ -358,8 +563,7 @@ int CloudService::send(const char *data,
         }
     );
 
-    if(!background_publish.publish(_writer_event_name, data,
-                                   publish_flags | PRIVATE, priority, std::move(publish_cb)))
+    if(!publish(data, publish_flags | PRIVATE, priority, std::move(publish_cb)))
     {
         rval = -EBUSY;
     }
@@ -372,6 +576,20 @@ int CloudService::send(const char *data,
     return rval;
 }
 
+bool CloudService::publish(const char *data,
+    PublishFlags publish_flags,
+    std::size_t priority,
+    BackgroundPublish<>::publish_callback cb)
+{
+    // commands formatted in a claimed slot are queued as they are, anything
+    // else is copied into a free slot
+    if(background_publish.claimed(data))
+    {
+        return background_publish.commit(_writer_event_name, publish_flags, priority, std::move(cb));
+    }
+    return background_publish.publish(_writer_event_name, data, publish_flags, priority, std::move(cb));
+}
+
 int CloudService::send(PublishFlags publish_flags, 
                     CloudServicePublishFlags cloud_flags, 
                     cloud_service_ack_callback cb,
@@ -394,6 +612,10 @@ int CloudService::send(PublishFlags publish_flags,
     // dataSize does not include the null terminator
     if(writer().dataSize() >= writer().bufferSize())
     {
+        if(background_publish.claimed(writer().buffer()))
+        {
+            background_publish.release();
+        }
         unlock();
         return -ENOSPC;
     }
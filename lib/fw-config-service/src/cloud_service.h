@@ -34,6 +34,25 @@
 #define CLOUD_CMD_CFG "cfg"
 
 #define CLOUD_MAX_CMD_LEN (32)
+
+// capacity of the command table, a power of two comfortably above the number
+// of registered commands, one entry is always left free so at most
+// CLOUD_MAX_COMMANDS - 1 commands can be registered
+#ifndef CLOUD_MAX_COMMANDS
+#define CLOUD_MAX_COMMANDS (16)
+#endif
+
+// commands registered by this firmware: set_cfg, get_cfg, reset_to_factory,
+// get_loc, loc-enhanced, reset, enter_shipping, and modbus_stats
+#define CLOUD_FIRMWARE_COMMANDS (8)
+static_assert(CLOUD_FIRMWARE_COMMANDS < CLOUD_MAX_COMMANDS, "CLOUD_MAX_COMMANDS is too small for the commands of this firmware");
+
+// publishes that can await an application ack at once, a power of two
+// once full the ack closest to timing out is given up on with a TIMEOUT
+// status to make room for the next
+#ifndef CLOUD_MAX_PENDING_ACKS
+#define CLOUD_MAX_PENDING_ACKS (32)
+#endif
 #define CLOUD_PUB_PREFIX ""
 
 #define CLOUD_DEFAULT_TIMEOUT_MS (10000)
@@ -67,6 +86,68 @@ struct cloud_service_ack_context {
     String data; // copy of original payload
 };
 
+// fixed capacity open addressing table of command handlers keyed by name
+class CloudCommandTable
+{
+    public:
+        CloudCommandTable() : _count(0) {}
+
+        int add(const char *name, std::function<int(JSONValue *)> handler);
+        std::function<int(JSONValue *)> *find(const char *name);
+    private:
+        static_assert(!(CLOUD_MAX_COMMANDS & (CLOUD_MAX_COMMANDS - 1)), "CLOUD_MAX_COMMANDS must be a power of two");
+
+        static uint32_t hash(const char *name);
+
+        struct entry_t {
+            uint32_t hash;
+            char name[CLOUD_MAX_CMD_LEN + 1]; // empty when the entry is unused
+            std::function<int(JSONValue *)> handler;
+        };
+
+        entry_t _entries[CLOUD_MAX_COMMANDS] {};
+        size_t _count;
+};
+
+// fixed capacity table of publishes awaiting an application ack indexed by
+// req_id, with a min-heap of their timeouts so that expiry only ever looks
+// at the earliest
+class CloudAckTable
+{
+    public:
+        CloudAckTable() : _count(0) {}
+
+        // -ENOSPC when full
+        int add(cloud_service_ack_context&& context);
+
+        // remove the context for the req_id, false if there is none
+        bool take(uint32_t req_id, cloud_service_ack_context &context);
+
+        // context with the earliest timeout, null when empty
+        const cloud_service_ack_context *earliest();
+        bool take_earliest(cloud_service_ack_context &context);
+    private:
+        static_assert(!(CLOUD_MAX_PENDING_ACKS & (CLOUD_MAX_PENDING_ACKS - 1)), "CLOUD_MAX_PENDING_ACKS must be a power of two");
+        static constexpr size_t mask = CLOUD_MAX_PENDING_ACKS - 1;
+
+        struct entry_t {
+            cloud_service_ack_context context;
+            uint16_t heap; // position of the entry in the heap
+            bool used;
+        };
+
+        void remove(size_t index);
+        bool before(size_t a, size_t b);
+        void swap(size_t a, size_t b);
+        void sift_up(size_t pos);
+        void sift_down(size_t pos);
+
+        entry_t _entries[CLOUD_MAX_PENDING_ACKS] {};
+        // entry indices ordered by timeout
+        uint16_t _heap[CLOUD_MAX_PENDING_ACKS];
+        size_t _count;
+};
+
 class CloudService
 {
     public:
@@ -143,6 +224,8 @@ class CloudService
         // process and dispatch incoming commands to registered callbacks
         int dispatchCommand(String cmd);
 
+        // -EEXIST if a handler is already registered for the name, -ENOSPC
+        // once CLOUD_MAX_COMMANDS - 1 commands are registered
         int registerCommand(const char *name, std::function<int(JSONValue *)> handler);
 
     private:
@@ -158,6 +241,12 @@ class CloudService
 
         uint32_t get_next_req_id();
 
+        bool publish(const char *data,
+            PublishFlags publish_flags,
+            std::size_t priority,
+            BackgroundPublish<>::publish_callback cb=nullptr);
+
+        // fallback for formatting commands when no publish slot can be claimed
         char json_buf[particle::protocol::MAX_EVENT_DATA_LENGTH + 1];
         JSONBufferWriter _writer;
         char _writer_event_name[sizeof(CLOUD_PUB_PREFIX) + CLOUD_MAX_CMD_LEN];
@@ -167,8 +256,8 @@ class CloudService
 
         uint32_t last_tick_sec;
 
-        std::list<cloud_service_ack_context> ack_handlers;
-        std::list<std::pair<String, std::function<int(JSONValue *)>>> command_handlers;
+        CloudAckTable ack_handlers;
+        CloudCommandTable command_handlers;
         std::list<std::function<int()>> deferred_acks;
 
         RecursiveMutex mutex;
@@ -18,12 +18,14 @@
 
 #if HAL_PLATFORM_FILESYSTEM
 
+#include <algorithm>
 #include <dirent.h>
 #include <fcntl.h>
 
 #include "config_service.h"
 //#include "cloud_service.h"
 
+#include "config_service_stream.h"
 #include "murmur3.h"
 
 Logger config_service_log("Config Service");
@@ -32,6 +34,7 @@ int _config_process_json(JSONValue &json_root, const char *json_root_name, Confi
 int config_process_json(const char *json, size_t size, ConfigNode *config_root);
 int config_write_json(ConfigNode *root, JSONWriter &writer);
 void config_hash(ConfigNode *root, murmur3_hash_t &hash);
+void config_bind(ConfigNode *root, uint32_t *generation);
 
 static String _format_hash_str(murmur3_hash_t &hash)
 {
@@ -42,14 +45,9 @@ static String _format_hash_str(murmur3_hash_t &hash)
         (uint32_t) hash.h[3]);
 }
 
-static int _json_parse_hash_str(JSONValue value, murmur3_hash_t &hash)
+static int _parse_hash_str(const char *value, murmur3_hash_t &hash)
 {
-    if(!value.isString())
-    {
-        return -EINVAL;
-    }
-
-    if(sscanf(value.toString().data(),
+    if(sscanf(value,
         "%08lx%08lx%08lx%08lx%*c",
         &hash.h[0],
         &hash.h[1],
@@ -91,6 +89,73 @@ int ConfigObject::enter(bool write)
 
 int ConfigObject::exit(bool write, int status)
 {
+    // exit callbacks commit values written to the write context
+    if(write)
+    {
+        touch();
+    }
+    if(exit_cb)
+    {
+        return exit_cb(write, status, (!write || !wcontext) ? context : wcontext);
+    }
+    return status;
+}
+
+int ConfigArray::count(bool write, int32_t &value)
+{
+    if(!get_count_cb)
+    {
+        return -EPERM;
+    }
+
+    return get_count_cb(value, (!write || !wcontext) ? context : wcontext);
+}
+
+int ConfigArray::resize(int32_t value)
+{
+    if(!set_count_cb)
+    {
+        return -EPERM;
+    }
+
+    if(value < 0 || value > max_count)
+    {
+        return -EDOM;
+    }
+
+    int rval = set_count_cb(value, wcontext ? wcontext : context);
+    if(!rval)
+    {
+        touch();
+    }
+    return rval;
+}
+
+int ConfigArray::select(bool write, int32_t index)
+{
+    if(!select_cb)
+    {
+        return -EPERM;
+    }
+
+    return select_cb(index, (!write || !wcontext) ? context : wcontext);
+}
+
+int ConfigArray::enter(bool write)
+{
+    if(enter_cb)
+    {
+        return enter_cb(write, (!write || !wcontext) ? context : wcontext);
+    }
+    return 0;
+}
+
+int ConfigArray::exit(bool write, int status)
+{
+    if(write)
+    {
+        touch();
+    }
     if(exit_cb)
     {
         return exit_cb(write, status, (!write || !wcontext) ? context : wcontext);
@@ -128,7 +193,12 @@ int ConfigStringEnum::set(const char *value)
     {
         if(!strcmp(pair.first, value))
         {
-            return set_cb(pair.second, this->wcontext ? this->wcontext : this->context);
+            int rval = set_cb(pair.second, this->wcontext ? this->wcontext : this->context);
+            if(!rval)
+            {
+                touch();
+            }
+            return rval;
         }
     }
 
@@ -158,10 +228,17 @@ int ConfigStringEnum::get(const char * &value)
 
 ConfigService *ConfigService::_instance = nullptr;
 ConfigService::ConfigService() :
+    last_tick_sec(0),
+    last_rehash_sec(0),
     fs_ok(false),
+    snapshot_stale(false),
+    snapshot_on_file(true),
+    snapshot_retry_sec(0),
+    snapshot_backoff_sec(0),
     sync_pending(false),
     sync_ok(false),
-    config_sync_pending_object(nullptr)
+    last_sync_batch(0),
+    sync_batches_pending(0)
 {
 }
 
@@ -204,11 +281,34 @@ void ConfigService::flush()
 {
     if(fs_ok)
     {
-        for(auto &it : configs)
+        rehash(true);
+        save_all();
+    }
+}
+
+void ConfigService::markChanged(const char *name)
+{
+    for(auto &it : configs)
+    {
+        if(!name || !strcmp(it.root->name(), name))
+        {
+            it.generation++;
+        }
+    }
+}
+
+// rehash only the modules written since they were last hashed
+// all modules are rehashed on force to pick up any changes made directly to
+// the underlying values rather than through the config nodes
+void ConfigService::rehash(bool force)
+{
+    for(auto &it : configs)
+    {
+        if(force || it.generation != it.hash_generation)
         {
+            it.hash_generation = it.generation;
             config_hash(it.root, it.hash);
         }
-        save_all();
     }
 }
 
@@ -218,11 +318,13 @@ void ConfigService::tick_sec()
     // on crc mismatch
     // make sure we are likely to succeed in publishing first...
 
-    // update hash across all configs once a second for change detection
-    for(auto &it : configs)
+    // update hash of changed configs once a second for change detection
+    bool rescan = (last_tick_sec - last_rehash_sec) >= CONFIG_SERVICE_REHASH_INTERVAL;
+    if(rescan)
     {
-        config_hash(it.root, it.hash);
+        last_rehash_sec = last_tick_sec;
     }
+    rehash(rescan);
 
     if(Particle.connected())
     {
@@ -250,28 +352,13 @@ void ConfigService::tick_sec()
         }
         else
         {
-            if(!config_sync_pending_object)
+            // modules are batched into events up to the maximum event size
+            // with several events awaiting acknowledgement at once
+            while(sync_batches_pending < CONFIG_SERVICE_SYNC_MAX_PENDING)
             {
-                for(auto &it : configs)
+                if(sync_batch() <= 0)
                 {
-                    if(it.hash != it.sync_hash)
-                    {
-                        cloud_service.beginCommand(CLOUD_CMD_CFG);
-                        cloud_service.writer().name("cfg").beginObject();
-                        config_write_json(it.root, cloud_service.writer());
-                        cloud_service.writer().endObject();
-                        // TODO: Cloud is not sending app ack yet
-                        // if(!cloud_service.send(WITH_ACK, CloudServicePublishFlags::FULL_ACK, &ConfigService::config_sync_ack_cb, this, CLOUD_DEFAULT_TIMEOUT_MS))
-                        if(!cloud_service.send(WITH_ACK, CloudServicePublishFlags::NONE, &ConfigService::config_sync_ack_cb, this, CLOUD_DEFAULT_TIMEOUT_MS))
-                        {
-                            config_sync_pending_object = &it;
-                            // possible config could be updated again before ack
-                            // received so save off the hash we sent rather than
-                            // simply using the current hash in the callback
-                            config_sync_pending_hash = it.hash;
-                            break;
-                        }
-                    }
+                    break;
                 }
             }
         }
@@ -282,6 +369,10 @@ void ConfigService::tick_sec()
     {
         save_all();
     }
+
+    // modules register during setup so the snapshot isn't needed past the
+    // first tick
+    snapshot.release();
 }
 
 void ConfigService::resetToFactory()
@@ -316,19 +407,25 @@ void ConfigService::save_all(bool force)
     {
         _save(it, force);
     }
+
+    _update_snapshot();
 }
 
 int ConfigService::save(const char *name, bool force)
 {
+    int error = -ENOENT;
+
     for(auto &it : configs)
     {
         if(!strcmp(it.root->name(), name))
         {
-            _save(it, force);
+            error = _save(it, force);
         }
     }
 
-    return 0;
+    _update_snapshot();
+
+    return error;
 }
 
 // A bug in Device-OS 1.5.3 caused newlib to call into the unsupported _link()
@@ -336,32 +433,27 @@ int ConfigService::save(const char *name, bool force)
 // the _rename() function (also exported via dynalb) and call directly.
 extern "C" int _rename(const char* oldpath, const char* newpath);
 
-int ConfigService::_save(config_service_desc_t &config_desc, bool force)
+void ConfigService::_write_file_json(config_service_desc_t &config_desc, JSONWriter &writer)
 {
-    if(!force && config_desc.hash == config_desc.file_hash && config_desc.sync_hash == config_desc.file_sync_hash)
-    {
-        return 0;
-    }
-
-    // TODO: use a JSONStreamWriter so we don't have a limit on the output config size
-    // and don't need to consume as much memory. Will require overloading a stream to point
-    // at an underlying FS file, etc.
-    char buf[1024];
-    JSONBufferWriter writer(buf, sizeof(buf));
-
     writer.beginObject();
     writer.name(CONFIG_SERVICE_FS_VERSION_KEY).value(CONFIG_SERVICE_FS_VERSION);
     writer.name(CONFIG_SERVICE_FS_SYNC_HASH_KEY).value(_format_hash_str(config_desc.sync_hash).c_str());
     config_write_json(config_desc.root, writer);
     writer.endObject();
-    // output json overflowed the buffer
-    if(writer.dataSize() >= writer.bufferSize())
+}
+
+int ConfigService::_save(config_service_desc_t &config_desc, bool force)
+{
+    if(!force && config_desc.hash == config_desc.file_hash && config_desc.sync_hash == config_desc.file_sync_hash)
     {
-        return -ENOSPC;
+        return 0;
     }
 
-    Log.info("saving config %s: %.*s", config_desc.root->name(), (int) writer.dataSize(), writer.buffer());
+    return _write_file(config_desc);
+}
 
+int ConfigService::_write_file(config_service_desc_t &config_desc)
+{
     // to ensure we always have a valid config write new config to a temp file
     // and use rename() to move over the original file.
     // rename() is an atomic operation on the filesystem so will either succeed
@@ -369,26 +461,38 @@ int ConfigService::_save(config_service_desc_t &config_desc, bool force)
     String filename = _get_filename(config_desc.root->name());
     String temp_filename = filename + ".tmp";
 
-    // new config to the temp file
+    // stream the new config to the temp file a buffer at a time
     int fd = open(temp_filename, O_CREAT | O_WRONLY | O_TRUNC, 0664);
-    if(fd <= 0)
+    if(fd < 0)
     {
         return -errno;
     }
 
-    int error = 0;
-    int written = write(fd, writer.buffer(), writer.dataSize());
-    if(written < 0)
+    ConfigFileWriter file(fd);
+    JSONStreamWriter writer(file);
+    _write_file_json(config_desc, writer);
+    int error = file.sync();
+
+    close(fd);
+
+    // the snapshot must be gone before any module file changes so a reset
+    // before it is rewritten can't load values older than the module files
+    if(!error && snapshot_on_file)
     {
-        error = -errno;
+        if(remove(CONFIG_SERVICE_SNAPSHOT_FILENAME) && errno != ENOENT)
+        {
+            error = -errno;
+        }
+        else
+        {
+            snapshot_on_file = false;
+        }
     }
-    else if(written != (int) writer.dataSize())
+    if(!error)
     {
-        error = -EIO;
+        snapshot_stale = true;
     }
 
-    close(fd);
-
     // then rename over the existing config
     if(!error)
     {
@@ -398,6 +502,7 @@ int ConfigService::_save(config_service_desc_t &config_desc, bool force)
         }
         else
         {
+            Log.info("saved config %s: %u bytes", config_desc.root->name(), (unsigned int) file.size());
             config_desc.file_hash = config_desc.hash;
             config_desc.file_sync_hash = config_desc.sync_hash;
         }
@@ -409,63 +514,62 @@ int ConfigService::_save(config_service_desc_t &config_desc, bool force)
 // processes the json file format and applies into the config object
 // looks for a matching file format version, valid hash, and correct
 // naming of the enclosed config blob before applying
-int _process_load(config_service_desc_t &config_desc, char *json, size_t size)
+// without apply the file is only checked so a damaged file can be rejected
+// before any of it reaches the config object
+static int _process_load(config_service_desc_t &config_desc, ConfigFileReader &reader, bool apply)
 {
-    // TODO: All of the parse() calls require the entire JSON string in memory
-    // It would be useful to define a Stream variant and then we could wrap the
-    // file handle in a new Stream type and use that instead to cut down on
-    // dynamic memory requirements for potentially large config blobs.
-    JSONValue json_root = JSONValue::parse(json, size);
-    int error = 0;
+    const char *name = nullptr;
+    const char *hash_str = nullptr;
+    int32_t version = 0;
+    murmur3_hash_t sync_hash;
+
+    int error = reader.begin_object();
+
+    if(!error &&
+        (reader.next_member(0, name) != 1 ||
+        strcmp(name, CONFIG_SERVICE_FS_VERSION_KEY) ||
+        reader.read_int(version) ||
+        version != CONFIG_SERVICE_FS_VERSION))
+    {
+        error = -EINVAL;
+    }
 
-    if(json_root.type() == JSON_TYPE_OBJECT)
+    if(!error &&
+        (reader.next_member(1, name) != 1 ||
+        strcmp(name, CONFIG_SERVICE_FS_SYNC_HASH_KEY) ||
+        reader.read_string(hash_str) ||
+        _parse_hash_str(hash_str, sync_hash)))
     {
-        JSONObjectIterator it(json_root);
-        int field_count = 0;
+        error = -EINVAL;
+    }
 
-        while(!error && it.next())
-        {
-            JSONValue json_child = it.value();
-            switch(field_count++)
-            {
-                case 0:
-                    if(strcmp(it.name().data(), CONFIG_SERVICE_FS_VERSION_KEY) ||
-                        !json_child.isNumber() ||
-                        json_child.toInt() != CONFIG_SERVICE_FS_VERSION)
-                    {
-                        error = -EINVAL;
-                    }
-                    break;
-                case 1:
-                    if(strcmp(it.name().data(), CONFIG_SERVICE_FS_SYNC_HASH_KEY) ||
-                        _json_parse_hash_str(json_child, config_desc.file_sync_hash))
-                    {
-                        error = -EINVAL;
-                    }
-                    break;
-                case 2:
-                    if(strcmp(it.name().data(), config_desc.root->name()) ||
-                        !json_child.isObject())
-                    {
-                        error = -EINVAL;
-                    }
-                    else
-                    {
-                        error = _config_process_json(json_child, (const char *) it.name(), config_desc.root);
-                        if(!error)
-                        {
-                            config_hash(config_desc.root, config_desc.file_hash);
-                            config_desc.hash = config_desc.file_hash;
-                            config_desc.sync_hash = config_desc.file_sync_hash;
-                        }
-                    }
-                    break;
-                default:
-                    error = -EINVAL;
-                    break;
-            }
-        }
+    if(!error &&
+        (reader.next_member(2, name) != 1 ||
+        strcmp(name, config_desc.root->name())))
+    {
+        error = -EINVAL;
     }
+
+    if(!error)
+    {
+        // a module value of the wrong type passes the check but fails the
+        // apply before anything has been written to the config object
+        error = apply ? reader.apply(config_desc.root) : reader.apply(nullptr);
+    }
+
+    if(!error && (reader.next_member(3, name) != 0 || reader.end()))
+    {
+        error = -EINVAL;
+    }
+
+    if(!error && apply)
+    {
+        config_desc.file_sync_hash = sync_hash;
+        config_hash(config_desc.root, config_desc.file_hash);
+        config_desc.hash = config_desc.file_hash;
+        config_desc.sync_hash = config_desc.file_sync_hash;
+    }
+
     return error;
 }
 
@@ -492,33 +596,103 @@ int ConfigService::_load(config_service_desc_t &config_desc)
         return errno;
     }
 
-    char *json = (char *) malloc(st.st_size);
-    memset(json, 0, st.st_size);
+    Log.info("loading config %s: %ld bytes", config_desc.root->name(), (long) st.st_size);
 
-    if(!json)
+    // parse the file twice with only a small buffer in memory, once to
+    // validate it and again to apply it
+    ConfigFileReader reader(fd);
+    error = _process_load(config_desc, reader, false);
+    if(!error)
     {
-        close(fd);
-        return -ENOMEM;
+        error = reader.rewind();
+    }
+    if(!error)
+    {
+        error = _process_load(config_desc, reader, true);
     }
 
-    int rval = read(fd, json, st.st_size);
-    if(rval < 0)
+    close(fd);
+
+    return error;
+}
+
+// rewrites a stale snapshot, backing off after failures as a module that
+// can't be written to the snapshot fails the same way every time
+void ConfigService::_update_snapshot()
+{
+    if(!snapshot_stale || (int32_t) (last_tick_sec - snapshot_retry_sec) < 0)
     {
-        error = errno;
+        return;
     }
-    else if(rval != st.st_size)
+
+    if(_save_snapshot())
     {
-        error = -EINVAL;
+        snapshot_backoff_sec = snapshot_backoff_sec ?
+            std::min<uint32_t>(snapshot_backoff_sec * 2, CONFIG_SERVICE_SNAPSHOT_MAX_BACKOFF) :
+            CONFIG_SERVICE_REHASH_INTERVAL;
+        snapshot_retry_sec = last_tick_sec + snapshot_backoff_sec;
     }
     else
     {
-        Log.info("loading config %s: %.*s", config_desc.root->name(), (int) st.st_size, json);
-        error = _process_load(config_desc, json, st.st_size);
+        snapshot_backoff_sec = 0;
+    }
+}
+
+// writes every module that matches its saved file to a new snapshot
+int ConfigService::_save_snapshot()
+{
+    String temp_filename = String(CONFIG_SERVICE_SNAPSHOT_FILENAME) + ".tmp";
+
+    int fd = open(temp_filename, O_CREAT | O_WRONLY | O_TRUNC, 0664);
+    if(fd < 0)
+    {
+        return -errno;
+    }
+
+    ConfigSnapshotWriter writer(fd);
+    int error = 0;
+    uint16_t modules = 0;
+
+    for(auto &it : configs)
+    {
+        // modules with changes not yet saved are left to their own files
+        if(it.generation == it.hash_generation &&
+            it.hash == it.file_hash &&
+            it.sync_hash == it.file_sync_hash)
+        {
+            error = writer.add(it.root, it.sync_hash);
+            if(error)
+            {
+                break;
+            }
+            modules++;
+        }
+    }
+
+    if(!error)
+    {
+        error = writer.finish();
     }
 
-    free(json);
     close(fd);
 
+    if(!error && _rename(temp_filename, CONFIG_SERVICE_SNAPSHOT_FILENAME))
+    {
+        error = -errno;
+    }
+
+    if(error)
+    {
+        remove(temp_filename);
+        Log.warn("failed to save config snapshot: %d", error);
+    }
+    else
+    {
+        Log.info("saved config snapshot: %u modules", modules);
+        snapshot_stale = false;
+        snapshot_on_file = true;
+    }
+
     return error;
 }
 
@@ -546,10 +720,27 @@ int ConfigService::registerModule(ConfigNode &root)
 
     if(fs_ok)
     {
-        _load(desc);
+        // all saved modules are read from a single snapshot at boot with the
+        // module's own file as the fallback
+        snapshot.load(CONFIG_SERVICE_SNAPSHOT_FILENAME);
+        if(!snapshot.apply(desc.root, desc.file_sync_hash))
+        {
+            Log.info("loaded config %s from snapshot", desc.root->name());
+            config_hash(desc.root, desc.file_hash);
+            desc.hash = desc.file_hash;
+            desc.sync_hash = desc.file_sync_hash;
+        }
+        else if(!_load(desc))
+        {
+            // include the module in the snapshot next time it is written
+            snapshot_stale = true;
+        }
     }
 
+    // hash on the next tick whether or not a config was loaded
+    desc.generation = desc.hash_generation + 1;
     configs.push_front(desc);
+    config_bind(configs.front().root, &configs.front().generation);
 
     return 0;
 }
@@ -690,20 +881,157 @@ int ConfigService::sync_ack_cb(CloudServiceStatus status, String&& req_event)
 }
 
 // callback for ack to individual config sync with cloud
-int ConfigService::config_sync_ack_cb(CloudServiceStatus status, String&& req_event)
+// the cloud now holds the leaf values sent for every module in the batch
+int ConfigService::config_sync_ack_cb(CloudServiceStatus status, uint32_t batch)
 {
-    if(status == CloudServiceStatus::SUCCESS)
+    bool found = false;
+
+    for(auto &it : configs)
     {
-        if(config_sync_pending_object)
+        if(it.sync_batch != batch)
         {
-            config_sync_pending_object->sync_hash = config_sync_pending_hash;
+            continue;
         }
+
+        if(status == CloudServiceStatus::SUCCESS)
+        {
+            // possible config could be updated again before ack received so
+            // use the hash we sent rather than simply the current hash
+            if(it.sync_batch_complete)
+            {
+                it.sync_hash = it.sync_batch_hash;
+            }
+            // a part only adds to the leaves if nothing has invalidated them
+            // since it was sent, the rest of the module follows either way
+            if(it.sync_hash == it.sync_batch_hash)
+            {
+                it.sync_leaves_hash = it.sync_hash;
+                it.sync_leaves = std::move(it.sync_batch_leaves);
+            }
+        }
+        it.sync_batch_leaves.clear();
+        it.sync_batch = 0;
+        found = true;
+    }
+
+    // a batch that failed to send has already been released
+    if(found && sync_batches_pending)
+    {
+        sync_batches_pending--;
     }
-    config_sync_pending_object = nullptr;
 
     return 0;
 }
 
+// picks out modules in need of sync whose changes fit together in a single
+// event, sized by rendering each into a writer with no buffer, and sends them
+// a module too large for an event on its own is sent a part at a time
+// returns the number of modules sent
+int ConfigService::sync_batch()
+{
+    // room for the command header, the closing of the cfg and command objects,
+    // and the request id that may be added on send
+    static constexpr size_t overhead = 96;
+    static constexpr size_t space = particle::protocol::MAX_EVENT_DATA_LENGTH - overhead;
+    static const Vector<config_sync_leaf_t> none;
+
+    // zero marks a module that isn't in a batch
+    if(!++last_sync_batch)
+    {
+        last_sync_batch++;
+    }
+    uint32_t batch = last_sync_batch;
+    size_t size = 0;
+    int modules = 0;
+
+    for(auto &it : configs)
+    {
+        if(it.sync_batch || it.hash == it.sync_hash || it.hash == it.sync_unsent_hash)
+        {
+            continue;
+        }
+
+        auto &synced = (it.sync_leaves_hash == it.sync_hash) ? it.sync_leaves : none;
+        JSONBufferWriter measure(nullptr, 0);
+        measure.beginObject();
+        ConfigSyncDelta(measure, synced).write(it.root);
+        measure.endObject();
+
+        if(size + measure.dataSize() <= space)
+        {
+            size += measure.dataSize();
+            it.sync_batch = batch;
+            it.sync_batch_changes = -1;
+            modules++;
+            continue;
+        }
+
+        // modules that don't fit alongside others wait for the next event
+        if(modules || measure.dataSize() <= space)
+        {
+            continue;
+        }
+
+        int changes = ConfigSyncDelta::fit(it.root, synced, space);
+        if(changes <= 0)
+        {
+            Log.warn("config %s has a value too large to sync", it.root->name());
+            it.sync_unsent_hash = it.hash;
+            continue;
+        }
+
+        Log.info("syncing config %s in parts: %u bytes", it.root->name(), (unsigned int) measure.dataSize());
+        it.sync_batch = batch;
+        it.sync_batch_changes = changes;
+        modules++;
+        break;
+    }
+
+    if(!modules)
+    {
+        return 0;
+    }
+
+    CloudService &cloud_service = CloudService::instance();
+    cloud_service.beginCommand(CLOUD_CMD_CFG);
+    cloud_service.writer().name("cfg").beginObject();
+    for(auto &it : configs)
+    {
+        if(it.sync_batch == batch)
+        {
+            auto &synced = (it.sync_leaves_hash == it.sync_hash) ? it.sync_leaves : none;
+            it.sync_batch_leaves.clear();
+            ConfigSyncDelta delta(cloud_service.writer(), synced, &it.sync_batch_leaves);
+            delta.write(it.root, it.sync_batch_changes);
+            it.sync_batch_complete = delta.complete();
+            it.sync_batch_hash = it.sync_batch_complete ? it.hash : it.sync_hash;
+        }
+    }
+    cloud_service.writer().endObject();
+
+    // TODO: Cloud is not sending app ack yet
+    // if(!cloud_service.send(WITH_ACK, CloudServicePublishFlags::FULL_ACK, ...))
+    int rval = cloud_service.send(WITH_ACK, CloudServicePublishFlags::NONE,
+        [this, batch](CloudServiceStatus status, String&& req_event) {return config_sync_ack_cb(status, batch);},
+        CLOUD_DEFAULT_TIMEOUT_MS);
+
+    if(rval)
+    {
+        for(auto &it : configs)
+        {
+            if(it.sync_batch == batch)
+            {
+                it.sync_batch_leaves.clear();
+                it.sync_batch = 0;
+            }
+        }
+        return rval;
+    }
+
+    sync_batches_pending++;
+    return modules;
+}
+
 // pair traversal of json object and config object and apply updates to config
 // object from the json object
 int _config_process_json(JSONValue &json_root, const char *json_root_name, ConfigNode *config_root)
@@ -744,12 +1072,68 @@ int _config_process_json(JSONValue &json_root, const char *json_root_name, Confi
             break;
         case JSON_TYPE_ARRAY:
         {
-            error = -EINVAL;
+            // a json array replaces the entire contents of a config array
+            if(config_root->type() == CONFIG_NODE_TYPE_ARRAY)
+            {
+                JSONArrayIterator it(json_root);
+                ConfigArray *config_array = reinterpret_cast<ConfigArray *>(config_root);
+                error = config_array->enter(true);
+                if(!error)
+                {
+                    error = config_array->resize((int32_t) it.count());
+                }
+                for(int32_t index=0; !error && it.next(); index++)
+                {
+                    JSONValue json_child = it.value();
+                    error = config_array->select(true, index);
+                    if(!error)
+                    {
+                        error = _config_process_json(json_child, nullptr, config_array->element());
+                    }
+                }
+                error = config_array->exit(true, error);
+            }
             break;
         }
         case JSON_TYPE_OBJECT:
         {
-            if(config_root->type() == CONFIG_NODE_TYPE_OBJECT)
+            // a json object with numeric keys patches individual elements of a
+            // config array and grows the array as needed
+            if(config_root->type() == CONFIG_NODE_TYPE_ARRAY)
+            {
+                JSONObjectIterator it(json_root);
+                ConfigArray *config_array = reinterpret_cast<ConfigArray *>(config_root);
+                error = config_array->enter(true);
+                while(!error && it.next())
+                {
+                    char *end = nullptr;
+                    long index = strtol((const char *) it.name(), &end, 10);
+                    int32_t count = 0;
+
+                    if(!end || *end || end == (const char *) it.name() || index < 0 || index >= INT32_MAX)
+                    {
+                        error = -EINVAL;
+                        break;
+                    }
+
+                    error = config_array->count(true, count);
+                    if(!error && index >= count)
+                    {
+                        error = config_array->resize((int32_t) index + 1);
+                    }
+                    if(!error)
+                    {
+                        error = config_array->select(true, (int32_t) index);
+                    }
+                    if(!error)
+                    {
+                        JSONValue json_child = it.value();
+                        error = _config_process_json(json_child, (const char *) it.name(), config_array->element());
+                    }
+                }
+                error = config_array->exit(true, error);
+            }
+            else if(config_root->type() == CONFIG_NODE_TYPE_OBJECT)
             {
                 JSONObjectIterator it(json_root);
                 ConfigObject *config_object = reinterpret_cast<ConfigObject *>(config_root);
@@ -836,9 +1220,42 @@ int config_write_json(ConfigNode *root, JSONWriter &writer)
             {
                 writer.name(root->name()).value(value);
             }
+            break;
         }
         case CONFIG_NODE_TYPE_ARRAY:
+        {
+            auto array_node = reinterpret_cast<ConfigArray *>(root);
+            int32_t count = 0;
+
+            error = array_node->enter(false);
+            if(!error)
+            {
+                error = array_node->count(false, count);
+            }
+            if(!error)
+            {
+                if(root->name())
+                {
+                    writer.name(root->name()).beginArray();
+                }
+                else
+                {
+                    writer.beginArray();
+                }
+
+                for(int32_t i=0; !error && i < count; i++)
+                {
+                    error = array_node->select(false, i);
+                    if(!error)
+                    {
+                        error = config_write_json(array_node->element(), writer);
+                    }
+                }
+                writer.endArray();
+            }
+            error = array_node->exit(false, error);
             break;
+        }
         case CONFIG_NODE_TYPE_UNKNOWN:
             break;
         case CONFIG_NODE_TYPE_OBJECT:
@@ -930,9 +1347,38 @@ void _config_hash(ConfigNode *root, murmur3_hash_t &hash)
             {
                 murmur3_hash_update(hash, value, strlen(value));
             }
+            break;
         }
         case CONFIG_NODE_TYPE_ARRAY:
+        {
+            auto array_node = reinterpret_cast<ConfigArray *>(root);
+            int32_t count = 0;
+
+            error = array_node->enter(false);
+            if(!error)
+            {
+                error = array_node->count(false, count);
+            }
+            if(!error)
+            {
+                if(root->name())
+                {
+                    murmur3_hash_update(hash, root->name(), strlen(root->name()));
+                }
+                murmur3_hash_update(hash, &count, sizeof(count));
+
+                for(int32_t i=0; !error && i < count; i++)
+                {
+                    error = array_node->select(false, i);
+                    if(!error)
+                    {
+                        _config_hash(array_node->element(), hash);
+                    }
+                }
+            }
+            array_node->exit(false, error);
             break;
+        }
         case CONFIG_NODE_TYPE_UNKNOWN:
             break;
         case CONFIG_NODE_TYPE_OBJECT:
@@ -969,6 +1415,30 @@ void config_hash(ConfigNode *root, murmur3_hash_t &hash)
     murmur3_hash_finalize(hash);
 }
 
+// point every node of the config structure at the generation counter of its module
+void config_bind(ConfigNode *root, uint32_t *generation)
+{
+    root->bind(generation);
+
+    switch(root->type())
+    {
+        case CONFIG_NODE_TYPE_ARRAY:
+            config_bind(reinterpret_cast<ConfigArray *>(root)->element(), generation);
+            break;
+        case CONFIG_NODE_TYPE_OBJECT:
+        {
+            auto object_node = reinterpret_cast<ConfigObject *>(root);
+            for(int i=0; i < object_node->child_count(); i++)
+            {
+                config_bind(object_node->child(i), generation);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
 int config_get_int32_cb(int32_t &value, const void *context)
 {
     value = *(int32_t *)context;
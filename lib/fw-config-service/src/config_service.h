@@ -19,6 +19,8 @@
 #include "Particle.h"
 
 #include "config_service_nodes.h"
+#include "config_service_snapshot.h"
+#include "config_service_sync.h"
 
 #include "cloud_service.h"
 
@@ -32,6 +34,28 @@
 #define CONFIG_SERVICE_FS_VERSION_KEY "version"
 #define CONFIG_SERVICE_FS_SYNC_HASH_KEY "hash"
 #define CONFIG_SERVICE_FS_VERSION (1)
+// binary snapshot of every saved module read at boot in place of the
+// individual module files
+#ifndef CONFIG_SERVICE_SNAPSHOT_FILENAME
+    #define CONFIG_SERVICE_SNAPSHOT_FILENAME CONFIG_SERVICE_FS_PATH "/config.snap"
+#endif
+
+// longest wait between attempts to write a snapshot after a failure, the wait
+// doubles from CONFIG_SERVICE_REHASH_INTERVAL on each failure [seconds]
+#ifndef CONFIG_SERVICE_SNAPSHOT_MAX_BACKOFF
+    #define CONFIG_SERVICE_SNAPSHOT_MAX_BACKOFF (3600)
+#endif
+
+// number of cfg events that may be awaiting acknowledgement at once
+#ifndef CONFIG_SERVICE_SYNC_MAX_PENDING
+    #define CONFIG_SERVICE_SYNC_MAX_PENDING (4)
+#endif
+
+// interval to rehash every module, including those not written through the
+// config nodes since the last rehash [seconds]
+#ifndef CONFIG_SERVICE_REHASH_INTERVAL
+    #define CONFIG_SERVICE_REHASH_INTERVAL (60)
+#endif
 
 extern Logger config_service_log;
 
@@ -50,6 +74,30 @@ typedef struct config_service_desc_t {
     // are up to date
     // on mismatch will trigger save to file
     murmur3_hash_t file_sync_hash;
+    // bumped by the config nodes on every write
+    uint32_t generation;
+    // generation of the current hash
+    // on mismatch will trigger rehash of the config module
+    uint32_t hash_generation;
+    // leaf values as most recently acknowledged by the cloud, sorted by path
+    // only describe the cloud copy while sync_leaves_hash matches sync_hash
+    // otherwise the whole module is sent
+    Vector<config_sync_leaf_t> sync_leaves;
+    murmur3_hash_t sync_leaves_hash;
+    // cfg event awaiting acknowledgement that carries this module, 0 if none
+    uint32_t sync_batch;
+    // values the event may carry, negative for all of them, a module too
+    // large for one event is sent in parts
+    int sync_batch_changes;
+    // set when the event carries all of the module's changes
+    bool sync_batch_complete;
+    // hash sent in that event, or the sync hash it was sent against when it
+    // carries only a part, and the leaf values held by the cloud after it
+    murmur3_hash_t sync_batch_hash;
+    Vector<config_sync_leaf_t> sync_batch_leaves;
+    // hash of a module with a value too large for any event, it is not
+    // measured again until it changes
+    murmur3_hash_t sync_unsent_hash;
 } config_service_desc_t;
 
 class ConfigService
@@ -79,6 +127,14 @@ class ConfigService
 
         void flush();
 
+        // flag a module, or all modules if name is null, as changed after
+        // writing its values directly rather than through its config nodes
+        void markChanged(const char *name=nullptr);
+
+        // write a module to file now rather than on the next tick
+        // returns 0 on success or a negative errno
+        int save(const char *name, bool force=false);
+
     private:
         ConfigService();
         static ConfigService *_instance;
@@ -92,25 +148,44 @@ class ConfigService
         int reset_to_factory_cb(JSONValue *root);
 
         int sync_ack_cb(CloudServiceStatus status, String&& req_event);
-        int config_sync_ack_cb(CloudServiceStatus status, String&& req_event);
+        int config_sync_ack_cb(CloudServiceStatus status, uint32_t batch);
+
+        // send changes of as many modules as fit in a single cfg event
+        int sync_batch();
 
         // process infrequent actions
         void tick_sec();
 
+        void rehash(bool force=false);
+
         void save_all(bool force=false);
-        int save(const char *name, bool force=false);
 
+        void _write_file_json(config_service_desc_t &config_desc, JSONWriter &writer);
         int _save(config_service_desc_t &config_desc, bool force=false);
+        int _write_file(config_service_desc_t &config_desc);
         int _load(config_service_desc_t &config_desc);
+        int _save_snapshot();
+        void _update_snapshot();
         String _get_filename(const char *name);
 
         uint32_t last_tick_sec;
+        uint32_t last_rehash_sec;
 
         bool fs_ok;
 
+        ConfigSnapshot snapshot;
+        // set when the snapshot on file no longer covers every saved module
+        bool snapshot_stale;
+        // cleared once the snapshot file is known to be gone, it must be
+        // removed before any module file changes whether or not it is stale
+        bool snapshot_on_file;
+        // failed snapshot writes aren't attempted again until this time
+        uint32_t snapshot_retry_sec;
+        uint32_t snapshot_backoff_sec;
+
         bool sync_pending;
         bool sync_ok;
 
-        config_service_desc_t *config_sync_pending_object;
-        murmur3_hash_t config_sync_pending_hash;
+        uint32_t last_sync_batch;
+        unsigned int sync_batches_pending;
 };
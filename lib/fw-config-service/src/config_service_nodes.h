@@ -17,6 +17,8 @@
 #pragma once
 
 #include <math.h>
+#include <stdint.h>
+#include <string.h>
 
 #include <memory>
 
@@ -45,16 +47,47 @@ int config_set_float_cb(double value, const void *context);
 int config_get_string_cb(const char * &value, const void *context);
 int config_set_string_cb(const char *value, const void *context);
 
+// nodes are identified by an fnv-1a hash of their path from the module root
+// with array elements identified by index
+#define CONFIG_PATH_ROOT (0x811c9dc5)
+
+inline uint32_t config_path_hash(uint32_t path, const void *data, size_t size)
+{
+    auto bytes = (const uint8_t *) data;
+    for(size_t i=0; i < size; i++)
+    {
+        path = (path ^ bytes[i]) * 0x01000193;
+    }
+    return path;
+}
+
+inline uint32_t config_path_child(uint32_t path, const char *name)
+{
+    return config_path_hash(config_path_hash(path, "/", 1), name, strlen(name));
+}
+
+inline uint32_t config_path_element(uint32_t path, int32_t index)
+{
+    return config_path_hash(config_path_hash(path, "/", 1), &index, sizeof(index));
+}
+
 class ConfigNode
 {
     public:
-        ConfigNode(const char *name=nullptr, config_node_type_t node_type=CONFIG_NODE_TYPE_UNKNOWN) : _name(name), _type(node_type) {}
+        ConfigNode(const char *name=nullptr, config_node_type_t node_type=CONFIG_NODE_TYPE_UNKNOWN) : _name(name), _type(node_type), _generation(nullptr) {}
         virtual ~ConfigNode() {}
         config_node_type_t type() {return _type;}
         const char * name() {return _name;}
+
+        // counter of the owning module that is bumped on every successful write
+        // so the config service only rehashes modules that have changed
+        void bind(uint32_t *generation) {_generation = generation;}
+    protected:
+        void touch() { if(_generation) (*_generation)++; }
     private:
         const char *_name;
         config_node_type_t _type;
+        uint32_t *_generation;
 };
 
 // allocates a copy of of ConfigNode derived class via std::shared_ptr
@@ -279,6 +312,55 @@ class ConfigObject : public ConfigNode
         const void *wcontext;
 };
 
+// array of identically shaped elements described by a single element node
+// the select callback points the element's accessors at the requested index
+// before the element is read or written
+class ConfigArray : public ConfigNode
+{
+    public:
+        ConfigArray(const char *name,
+            ConfigNodeAllocator element,
+            std::function<int(int32_t &count, const void *context)> get_count_cb,
+            std::function<int(int32_t count, const void *context)> set_count_cb,
+            std::function<int(int32_t index, const void *context)> select_cb,
+            std::function<int(bool write, const void *context)> enter_cb=nullptr,
+            std::function<int(bool write, int status, const void *context)> exit_cb=nullptr,
+            void *context=nullptr,
+            void *wcontext=nullptr,
+            int32_t max_count=INT32_MAX) :
+        ConfigNode(name, CONFIG_NODE_TYPE_ARRAY),
+        _element(element.get()),
+        get_count_cb(get_count_cb),
+        set_count_cb(set_count_cb),
+        select_cb(select_cb),
+        enter_cb(enter_cb),
+        exit_cb(exit_cb),
+        context(context),
+        wcontext(wcontext),
+        max_count(max_count)
+        {
+        }
+
+        ConfigNode *element() { return _element.get(); }
+        int count(bool write, int32_t &value);
+        int resize(int32_t value);
+        int select(bool write, int32_t index);
+        int enter(bool write);
+        int exit(bool write, int status);
+
+        ConfigArray &max(int32_t value) {max_count = value; return *this;}
+    private:
+        std::shared_ptr<ConfigNode> _element;
+        std::function<int(int32_t &count, const void *context)> get_count_cb;
+        std::function<int(int32_t count, const void *context)> set_count_cb;
+        std::function<int(int32_t index, const void *context)> select_cb;
+        std::function<int(bool write, const void *context)> enter_cb;
+        std::function<int(bool write, int status, const void *context)> exit_cb;
+        const void *context;
+        const void *wcontext;
+        int32_t max_count;
+};
+
 template <class T, config_node_type_t NODE_T>
 bool ConfigLeaf<T, NODE_T>::check(T value)
 {
@@ -298,7 +380,12 @@ int ConfigLeaf<T, NODE_T>::set(T value)
         return -EDOM;
     }
 
-    return set_cb(value, wcontext ? wcontext : context);
+    int rval = set_cb(value, wcontext ? wcontext : context);
+    if(!rval)
+    {
+        touch();
+    }
+    return rval;
 }
 
 template <class T, config_node_type_t NODE_T>
@@ -0,0 +1,525 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Particle.h"
+
+#if HAL_PLATFORM_FILESYSTEM
+
+#include <fcntl.h>
+
+#include "config_service_snapshot.h"
+
+ConfigSnapshotWriter::ConfigSnapshotWriter(int fd) :
+    _fd(fd),
+    _file(fd),
+    _modules(0)
+{
+    // header is filled in by finish()
+    config_snapshot_header_t header = {};
+    _file.write((const uint8_t *) &header, sizeof(header));
+    murmur3_hash_start(_checksum, 0);
+}
+
+void ConfigSnapshotWriter::put(const void *data, size_t size)
+{
+    _file.write((const uint8_t *) data, size);
+    murmur3_hash_update(_checksum, data, size);
+}
+
+int ConfigSnapshotWriter::put_entry(config_node_type_t type, uint32_t path, const void *value, size_t size)
+{
+    if(size > UINT8_MAX)
+    {
+        return -ENOSPC;
+    }
+
+    uint8_t _type = type;
+    uint8_t _size = size;
+    put(&_type, sizeof(_type));
+    put(&path, sizeof(path));
+    put(&_size, sizeof(_size));
+    put(value, size);
+
+    return 0;
+}
+
+int ConfigSnapshotWriter::add(ConfigNode *root, const murmur3_hash_t &sync_hash)
+{
+    size_t name_len = strlen(root->name());
+    if(name_len > UINT8_MAX || _modules == UINT16_MAX)
+    {
+        return -ENOSPC;
+    }
+
+    uint8_t _name_len = name_len;
+    put(&_name_len, sizeof(_name_len));
+    put(root->name(), name_len);
+    put(sync_hash.h, sizeof(sync_hash.h));
+
+    int error = add_node(root, CONFIG_PATH_ROOT);
+
+    uint8_t end = CONFIG_NODE_TYPE_UNKNOWN;
+    put(&end, sizeof(end));
+    _modules++;
+
+    return error;
+}
+
+// walks the config structure the same way as hashing it
+int ConfigSnapshotWriter::add_node(ConfigNode *node, uint32_t path)
+{
+    int error = -EINVAL;
+
+    switch(node->type())
+    {
+        case CONFIG_NODE_TYPE_INT:
+        {
+            int32_t value;
+            error = reinterpret_cast<ConfigInt *>(node)->get(value);
+            if(!error)
+            {
+                error = put_entry(node->type(), path, &value, sizeof(value));
+            }
+            break;
+        }
+        case CONFIG_NODE_TYPE_BOOL:
+        {
+            bool value;
+            error = reinterpret_cast<ConfigBool *>(node)->get(value);
+            if(!error)
+            {
+                uint8_t byte = value;
+                error = put_entry(node->type(), path, &byte, sizeof(byte));
+            }
+            break;
+        }
+        case CONFIG_NODE_TYPE_FLOAT:
+        {
+            double value;
+            error = reinterpret_cast<ConfigFloat *>(node)->get(value);
+            if(!error)
+            {
+                error = put_entry(node->type(), path, &value, sizeof(value));
+            }
+            break;
+        }
+        case CONFIG_NODE_TYPE_STRING:
+        {
+            const char *value;
+            error = reinterpret_cast<ConfigString *>(node)->get(value);
+            if(!error)
+            {
+                error = put_entry(node->type(), path, value, strlen(value));
+            }
+            break;
+        }
+        case CONFIG_NODE_TYPE_STRING_ENUM:
+        {
+            // enums are kept by name like the json files so renumbering
+            // doesn't change their meaning
+            const char *value;
+            error = reinterpret_cast<ConfigStringEnum *>(node)->get(value);
+            if(!error)
+            {
+                error = put_entry(node->type(), path, value, strlen(value));
+            }
+            break;
+        }
+        case CONFIG_NODE_TYPE_ARRAY:
+        {
+            auto array_node = reinterpret_cast<ConfigArray *>(node);
+            int32_t count = 0;
+
+            error = array_node->enter(false);
+            if(!error)
+            {
+                error = array_node->count(false, count);
+            }
+            if(!error)
+            {
+                error = put_entry(node->type(), path, &count, sizeof(count));
+            }
+            for(int32_t i=0; !error && i < count; i++)
+            {
+                error = array_node->select(false, i);
+                if(!error)
+                {
+                    error = add_node(array_node->element(), config_path_element(path, i));
+                }
+            }
+            error = array_node->exit(false, error);
+            break;
+        }
+        case CONFIG_NODE_TYPE_UNKNOWN:
+            break;
+        case CONFIG_NODE_TYPE_OBJECT:
+        {
+            auto object_node = reinterpret_cast<ConfigObject *>(node);
+
+            error = object_node->enter(false);
+            for(int i=0; !error && i < object_node->child_count(); i++)
+            {
+                auto child = object_node->child(i);
+                if(child->name())
+                {
+                    error = add_node(child, config_path_child(path, child->name()));
+                }
+            }
+            error = object_node->exit(false, error);
+            break;
+        }
+    }
+
+    return error;
+}
+
+int ConfigSnapshotWriter::finish()
+{
+    config_snapshot_header_t header = {};
+
+    murmur3_hash_finalize(_checksum);
+    header.magic = CONFIG_SERVICE_SNAPSHOT_MAGIC;
+    header.version = CONFIG_SERVICE_SNAPSHOT_VERSION;
+    header.modules = _modules;
+    header.size = _file.size() - sizeof(header);
+    memcpy(header.checksum, _checksum.h, sizeof(header.checksum));
+
+    int error = _file.sync();
+    if(error)
+    {
+        return error;
+    }
+
+    if(lseek(_fd, 0, SEEK_SET) < 0)
+    {
+        return -errno;
+    }
+
+    int written = write(_fd, &header, sizeof(header));
+    if(written < 0)
+    {
+        return -errno;
+    }
+
+    return (written == sizeof(header)) ? 0 : -EIO;
+}
+
+int ConfigSnapshot::load(const char *filename)
+{
+    struct stat st;
+
+    if(_loaded)
+    {
+        return _data ? 0 : -ENOENT;
+    }
+    _loaded = true;
+
+    if(stat(filename, &st))
+    {
+        return -errno;
+    }
+
+    if(!S_ISREG(st.st_mode) || st.st_size < (off_t) sizeof(config_snapshot_header_t))
+    {
+        return -ENOENT;
+    }
+
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0)
+    {
+        return -errno;
+    }
+
+    int error = 0;
+    _size = st.st_size;
+    _data = (uint8_t *) malloc(_size);
+
+    if(!_data)
+    {
+        error = -ENOMEM;
+    }
+    else
+    {
+        int rval = read(fd, _data, _size);
+        if(rval < 0)
+        {
+            error = -errno;
+        }
+        else if(rval != (int) _size)
+        {
+            error = -EIO;
+        }
+        else
+        {
+            error = verify();
+        }
+    }
+
+    close(fd);
+
+    if(error)
+    {
+        Log.warn("config snapshot rejected: %d", error);
+        release();
+    }
+
+    return error;
+}
+
+// checks the header and checksum, then walks every record once so that
+// later lookups can trust the offsets within the snapshot
+int ConfigSnapshot::verify()
+{
+    config_snapshot_header_t header;
+    murmur3_hash_t checksum;
+
+    memcpy(&header, _data, sizeof(header));
+    if(header.magic != CONFIG_SERVICE_SNAPSHOT_MAGIC ||
+        header.version != CONFIG_SERVICE_SNAPSHOT_VERSION ||
+        header.size != _size - sizeof(header))
+    {
+        return -EINVAL;
+    }
+
+    murmur3_hash_start(checksum, 0);
+    murmur3_hash_update(checksum, _data + sizeof(header), header.size);
+    murmur3_hash_finalize(checksum);
+    if(memcmp(checksum.h, header.checksum, sizeof(header.checksum)))
+    {
+        return -EINVAL;
+    }
+
+    size_t offset = sizeof(header);
+    for(uint16_t i=0; i < header.modules; i++)
+    {
+        if(offset >= _size)
+        {
+            return -EINVAL;
+        }
+        offset += 1 + _data[offset] + sizeof(murmur3_hash_t::h);
+        offset = skip_entries(offset);
+        if(!offset)
+        {
+            return -EINVAL;
+        }
+    }
+
+    return (offset == _size) ? 0 : -EINVAL;
+}
+
+// returns the offset following the end of a module's entries, zero if the
+// entries run past the end of the snapshot
+size_t ConfigSnapshot::skip_entries(size_t offset)
+{
+    while(offset < _size)
+    {
+        if(_data[offset] == CONFIG_NODE_TYPE_UNKNOWN)
+        {
+            return offset + 1;
+        }
+        // type, path, and size before the value
+        if(offset + 6 > _size)
+        {
+            return 0;
+        }
+        offset += 6 + _data[offset + 5];
+    }
+
+    return 0;
+}
+
+void ConfigSnapshot::release()
+{
+    free(_data);
+    _data = nullptr;
+    _size = 0;
+}
+
+int ConfigSnapshot::apply(ConfigNode *root, murmur3_hash_t &sync_hash)
+{
+    if(!_data)
+    {
+        return -ENOENT;
+    }
+
+    auto header = reinterpret_cast<const config_snapshot_header_t *>(_data);
+    size_t name_len = strlen(root->name());
+    size_t offset = sizeof(config_snapshot_header_t);
+
+    for(uint16_t i=0; i < header->modules; i++)
+    {
+        size_t record_len = _data[offset];
+        const uint8_t *record = &_data[offset];
+        offset += 1 + record_len + sizeof(murmur3_hash_t::h);
+
+        if(record_len == name_len && !memcmp(record + 1, root->name(), name_len))
+        {
+            _entries = _cursor = offset;
+            int error = apply_node(root, CONFIG_PATH_ROOT);
+            if(!error)
+            {
+                memcpy(sync_hash.h, record + 1 + record_len, sizeof(sync_hash.h));
+            }
+            return error;
+        }
+
+        offset = skip_entries(offset);
+    }
+
+    return -ENOENT;
+}
+
+// returns the value of the entry for the path, null if the module has no
+// such entry
+const uint8_t *ConfigSnapshot::find_entry(uint32_t path, config_node_type_t type, uint8_t &size)
+{
+    size_t offset = _cursor;
+
+    // try the next entry in walk order before searching the whole module
+    for(int pass=0; pass < 2; pass++)
+    {
+        while(_data[offset] != CONFIG_NODE_TYPE_UNKNOWN)
+        {
+            uint32_t entry_path;
+            memcpy(&entry_path, &_data[offset + 1], sizeof(entry_path));
+            size = _data[offset + 5];
+
+            if(entry_path == path && _data[offset] == type)
+            {
+                _cursor = offset + 6 + size;
+                return &_data[offset + 6];
+            }
+
+            offset += 6 + size;
+            if(!pass)
+            {
+                break;
+            }
+        }
+        offset = _entries;
+    }
+
+    return nullptr;
+}
+
+// a node without an entry is left alone just like a member missing from a
+// json config
+int ConfigSnapshot::apply_node(ConfigNode *node, uint32_t path)
+{
+    uint8_t size = 0;
+    const uint8_t *value = nullptr;
+    int error = 0;
+
+    switch(node->type())
+    {
+        case CONFIG_NODE_TYPE_INT:
+        {
+            int32_t _value;
+            value = find_entry(path, node->type(), size);
+            if(value && size == sizeof(_value))
+            {
+                memcpy(&_value, value, sizeof(_value));
+                error = reinterpret_cast<ConfigInt *>(node)->set(_value);
+            }
+            break;
+        }
+        case CONFIG_NODE_TYPE_BOOL:
+            value = find_entry(path, node->type(), size);
+            if(value && size == 1)
+            {
+                error = reinterpret_cast<ConfigBool *>(node)->set(*value != 0);
+            }
+            break;
+        case CONFIG_NODE_TYPE_FLOAT:
+        {
+            double _value;
+            value = find_entry(path, node->type(), size);
+            if(value && size == sizeof(_value))
+            {
+                memcpy(&_value, value, sizeof(_value));
+                error = reinterpret_cast<ConfigFloat *>(node)->set(_value);
+            }
+            break;
+        }
+        case CONFIG_NODE_TYPE_STRING:
+        case CONFIG_NODE_TYPE_STRING_ENUM:
+            value = find_entry(path, node->type(), size);
+            if(value)
+            {
+                memcpy(_str, value, size);
+                _str[size] = '\0';
+                if(node->type() == CONFIG_NODE_TYPE_STRING)
+                {
+                    error = reinterpret_cast<ConfigString *>(node)->set((const char *) _str);
+                }
+                else
+                {
+                    error = reinterpret_cast<ConfigStringEnum *>(node)->set((const char *) _str);
+                }
+            }
+            break;
+        case CONFIG_NODE_TYPE_ARRAY:
+        {
+            auto array_node = reinterpret_cast<ConfigArray *>(node);
+            int32_t count = 0;
+
+            value = find_entry(path, node->type(), size);
+            if(!value || size != sizeof(count))
+            {
+                break;
+            }
+            memcpy(&count, value, sizeof(count));
+
+            error = array_node->enter(true);
+            if(!error)
+            {
+                error = array_node->resize(count);
+            }
+            for(int32_t i=0; !error && i < count; i++)
+            {
+                error = array_node->select(true, i);
+                if(!error)
+                {
+                    error = apply_node(array_node->element(), config_path_element(path, i));
+                }
+            }
+            error = array_node->exit(true, error);
+            break;
+        }
+        case CONFIG_NODE_TYPE_UNKNOWN:
+            break;
+        case CONFIG_NODE_TYPE_OBJECT:
+        {
+            auto object_node = reinterpret_cast<ConfigObject *>(node);
+
+            error = object_node->enter(true);
+            for(int i=0; !error && i < object_node->child_count(); i++)
+            {
+                auto child = object_node->child(i);
+                if(child->name())
+                {
+                    error = apply_node(child, config_path_child(path, child->name()));
+                }
+            }
+            error = object_node->exit(true, error);
+            break;
+        }
+    }
+
+    return error;
+}
+
+#endif // HAL_PLATFORM_FILESYSTEM
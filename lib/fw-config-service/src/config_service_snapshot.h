@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "Particle.h"
+
+#include "config_service_nodes.h"
+#include "config_service_stream.h"
+
+#include "murmur3.h"
+
+#define CONFIG_SERVICE_SNAPSHOT_MAGIC (0x50414e53) // "SNAP"
+#define CONFIG_SERVICE_SNAPSHOT_VERSION (1)
+
+// the snapshot file format is a header followed by a record per module
+//
+// module record
+//   uint8_t name length, name, uint32_t sync hash[4], entries, uint8_t 0
+// entry
+//   uint8_t node type, uint32_t path hash, uint8_t value length, value
+//
+// leaves are keyed by a hash of their path from the module root, with array
+// elements keyed by index and an array entry holding the element count
+typedef struct __attribute__((packed)) config_snapshot_header_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t modules;
+    // bytes of module records following the header
+    uint32_t size;
+    // murmur3 of the module records
+    uint32_t checksum[4];
+} config_snapshot_header_t;
+
+// writes a snapshot of config modules to an open file
+class ConfigSnapshotWriter
+{
+    public:
+        ConfigSnapshotWriter(int fd);
+
+        int add(ConfigNode *root, const murmur3_hash_t &sync_hash);
+
+        // write out the header once all modules have been added
+        int finish();
+    private:
+        void put(const void *data, size_t size);
+        int put_entry(config_node_type_t type, uint32_t path, const void *value, size_t size);
+        int add_node(ConfigNode *node, uint32_t path);
+
+        int _fd;
+        ConfigFileWriter _file;
+        murmur3_hash_t _checksum;
+        uint16_t _modules;
+};
+
+// snapshot read in one shot and verified the first time it is needed, values
+// are then applied to modules by name as they are registered
+class ConfigSnapshot
+{
+    public:
+        ConfigSnapshot() : _data(nullptr), _size(0), _loaded(false), _entries(0), _cursor(0) {}
+        ~ConfigSnapshot() {release();}
+
+        // read the snapshot file, only the first call has any effect
+        int load(const char *filename);
+
+        // apply the module's values from the snapshot, -ENOENT if the module is
+        // not in the snapshot
+        int apply(ConfigNode *root, murmur3_hash_t &sync_hash);
+
+        // drop the snapshot from memory, it can't be loaded again
+        void release();
+    private:
+        int verify();
+        size_t skip_entries(size_t offset);
+        const uint8_t *find_entry(uint32_t path, config_node_type_t type, uint8_t &size);
+        int apply_node(ConfigNode *node, uint32_t path);
+
+        uint8_t *_data;
+        size_t _size;
+        bool _loaded;
+        // offset of the first entry of the module being applied
+        size_t _entries;
+        // offset of the entry expected next, entries are written in the order
+        // the tree is walked so lookups usually hit here first
+        size_t _cursor;
+        // string values are terminated here before being set
+        char _str[UINT8_MAX + 1];
+};
@@ -0,0 +1,619 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Particle.h"
+
+#if HAL_PLATFORM_FILESYSTEM
+
+#include <fcntl.h>
+
+#include <algorithm>
+
+#include "config_service_stream.h"
+
+size_t ConfigFileWriter::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+size_t ConfigFileWriter::write(const uint8_t *buffer, size_t size)
+{
+    size_t remaining = size;
+
+    while(!_error && remaining)
+    {
+        size_t len = std::min(remaining, sizeof(_buf) - _used);
+        memcpy(_buf + _used, buffer, len);
+        _used += len;
+        buffer += len;
+        remaining -= len;
+
+        if(_used == sizeof(_buf))
+        {
+            sync();
+        }
+    }
+
+    if(_error)
+    {
+        setWriteError(_error);
+        return 0;
+    }
+
+    _size += size;
+    return size;
+}
+
+int ConfigFileWriter::sync()
+{
+    if(!_error && _used)
+    {
+        int written = ::write(_fd, _buf, _used);
+        if(written < 0)
+        {
+            _error = -errno;
+        }
+        else if(written != (int) _used)
+        {
+            _error = -EIO;
+        }
+        _used = 0;
+    }
+
+    return _error;
+}
+
+int ConfigFileReader::rewind()
+{
+    _pos = _len = 0;
+
+    if(lseek(_fd, 0, SEEK_SET) < 0)
+    {
+        return -errno;
+    }
+
+    return 0;
+}
+
+// returns the next character without consuming it, -ENODATA at the end of
+// the file, or a negative error
+int ConfigFileReader::peek()
+{
+    if(_pos == _len)
+    {
+        int rval = read(_fd, _buf, sizeof(_buf));
+        if(rval < 0)
+        {
+            return -errno;
+        }
+        if(rval == 0)
+        {
+            return -ENODATA;
+        }
+        _pos = 0;
+        _len = rval;
+    }
+
+    return (uint8_t) _buf[_pos];
+}
+
+int ConfigFileReader::next()
+{
+    int c = peek();
+    if(c >= 0)
+    {
+        _pos++;
+    }
+    return c;
+}
+
+int ConfigFileReader::skip_space()
+{
+    int c = peek();
+    while(c == ' ' || c == '\t' || c == '\r' || c == '\n')
+    {
+        _pos++;
+        c = peek();
+    }
+    return c;
+}
+
+int ConfigFileReader::expect(char c)
+{
+    int rval = skip_space();
+    if(rval < 0)
+    {
+        return rval;
+    }
+    if(rval != c)
+    {
+        return -EINVAL;
+    }
+    _pos++;
+    return 0;
+}
+
+// reads a quoted string into the token buffer, unescaping as it goes
+int ConfigFileReader::parse_string()
+{
+    size_t len = 0;
+
+    int c = expect('"');
+    if(c < 0)
+    {
+        return c;
+    }
+
+    while(true)
+    {
+        char out[3];
+        size_t out_len = 1;
+
+        c = next();
+        if(c < 0)
+        {
+            return c;
+        }
+        if(c == '"')
+        {
+            break;
+        }
+        if(c < 0x20)
+        {
+            return -EINVAL;
+        }
+        out[0] = c;
+
+        if(c == '\\')
+        {
+            c = next();
+            switch(c)
+            {
+                case '"': case '\\': case '/': out[0] = c; break;
+                case 'b': out[0] = '\b'; break;
+                case 'f': out[0] = '\f'; break;
+                case 'n': out[0] = '\n'; break;
+                case 'r': out[0] = '\r'; break;
+                case 't': out[0] = '\t'; break;
+                case 'u':
+                {
+                    uint32_t code = 0;
+                    for(int i=0; i < 4; i++)
+                    {
+                        c = next();
+                        if(c < 0)
+                        {
+                            return c;
+                        }
+                        if(!isxdigit(c))
+                        {
+                            return -EINVAL;
+                        }
+                        code = (code << 4) | (isdigit(c) ? (c - '0') : ((c | 0x20) - 'a' + 10));
+                    }
+                    // encode the code point as utf-8
+                    if(code < 0x80)
+                    {
+                        out[0] = code;
+                    }
+                    else if(code < 0x800)
+                    {
+                        out[0] = 0xc0 | (code >> 6);
+                        out[1] = 0x80 | (code & 0x3f);
+                        out_len = 2;
+                    }
+                    else
+                    {
+                        out[0] = 0xe0 | (code >> 12);
+                        out[1] = 0x80 | ((code >> 6) & 0x3f);
+                        out[2] = 0x80 | (code & 0x3f);
+                        out_len = 3;
+                    }
+                    break;
+                }
+                default:
+                    return (c < 0) ? c : -EINVAL;
+            }
+        }
+
+        // always leave room for the terminator
+        if(len + out_len >= sizeof(_token))
+        {
+            return -ENOSPC;
+        }
+        memcpy(_token + len, out, out_len);
+        len += out_len;
+    }
+
+    _token[len] = '\0';
+    return 0;
+}
+
+// reads a number, true, false, or null into the token buffer
+int ConfigFileReader::parse_literal()
+{
+    size_t len = 0;
+
+    int c = skip_space();
+    while(c >= 0 && (isalnum(c) || c == '-' || c == '+' || c == '.'))
+    {
+        if(len + 1 >= sizeof(_token))
+        {
+            return -ENOSPC;
+        }
+        _token[len++] = c;
+        _pos++;
+        c = peek();
+    }
+
+    if(c < 0 && c != -ENODATA)
+    {
+        return c;
+    }
+
+    _token[len] = '\0';
+    return len ? 0 : -EINVAL;
+}
+
+int ConfigFileReader::begin_object()
+{
+    return expect('{');
+}
+
+int ConfigFileReader::next_member(int index, const char * &name)
+{
+    int c = skip_space();
+    if(c < 0)
+    {
+        return c;
+    }
+
+    if(c == '}')
+    {
+        _pos++;
+        return 0;
+    }
+
+    // members after the first are separated by a comma
+    if(index)
+    {
+        if(c != ',')
+        {
+            return -EINVAL;
+        }
+        _pos++;
+    }
+
+    int error = parse_string();
+    if(!error)
+    {
+        error = expect(':');
+    }
+    if(error)
+    {
+        return error;
+    }
+
+    name = _token;
+    return 1;
+}
+
+int ConfigFileReader::read_string(const char * &value)
+{
+    int error = parse_string();
+    if(!error)
+    {
+        value = _token;
+    }
+    return error;
+}
+
+int ConfigFileReader::read_int(int32_t &value)
+{
+    int error = parse_literal();
+    if(error)
+    {
+        return error;
+    }
+
+    char *end = nullptr;
+    long rval = strtol(_token, &end, 10);
+    if(!end || *end || end == _token)
+    {
+        return -EINVAL;
+    }
+
+    value = (int32_t) rval;
+    return 0;
+}
+
+int ConfigFileReader::end()
+{
+    int c = skip_space();
+    return (c == -ENODATA) ? 0 : ((c < 0) ? c : -EINVAL);
+}
+
+int ConfigFileReader::apply(ConfigNode *node)
+{
+    int c = skip_space();
+    if(c < 0)
+    {
+        return c;
+    }
+
+    switch(c)
+    {
+        case '{':
+            if(!node)
+            {
+                return apply_object(nullptr);
+            }
+            if(node->type() == CONFIG_NODE_TYPE_OBJECT)
+            {
+                return apply_object(reinterpret_cast<ConfigObject *>(node));
+            }
+            if(node->type() == CONFIG_NODE_TYPE_ARRAY)
+            {
+                return apply_array_members(reinterpret_cast<ConfigArray *>(node));
+            }
+            return -EINVAL;
+        case '[':
+            if(!node || node->type() == CONFIG_NODE_TYPE_ARRAY)
+            {
+                return apply_array(reinterpret_cast<ConfigArray *>(node));
+            }
+            return -EINVAL;
+        case '"':
+        {
+            int error = parse_string();
+            if(error || !node)
+            {
+                return error;
+            }
+            if(node->type() == CONFIG_NODE_TYPE_STRING)
+            {
+                return reinterpret_cast<ConfigString *>(node)->set((const char *) _token);
+            }
+            if(node->type() == CONFIG_NODE_TYPE_STRING_ENUM)
+            {
+                return reinterpret_cast<ConfigStringEnum *>(node)->set((const char *) _token);
+            }
+            return -EINVAL;
+        }
+        default:
+            return apply_literal(node);
+    }
+}
+
+int ConfigFileReader::apply_literal(ConfigNode *node)
+{
+    int error = parse_literal();
+    if(error)
+    {
+        return error;
+    }
+
+    if(!strcmp(_token, "true") || !strcmp(_token, "false"))
+    {
+        if(!node)
+        {
+            return 0;
+        }
+        if(node->type() == CONFIG_NODE_TYPE_BOOL)
+        {
+            return reinterpret_cast<ConfigBool *>(node)->set(_token[0] == 't');
+        }
+        return -EINVAL;
+    }
+
+    if(!strcmp(_token, "null"))
+    {
+        // null never applies to a config node
+        return node ? -EINVAL : 0;
+    }
+
+    if(_token[0] != '-' && !isdigit((uint8_t) _token[0]))
+    {
+        return -EINVAL;
+    }
+
+    char *end = nullptr;
+    double value = strtod(_token, &end);
+    if(!end || *end)
+    {
+        return -EINVAL;
+    }
+
+    if(!node)
+    {
+        return 0;
+    }
+    if(node->type() == CONFIG_NODE_TYPE_INT)
+    {
+        long int_value = strtol(_token, &end, 10);
+        return reinterpret_cast<ConfigInt *>(node)->set(*end ? (int32_t) value : (int32_t) int_value);
+    }
+    if(node->type() == CONFIG_NODE_TYPE_FLOAT)
+    {
+        return reinterpret_cast<ConfigFloat *>(node)->set(value);
+    }
+    return -EINVAL;
+}
+
+// object members are applied to the matching child with unknown members
+// skipped, a null node skips the whole object
+int ConfigFileReader::apply_object(ConfigObject *node)
+{
+    const char *name;
+    int error = begin_object();
+    if(error)
+    {
+        return error;
+    }
+
+    if(node)
+    {
+        error = node->enter(true);
+    }
+
+    for(int index=0; !error; index++)
+    {
+        int rval = next_member(index, name);
+        if(rval <= 0)
+        {
+            error = rval;
+            break;
+        }
+        // missing node is non-fatal, skip the value if child lookup fails
+        error = apply(node ? node->child(name) : nullptr);
+    }
+
+    if(node)
+    {
+        error = node->exit(true, error);
+    }
+
+    return error;
+}
+
+// a json array replaces the entire contents of a config array, the array is
+// grown as elements arrive and trimmed to the element count at the end
+int ConfigFileReader::apply_array(ConfigArray *node)
+{
+    int32_t index = 0;
+    int32_t count = 0;
+    int error = expect('[');
+    if(error)
+    {
+        return error;
+    }
+
+    if(node)
+    {
+        error = node->enter(true);
+        if(!error)
+        {
+            error = node->count(true, count);
+        }
+    }
+
+    while(!error)
+    {
+        int c = skip_space();
+        if(c < 0)
+        {
+            error = c;
+            break;
+        }
+        if(c == ']')
+        {
+            _pos++;
+            break;
+        }
+        if(index)
+        {
+            if(c != ',')
+            {
+                error = -EINVAL;
+                break;
+            }
+            _pos++;
+        }
+
+        if(node)
+        {
+            if(index >= count)
+            {
+                count = index + 1;
+                error = node->resize(count);
+            }
+            if(!error)
+            {
+                error = node->select(true, index);
+            }
+        }
+        if(!error)
+        {
+            error = apply(node ? node->element() : nullptr);
+        }
+        index++;
+    }
+
+    if(node)
+    {
+        if(!error && index != count)
+        {
+            error = node->resize(index);
+        }
+        error = node->exit(true, error);
+    }
+
+    return error;
+}
+
+// a json object with numeric keys patches individual elements of a config
+// array and grows the array as needed
+int ConfigFileReader::apply_array_members(ConfigArray *node)
+{
+    const char *name;
+    int error = begin_object();
+    if(!error)
+    {
+        error = node->enter(true);
+    }
+    if(error)
+    {
+        return error;
+    }
+
+    for(int member=0; !error; member++)
+    {
+        int rval = next_member(member, name);
+        if(rval <= 0)
+        {
+            error = rval;
+            break;
+        }
+
+        char *end = nullptr;
+        long index = strtol(name, &end, 10);
+        int32_t count = 0;
+
+        if(!end || *end || end == name || index < 0 || index >= INT32_MAX)
+        {
+            error = -EINVAL;
+            break;
+        }
+
+        error = node->count(true, count);
+        if(!error && index >= count)
+        {
+            error = node->resize((int32_t) index + 1);
+        }
+        if(!error)
+        {
+            error = node->select(true, (int32_t) index);
+        }
+        if(!error)
+        {
+            error = apply(node->element());
+        }
+    }
+
+    return node->exit(true, error);
+}
+
+#endif // HAL_PLATFORM_FILESYSTEM
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "Particle.h"
+
+#include "config_service_nodes.h"
+
+// bytes of output held before being written through to the file
+#ifndef CONFIG_SERVICE_STREAM_BUFFER_SIZE
+#define CONFIG_SERVICE_STREAM_BUFFER_SIZE (128)
+#endif
+
+// longest name, string, or number accepted when reading a config file
+#ifndef CONFIG_SERVICE_STREAM_TOKEN_SIZE
+#define CONFIG_SERVICE_STREAM_TOKEN_SIZE (128)
+#endif
+
+// buffered Print over an open file so a JSONStreamWriter can write configs of
+// any size without rendering the whole document in memory first
+class ConfigFileWriter : public Print
+{
+    public:
+        ConfigFileWriter(int fd) : _fd(fd), _used(0), _size(0), _error(0) {}
+
+        size_t write(uint8_t c) override;
+        size_t write(const uint8_t *buffer, size_t size) override;
+
+        // write out anything still buffered, returns the first error seen
+        int sync();
+
+        size_t size() {return _size;}
+    private:
+        int _fd;
+        uint8_t _buf[CONFIG_SERVICE_STREAM_BUFFER_SIZE];
+        size_t _used;
+        size_t _size;
+        int _error;
+};
+
+// incremental JSON parser over an open file that applies values to config
+// nodes as they are read, only ever holding a single token in memory
+// follows the same rules as applying a set_cfg JSON object to a config tree
+class ConfigFileReader
+{
+    public:
+        ConfigFileReader(int fd) : _fd(fd), _pos(0), _len(0) {}
+
+        // start again from the beginning of the file
+        int rewind();
+
+        // consume the opening brace of an object
+        int begin_object();
+
+        // returns 1 with the name of the member at index when there is
+        // another member, 0 at the end of the object, or a negative error
+        int next_member(int index, const char * &name);
+
+        int read_string(const char * &value);
+        int read_int(int32_t &value);
+
+        // parse the next value and apply it to the node, a null node parses
+        // and discards the value
+        int apply(ConfigNode *node);
+
+        // check that nothing but whitespace follows
+        int end();
+
+        const char *token() {return _token;}
+    private:
+        int peek();
+        int next();
+        int skip_space();
+        int expect(char c);
+
+        int parse_string();
+        int parse_literal();
+
+        int apply_object(ConfigObject *node);
+        int apply_array(ConfigArray *node);
+        int apply_array_members(ConfigArray *node);
+        int apply_literal(ConfigNode *node);
+
+        int _fd;
+        char _buf[CONFIG_SERVICE_STREAM_BUFFER_SIZE];
+        size_t _pos;
+        size_t _len;
+        char _token[CONFIG_SERVICE_STREAM_TOKEN_SIZE];
+};
@@ -0,0 +1,452 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Particle.h"
+
+#if HAL_PLATFORM_FILESYSTEM
+
+#include <algorithm>
+
+#include "config_service_sync.h"
+
+static uint32_t _value_hash(config_node_type_t type, const void *data, size_t size)
+{
+    return config_path_hash(CONFIG_PATH_ROOT ^ type, data, size);
+}
+
+int ConfigSyncDelta::write(ConfigNode *root, int max_changes)
+{
+    _max_changes = max_changes;
+
+    int error = node(root, nullptr, root->name(), CONFIG_PATH_ROOT, _synced.isEmpty());
+
+    if(_leaves)
+    {
+        std::sort(_leaves->begin(), _leaves->end(),
+            [](const config_sync_leaf_t &a, const config_sync_leaf_t &b) {return a.path < b.path;});
+    }
+
+    return error ? error : _changes;
+}
+
+int ConfigSyncDelta::fit(ConfigNode *root, const Vector<config_sync_leaf_t> &synced, size_t size)
+{
+    JSONBufferWriter measure(nullptr, 0);
+    ConfigSyncDelta delta(measure, synced);
+
+    // the enclosing object is closed after the module
+    delta._measure = &measure;
+    delta._space = size - 1;
+    measure.beginObject();
+
+    int error = delta.write(root);
+
+    return error < 0 ? error : (delta._capped ? delta._max_changes : delta._changes);
+}
+
+// objects are only written once something inside them has changed so the
+// enclosing objects are opened on the way back down to the change
+void ConfigSyncDelta::open(frame_t *frame)
+{
+    if(!frame || frame->opened)
+    {
+        return;
+    }
+
+    open(frame->parent);
+    if(frame->key)
+    {
+        _writer.name(frame->key);
+    }
+    if(frame->array)
+    {
+        _writer.beginArray();
+    }
+    else
+    {
+        _writer.beginObject();
+    }
+    frame->opened = true;
+    _depth++;
+}
+
+void ConfigSyncDelta::close(frame_t *frame)
+{
+    if(!frame->opened)
+    {
+        return;
+    }
+
+    if(frame->array)
+    {
+        _writer.endArray();
+    }
+    else
+    {
+        _writer.endObject();
+    }
+    _depth--;
+}
+
+bool ConfigSyncDelta::changed(uint32_t path, uint32_t value)
+{
+    auto it = std::lower_bound(_synced.begin(), _synced.end(), path,
+        [](const config_sync_leaf_t &leaf, uint32_t path) {return leaf.path < path;});
+
+    return it == _synced.end() || it->path != path || it->value != value;
+}
+
+// whether the leaf is to be written, it is recorded as held by the cloud when
+// it is written or already matches but not when it is left for a later part
+bool ConfigSyncDelta::leaf(uint32_t path, uint32_t value, bool full)
+{
+    bool write = changed(path, value) || full;
+
+    if(write && !more())
+    {
+        return false;
+    }
+
+    if(_leaves)
+    {
+        config_sync_leaf_t leaf = {path, value};
+        _leaves->append(leaf);
+    }
+
+    return write;
+}
+
+bool ConfigSyncDelta::more()
+{
+    if(_max_changes >= 0 && _changes >= _max_changes)
+    {
+        _capped = true;
+    }
+
+    return !_capped;
+}
+
+void ConfigSyncDelta::wrote()
+{
+    _changes++;
+
+    // the last value written along with the containers still to be closed
+    // must fit, otherwise it is left for the next part
+    if(_measure && _measure->dataSize() + _depth > _space)
+    {
+        _max_changes = _changes - 1;
+        _capped = true;
+    }
+}
+
+// hash of the whole value of a node, combined into hash
+int ConfigSyncDelta::digest(ConfigNode *node, uint32_t &hash)
+{
+    int error = -EINVAL;
+
+    switch(node->type())
+    {
+        case CONFIG_NODE_TYPE_INT:
+        {
+            int32_t value = 0;
+            error = reinterpret_cast<ConfigInt *>(node)->get(value);
+            hash = config_path_hash(hash ^ node->type(), &value, sizeof(value));
+            break;
+        }
+        case CONFIG_NODE_TYPE_BOOL:
+        {
+            bool value = false;
+            error = reinterpret_cast<ConfigBool *>(node)->get(value);
+            hash = config_path_hash(hash ^ node->type(), &value, sizeof(value));
+            break;
+        }
+        case CONFIG_NODE_TYPE_FLOAT:
+        {
+            double value = 0;
+            error = reinterpret_cast<ConfigFloat *>(node)->get(value);
+            hash = config_path_hash(hash ^ node->type(), &value, sizeof(value));
+            break;
+        }
+        case CONFIG_NODE_TYPE_STRING:
+        case CONFIG_NODE_TYPE_STRING_ENUM:
+        {
+            const char *value = nullptr;
+            if(node->type() == CONFIG_NODE_TYPE_STRING)
+            {
+                error = reinterpret_cast<ConfigString *>(node)->get(value);
+            }
+            else
+            {
+                error = reinterpret_cast<ConfigStringEnum *>(node)->get(value);
+            }
+            if(!error)
+            {
+                hash = config_path_hash(hash ^ node->type(), value, strlen(value) + 1);
+            }
+            break;
+        }
+        case CONFIG_NODE_TYPE_ARRAY:
+        {
+            auto array_node = reinterpret_cast<ConfigArray *>(node);
+            int32_t count = 0;
+
+            error = array_node->enter(false);
+            if(!error)
+            {
+                error = array_node->count(false, count);
+            }
+            if(!error)
+            {
+                hash = config_path_hash(hash ^ node->type(), &count, sizeof(count));
+                for(int32_t i=0; !error && i < count; i++)
+                {
+                    error = array_node->select(false, i);
+                    if(!error)
+                    {
+                        error = digest(array_node->element(), hash);
+                    }
+                }
+            }
+            error = array_node->exit(false, error);
+            break;
+        }
+        case CONFIG_NODE_TYPE_UNKNOWN:
+            break;
+        case CONFIG_NODE_TYPE_OBJECT:
+        {
+            auto object_node = reinterpret_cast<ConfigObject *>(node);
+
+            error = object_node->enter(false);
+            for(int i=0; !error && i < object_node->child_count(); i++)
+            {
+                auto child = object_node->child(i);
+                if(child->name())
+                {
+                    hash = config_path_child(hash, child->name());
+                    error = digest(child, hash);
+                }
+            }
+            error = object_node->exit(false, error);
+            break;
+        }
+    }
+
+    return error;
+}
+
+// writes the whole value of a node, key is null for elements written into a
+// json array
+int ConfigSyncDelta::whole(ConfigNode *node, const char *key)
+{
+    int error = -EINVAL;
+
+    if(key && node->type() != CONFIG_NODE_TYPE_UNKNOWN)
+    {
+        _writer.name(key);
+    }
+
+    switch(node->type())
+    {
+        case CONFIG_NODE_TYPE_INT:
+        {
+            int32_t value = 0;
+            error = reinterpret_cast<ConfigInt *>(node)->get(value);
+            _writer.value((int) value);
+            break;
+        }
+        case CONFIG_NODE_TYPE_BOOL:
+        {
+            bool value = false;
+            error = reinterpret_cast<ConfigBool *>(node)->get(value);
+            _writer.value(value);
+            break;
+        }
+        case CONFIG_NODE_TYPE_FLOAT:
+        {
+            double value = 0;
+            error = reinterpret_cast<ConfigFloat *>(node)->get(value);
+            _writer.value(value, 10);
+            break;
+        }
+        case CONFIG_NODE_TYPE_STRING:
+        case CONFIG_NODE_TYPE_STRING_ENUM:
+        {
+            const char *value = nullptr;
+            if(node->type() == CONFIG_NODE_TYPE_STRING)
+            {
+                error = reinterpret_cast<ConfigString *>(node)->get(value);
+            }
+            else
+            {
+                error = reinterpret_cast<ConfigStringEnum *>(node)->get(value);
+            }
+            _writer.value(error ? "" : value);
+            break;
+        }
+        case CONFIG_NODE_TYPE_ARRAY:
+        {
+            auto array_node = reinterpret_cast<ConfigArray *>(node);
+            int32_t count = 0;
+
+            _writer.beginArray();
+            error = array_node->enter(false);
+            if(!error)
+            {
+                error = array_node->count(false, count);
+            }
+            for(int32_t i=0; !error && i < count; i++)
+            {
+                error = array_node->select(false, i);
+                if(!error)
+                {
+                    error = whole(array_node->element(), nullptr);
+                }
+            }
+            error = array_node->exit(false, error);
+            _writer.endArray();
+            break;
+        }
+        case CONFIG_NODE_TYPE_UNKNOWN:
+            break;
+        case CONFIG_NODE_TYPE_OBJECT:
+        {
+            auto object_node = reinterpret_cast<ConfigObject *>(node);
+
+            _writer.beginObject();
+            error = object_node->enter(false);
+            for(int i=0; !error && i < object_node->child_count(); i++)
+            {
+                auto child = object_node->child(i);
+                if(child->name())
+                {
+                    error = whole(child, child->name());
+                }
+            }
+            error = object_node->exit(false, error);
+            _writer.endObject();
+            break;
+        }
+    }
+
+    return error;
+}
+
+// a value tracked by a single hash is written whole when it has changed
+int ConfigSyncDelta::value(ConfigNode *node, frame_t *parent, const char *key, uint32_t path, bool full)
+{
+    uint32_t hash = CONFIG_PATH_ROOT;
+    int error = digest(node, hash);
+
+    if(!error && leaf(path, hash, full))
+    {
+        open(parent);
+        error = whole(node, key);
+        wrote();
+    }
+
+    return error;
+}
+
+// only the module root and its arrays are walked, every other value is
+// tracked by a single hash so that a large module takes a leaf per element
+// rather than a leaf per value
+// key is null for elements written into a json array
+int ConfigSyncDelta::node(ConfigNode *node, frame_t *parent, const char *key, uint32_t path, bool full)
+{
+    int error = -EINVAL;
+
+    switch(node->type())
+    {
+        case CONFIG_NODE_TYPE_ARRAY:
+        {
+            auto array_node = reinterpret_cast<ConfigArray *>(node);
+            int32_t count = 0;
+
+            error = array_node->enter(false);
+            if(!error)
+            {
+                error = array_node->count(false, count);
+            }
+            if(!error)
+            {
+                // a set_cfg patch can grow an array but not shrink it
+                // an array cut short by the end of a part is completed by
+                // index in the next part as its count is then recorded
+                bool all = leaf(path, _value_hash(node->type(), &count, sizeof(count)), full);
+                frame_t frame = {parent, key, all, false};
+
+                if(all)
+                {
+                    open(&frame);
+                    wrote();
+                }
+
+                for(int32_t i=0; !error && i < count; i++)
+                {
+                    char index[12];
+                    snprintf(index, sizeof(index), "%ld", (long) i);
+                    error = array_node->select(false, i);
+                    if(!error)
+                    {
+                        error = value(array_node->element(), &frame, all ? nullptr : index, config_path_element(path, i), all);
+                    }
+                }
+
+                close(&frame);
+            }
+            error = array_node->exit(false, error);
+            break;
+        }
+        case CONFIG_NODE_TYPE_UNKNOWN:
+            break;
+        case CONFIG_NODE_TYPE_OBJECT:
+        {
+            if(parent)
+            {
+                error = value(node, parent, key, path, full);
+                break;
+            }
+
+            auto object_node = reinterpret_cast<ConfigObject *>(node);
+            frame_t frame = {parent, key, false, false};
+
+            error = object_node->enter(false);
+            if(!error && full && more())
+            {
+                open(&frame);
+                wrote();
+            }
+            for(int i=0; !error && i < object_node->child_count(); i++)
+            {
+                auto child = object_node->child(i);
+                if(child->name())
+                {
+                    error = this->node(child, &frame, child->name(), config_path_child(path, child->name()), full);
+                }
+            }
+            close(&frame);
+            error = object_node->exit(false, error);
+            break;
+        }
+        default:
+            error = value(node, parent, key, path, full);
+            break;
+    }
+
+    return error;
+}
+
+#endif // HAL_PLATFORM_FILESYSTEM
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "Particle.h"
+
+#include "config_service_nodes.h"
+
+// hash of the whole value of an array element or of a member of the module
+// root, or the element count of an array, keyed by the hash of its path from
+// the module root
+typedef struct config_sync_leaf_t {
+    uint32_t path;
+    uint32_t value;
+} config_sync_leaf_t;
+
+// writes the members of a config module whose values differ from the leaves
+// last acknowledged by the cloud, in the same form as a set_cfg patch
+// arrays with a changed element count are written whole, otherwise changed
+// elements are written whole as members keyed by their index
+// objects below the module root are tracked and written whole, keeping one
+// leaf per element and per member of the root, about 8 bytes each
+// a module too large for one event is written a part at a time, each part
+// recording only the leaves it wrote so the next part picks up the rest
+class ConfigSyncDelta
+{
+    public:
+        // synced must be sorted by path, every leaf is written when it is empty
+        // the value of every leaf held by the cloud once the output is
+        // acknowledged is recorded in leaves when not null
+        ConfigSyncDelta(JSONWriter &writer,
+            const Vector<config_sync_leaf_t> &synced,
+            Vector<config_sync_leaf_t> *leaves=nullptr) :
+            _writer(writer),
+            _synced(synced),
+            _leaves(leaves),
+            _measure(nullptr),
+            _space(0),
+            _max_changes(-1),
+            _changes(0),
+            _depth(0),
+            _capped(false)
+        {
+        }
+
+        // write the module as a named member of the open object, writing at
+        // most max_changes values and whole containers when not negative
+        // returns the number written or a negative error
+        int write(ConfigNode *root, int max_changes=-1);
+
+        // false when values were left out by max_changes
+        bool complete() const {return !_capped;}
+
+        // number of values and whole containers of the module that fit in an
+        // object of size bytes, for use as max_changes
+        static int fit(ConfigNode *root, const Vector<config_sync_leaf_t> &synced, size_t size);
+    private:
+        typedef struct frame_t {
+            frame_t *parent;
+            const char *key;
+            bool array;
+            bool opened;
+        } frame_t;
+
+        void open(frame_t *frame);
+        void close(frame_t *frame);
+        bool changed(uint32_t path, uint32_t value);
+        bool leaf(uint32_t path, uint32_t value, bool full);
+        bool more();
+        void wrote();
+        int digest(ConfigNode *node, uint32_t &hash);
+        int whole(ConfigNode *node, const char *key);
+        int value(ConfigNode *node, frame_t *parent, const char *key, uint32_t path, bool full);
+        int node(ConfigNode *node, frame_t *parent, const char *key, uint32_t path, bool full);
+
+        JSONWriter &_writer;
+        const Vector<config_sync_leaf_t> &_synced;
+        Vector<config_sync_leaf_t> *_leaves;
+        // set while fitting to the space available
+        const JSONBufferWriter *_measure;
+        size_t _space;
+        int _max_changes;
+        int _changes;
+        // containers open that are still to be closed
+        int _depth;
+        bool _capped;
+};
@@ -145,6 +145,87 @@ uint8_t ModbusClient::readWriteMultipleRegisters(uint8_t id, uint16_t u16ReadAdd
   return ModbusClientTransactionRtu(id, ku8MBReadWriteMultipleRegisters, context);
 }
 
+bool ModbusClient::beginRead(uint8_t id, ModbusType type, uint16_t u16ReadAddress,
+  uint16_t u16ReadQty, ModbusClientContext& context, ModbusClientCompletion completion)
+{
+  std::lock_guard<RecursiveMutex> lock(_mutex);
+  uint8_t u8MBFunction {};
+
+  switch (type)
+  {
+    case ModbusType::Coil:
+      u8MBFunction = ku8MBReadCoils;
+      break;
+
+    case ModbusType::DiscreteInput:
+      u8MBFunction = ku8MBReadDiscreteInputs;
+      break;
+
+    case ModbusType::InputRegister:
+      u8MBFunction = ku8MBReadInputRegisters;
+      break;
+
+    case ModbusType::HoldingRegister:
+      u8MBFunction = ku8MBReadHoldingRegisters;
+      break;
+
+    default:
+      return false;
+  }
+
+  if (ModbusClientState::Idle != _state)
+  {
+    return false;
+  }
+  context.readAddress = u16ReadAddress;
+  context.readQty = u16ReadQty;
+  return beginTransaction(id, u8MBFunction, context, completion);
+}
+
+bool ModbusClient::poll()
+{
+  std::lock_guard<RecursiveMutex> lock(_mutex);
+
+  switch (_state)
+  {
+    case ModbusClientState::Idle:
+      return false;
+
+    case ModbusClientState::Waiting:
+      // ensure back-to-back operations allow the server device to be ready and
+      // that the bus has been silent for at least t3.5
+      if ((millis() - _lastModbusTransmission < _lastModbusTransmissionDelay) ||
+        ((uint32_t)micros() - _lastModbusReceive < _frameDelay))
+      {
+        return true;
+      }
+      transmit();
+      break;
+
+    case ModbusClientState::Receiving:
+      if (receive())
+      {
+        complete(_status);
+      }
+      break;
+  }
+
+  return ModbusClientState::Idle != _state;
+}
+
+void ModbusClient::cancel()
+{
+  std::lock_guard<RecursiveMutex> lock(_mutex);
+  if (ModbusClientState::Receiving == _state)
+  {
+    // a late response may still arrive so hold off the next request
+    _lastModbusTransmission = millis();
+  }
+  _state = ModbusClientState::Idle;
+  _context = nullptr;
+  _completion = nullptr;
+}
+
 ModbusType ModbusClient::legacyAddressDecode(unsigned int legacyAddress, uint16_t& address)
 {
   unsigned int code1 = legacyAddress / 100000;
@@ -196,29 +277,66 @@ Sequence:
   - evaluate/disassemble response
   - return status (success/exception)
 
+The transaction is driven to completion through poll(), calling the idle
+callback whenever poll() has nothing to do.
+
 @param id Modbus server ID (1..255)
 @param u8MBFunction Modbus function (0x01..0xFF)
 @return 0 on success; exception number on failure
 */
 uint8_t ModbusClient::ModbusClientTransactionRtu(uint8_t id, uint8_t u8MBFunction, ModbusClientContext& context)
 {
+  // finish any asynchronous transaction already using the bus
+  while (poll())
+  {
+    if (_idle)
+    {
+      _idle();
+    }
+  }
+
   // ensure back-to-back operations allow the server device to be ready
   while (millis() - _lastModbusTransmission < _lastModbusTransmissionDelay)
   {
     Particle.process();
   }
 
-  uint8_t u8ModbusADU[256] {};
-  uint8_t u8ModbusADUSize {};
+  beginTransaction(id, u8MBFunction, context, nullptr);
+  while (poll())
+  {
+    if (_idle)
+    {
+      _idle();
+    }
+  }
+
+  return _status;
+}
+
+/**
+Assemble the request ADU and queue it for transmission by poll().
+
+@param id Modbus server ID (1..255)
+@param u8MBFunction Modbus function (0x01..0xFF)
+@param context Buffers for the transaction
+@param completion Called with the transaction status once the transaction finishes
+@return true if the transaction was started; false if another is in progress
+*/
+bool ModbusClient::beginTransaction(uint8_t id, uint8_t u8MBFunction, ModbusClientContext& context, ModbusClientCompletion completion)
+{
+  if (ModbusClientState::Idle != _state)
+  {
+    return false;
+  }
+
   uint8_t i, u8Qty;
   uint16_t u16CRC;
-  system_tick_t u32StartTime {};
-  uint8_t u8BytesLeft = 8;
-  uint8_t u8MBStatus = ku8MBSuccess;
+
+  _aduSize = 0;
 
   // assemble Modbus Request Application Data Unit
-  u8ModbusADU[u8ModbusADUSize++] = id;
-  u8ModbusADU[u8ModbusADUSize++] = u8MBFunction;
+  _adu[_aduSize++] = id;
+  _adu[_aduSize++] = u8MBFunction;
 
   switch(u8MBFunction)
   {
@@ -227,10 +345,10 @@ uint8_t ModbusClient::ModbusClientTransactionRtu(uint8_t id, uint8_t u8MBFunctio
     case ku8MBReadInputRegisters:
     case ku8MBReadHoldingRegisters:
     case ku8MBReadWriteMultipleRegisters:
-      u8ModbusADU[u8ModbusADUSize++] = highByte(context.readAddress);
-      u8ModbusADU[u8ModbusADUSize++] = lowByte(context.readAddress);
-      u8ModbusADU[u8ModbusADUSize++] = highByte(context.readQty);
-      u8ModbusADU[u8ModbusADUSize++] = lowByte(context.readQty);
+      _adu[_aduSize++] = highByte(context.readAddress);
+      _adu[_aduSize++] = lowByte(context.readAddress);
+      _adu[_aduSize++] = highByte(context.readQty);
+      _adu[_aduSize++] = lowByte(context.readQty);
       break;
   }
 
@@ -242,38 +360,38 @@ uint8_t ModbusClient::ModbusClientTransactionRtu(uint8_t id, uint8_t u8MBFunctio
     case ku8MBWriteSingleRegister:
     case ku8MBWriteMultipleRegisters:
     case ku8MBReadWriteMultipleRegisters:
-      u8ModbusADU[u8ModbusADUSize++] = highByte(context.readQty);
-      u8ModbusADU[u8ModbusADUSize++] = lowByte(context.readQty);
+      _adu[_aduSize++] = highByte(context.readQty);
+      _adu[_aduSize++] = lowByte(context.readQty);
       break;
   }
 
   switch(u8MBFunction)
   {
     case ku8MBWriteSingleCoil:
-      u8ModbusADU[u8ModbusADUSize++] = highByte(context.writeQty);
-      u8ModbusADU[u8ModbusADUSize++] = lowByte(context.writeQty);
+      _adu[_aduSize++] = highByte(context.writeQty);
+      _adu[_aduSize++] = lowByte(context.writeQty);
       break;
 
     case ku8MBWriteSingleRegister:
-      u8ModbusADU[u8ModbusADUSize++] = highByte(context.writeBuffer[0]);
-      u8ModbusADU[u8ModbusADUSize++] = lowByte(context.writeBuffer[0]);
+      _adu[_aduSize++] = highByte(context.writeBuffer[0]);
+      _adu[_aduSize++] = lowByte(context.writeBuffer[0]);
       break;
 
     case ku8MBWriteMultipleCoils:
-      u8ModbusADU[u8ModbusADUSize++] = highByte(context.writeQty);
-      u8ModbusADU[u8ModbusADUSize++] = lowByte(context.writeQty);
+      _adu[_aduSize++] = highByte(context.writeQty);
+      _adu[_aduSize++] = lowByte(context.writeQty);
       u8Qty = (context.writeQty % 8) ? ((context.writeQty >> 3) + 1) : (context.writeQty >> 3);
-      u8ModbusADU[u8ModbusADUSize++] = u8Qty;
+      _adu[_aduSize++] = u8Qty;
       for (i = 0; i < u8Qty; i++)
       {
         switch(i % 2)
         {
           case 0: // i is even
-            u8ModbusADU[u8ModbusADUSize++] = lowByte(context.writeBuffer[i >> 1]);
+            _adu[_aduSize++] = lowByte(context.writeBuffer[i >> 1]);
             break;
 
           case 1: // i is odd
-            u8ModbusADU[u8ModbusADUSize++] = highByte(context.writeBuffer[i >> 1]);
+            _adu[_aduSize++] = highByte(context.writeBuffer[i >> 1]);
             break;
         }
       }
@@ -281,36 +399,54 @@ uint8_t ModbusClient::ModbusClientTransactionRtu(uint8_t id, uint8_t u8MBFunctio
 
     case ku8MBWriteMultipleRegisters:
     case ku8MBReadWriteMultipleRegisters:
-      u8ModbusADU[u8ModbusADUSize++] = highByte(context.writeQty);
-      u8ModbusADU[u8ModbusADUSize++] = lowByte(context.writeQty);
-      u8ModbusADU[u8ModbusADUSize++] = lowByte(context.writeQty << 1);
+      _adu[_aduSize++] = highByte(context.writeQty);
+      _adu[_aduSize++] = lowByte(context.writeQty);
+      _adu[_aduSize++] = lowByte(context.writeQty << 1);
 
       for (i = 0; i < lowByte(context.writeQty); i++)
       {
-        u8ModbusADU[u8ModbusADUSize++] = highByte(context.writeBuffer[i]);
-        u8ModbusADU[u8ModbusADUSize++] = lowByte(context.writeBuffer[i]);
+        _adu[_aduSize++] = highByte(context.writeBuffer[i]);
+        _adu[_aduSize++] = lowByte(context.writeBuffer[i]);
       }
       break;
 
     case ku8MBMaskWriteRegister:
-      u8ModbusADU[u8ModbusADUSize++] = highByte(context.writeBuffer[0]);
-      u8ModbusADU[u8ModbusADUSize++] = lowByte(context.writeBuffer[0]);
-      u8ModbusADU[u8ModbusADUSize++] = highByte(context.writeBuffer[1]);
-      u8ModbusADU[u8ModbusADUSize++] = lowByte(context.writeBuffer[1]);
+      _adu[_aduSize++] = highByte(context.writeBuffer[0]);
+      _adu[_aduSize++] = lowByte(context.writeBuffer[0]);
+      _adu[_aduSize++] = highByte(context.writeBuffer[1]);
+      _adu[_aduSize++] = lowByte(context.writeBuffer[1]);
       break;
   }
 
   // append CRC
-  u16CRC = ModbusCrc16(u8ModbusADU, (size_t)u8ModbusADUSize);
-  u8ModbusADU[u8ModbusADUSize++] = lowByte(u16CRC);
-  u8ModbusADU[u8ModbusADUSize++] = highByte(u16CRC);
-  u8ModbusADU[u8ModbusADUSize] = 0;
+  u16CRC = ModbusCrc16(_adu, (size_t)_aduSize);
+  _adu[_aduSize++] = lowByte(u16CRC);
+  _adu[_aduSize++] = highByte(u16CRC);
+  _adu[_aduSize] = 0;
+
+  _id = id;
+  _function = u8MBFunction;
+  _context = &context;
+  _completion = completion;
+  _status = ku8MBSuccess;
+  _timeout = _responseTimeout;
+  _state = ModbusClientState::Waiting;
+
+  return true;
+}
 
+/**
+Transmit the assembled request and start collecting the response.
+*/
+void ModbusClient::transmit()
+{
   if (_debugTransmitData)
   {
-    _debugTransmitData(u8ModbusADU, (size_t)u8ModbusADUSize);
+    _debugTransmitData(_adu, (size_t)_aduSize);
   }
 
+  _transmitTime = (uint32_t)micros();
+
   // flush receive buffer before transmitting request
   while (_serial->read() != -1);
 
@@ -328,97 +464,125 @@ uint8_t ModbusClient::ModbusClientTransactionRtu(uint8_t id, uint8_t u8MBFunctio
     // must be called in time to properly receive a response)
     SINGLE_THREADED_BLOCK()
     {
-      _serial->write(u8ModbusADU, (size_t)u8ModbusADUSize);
+      _serial->write(_adu, (size_t)_aduSize);
       _serial->flush();    // flush transmit buffer
       _postTransmission();
     }
   }
   else
   {
-    _serial->write(u8ModbusADU, (size_t)u8ModbusADUSize);
+    _serial->write(_adu, (size_t)_aduSize);
     _serial->flush();    // flush transmit buffer
   }
-  u8ModbusADUSize = 0;
 
-  // loop until we run out of time or bytes, or an error occurs
-  u32StartTime = millis();
-  while (u8BytesLeft && !u8MBStatus)
+  _aduSize = 0;
+  _crc = ModbusCrc16Init;
+  _bytesLeft = 8;
+  _startTime = millis();
+  _lastModbusReceive = (uint32_t)micros();
+  _state = ModbusClientState::Receiving;
+}
+
+/**
+Collect available response bytes without blocking.
+
+@return true if the transaction is finished; false if more bytes are expected
+*/
+bool ModbusClient::receive()
+{
+  while (_bytesLeft && _serial->available())
   {
-    if (_serial->available())
-    {
-      u8ModbusADU[u8ModbusADUSize++] = _serial->read();
-      u8BytesLeft--;
-    }
-    else
-    {
-      if (_idle)
-      {
-        _idle();
-      }
-    }
+    auto data = (uint8_t)_serial->read();
+    _adu[_aduSize++] = data;
+    _crc = ModbusCrc16Update(_crc, data);
+    _bytesLeft--;
+    _lastModbusReceive = (uint32_t)micros();
 
     // evaluate server ID, function code once enough bytes have been read
-    if (u8ModbusADUSize == 5)
+    if (_aduSize == 5)
     {
       // verify response is for correct Modbus server
-      if (u8ModbusADU[0] != id)
+      if (_adu[0] != _id)
       {
-        u8MBStatus = ku8MBInvalidSlaveID;
-        break;
+        _status = ku8MBInvalidSlaveID;
+        return true;
       }
 
       // verify response is for correct Modbus function code (mask exception bit 7)
-      if ((u8ModbusADU[1] & 0x7F) != u8MBFunction)
+      if ((_adu[1] & 0x7F) != _function)
       {
-        u8MBStatus = ku8MBInvalidFunction;
-        break;
+        _status = ku8MBInvalidFunction;
+        return true;
       }
 
       // check whether Modbus exception occurred; return Modbus Exception Code
-      if (bitRead(u8ModbusADU[1], 7))
+      if (bitRead(_adu[1], 7))
       {
-        u8MBStatus = u8ModbusADU[2];
-        break;
+        _status = _adu[2];
+        return true;
       }
 
       // evaluate returned Modbus function code
-      switch(u8ModbusADU[1])
+      switch(_adu[1])
       {
         case ku8MBReadCoils:
         case ku8MBReadDiscreteInputs:
         case ku8MBReadInputRegisters:
         case ku8MBReadHoldingRegisters:
         case ku8MBReadWriteMultipleRegisters:
-          u8BytesLeft = u8ModbusADU[2];
+          // a byte count past the largest the protocol allows would run off
+          // the end of the response buffer
+          if (_adu[2] > ku8MaxBufferSize)
+          {
+            _status = ku8MBInvalidFunction;
+            return true;
+          }
+          _bytesLeft = _adu[2];
           break;
 
         case ku8MBWriteSingleCoil:
         case ku8MBWriteMultipleCoils:
         case ku8MBWriteSingleRegister:
         case ku8MBWriteMultipleRegisters:
-          u8BytesLeft = 3;
+          _bytesLeft = 3;
           break;
 
         case ku8MBMaskWriteRegister:
-          u8BytesLeft = 5;
+          _bytesLeft = 5;
           break;
       }
     }
-    if ((millis() - u32StartTime) > _responseTimeout)
-    {
-      u8MBStatus = ku8MBResponseTimedOut;
-    }
   }
 
-  // verify response is large enough to inspect further
-  if (!u8MBStatus && u8ModbusADUSize >= 5)
+  if (!_bytesLeft)
+  {
+    return true;
+  }
+
+  if ((millis() - _startTime) > _timeout)
   {
-    // calculate CRC
-    u16CRC = ModbusCrc16(u8ModbusADU, (size_t)u8ModbusADUSize - 2);
+    _status = ku8MBResponseTimedOut;
+    return true;
+  }
+
+  return false;
+}
 
-    // verify CRC
-    if (!u8MBStatus && (lowByte(u16CRC) != u8ModbusADU[u8ModbusADUSize - 2] ||
-      highByte(u16CRC) != u8ModbusADU[u8ModbusADUSize - 1]))
+/**
+Verify and disassemble the response, then notify the submitter.
+
+@param u8MBStatus Status of the transaction so far
+*/
+void ModbusClient::complete(uint8_t u8MBStatus)
+{
+  uint8_t i;
+  auto& context = *_context;
+
+  // verify response is large enough to inspect further
+  if (!u8MBStatus && _aduSize >= 5)
+  {
+    // the CRC was updated as each byte arrived and including the received CRC leaves zero
+    if (0 != _crc)
     {
       u8MBStatus = ku8MBInvalidCRC;
     }
@@ -428,25 +592,25 @@ uint8_t ModbusClient::ModbusClientTransactionRtu(uint8_t id, uint8_t u8MBFunctio
   if (!u8MBStatus)
   {
     // evaluate returned Modbus function code
-    switch(u8ModbusADU[1])
+    switch(_adu[1])
     {
       case ku8MBReadCoils:
       case ku8MBReadDiscreteInputs:
         // load bytes into word; response bytes are ordered L, H, L, H, ...
-        for (i = 0; i < (u8ModbusADU[2] >> 1); i++)
+        for (i = 0; i < (_adu[2] >> 1); i++)
         {
-          if (i < sizeof(context.readBuffer))
+          if (i < ku8MaxBufferSize)
           {
-            context.readBuffer[i] = bytesToWord(u8ModbusADU[2 * i + 4], u8ModbusADU[2 * i + 3]);
+            context.readBuffer[i] = bytesToWord(_adu[2 * i + 4], _adu[2 * i + 3]);
           }
         }
 
         // in the event of an odd number of bytes, load last byte into zero-padded word
-        if (u8ModbusADU[2] % 2)
+        if (_adu[2] % 2)
         {
-          if (i < sizeof(context.readBuffer))
+          if (i < ku8MaxBufferSize)
           {
-            context.readBuffer[i] = bytesToWord(0, u8ModbusADU[2 * i + 3]);
+            context.readBuffer[i] = bytesToWord(0, _adu[2 * i + 3]);
           }
         }
         break;
@@ -455,11 +619,11 @@ uint8_t ModbusClient::ModbusClientTransactionRtu(uint8_t id, uint8_t u8MBFunctio
       case ku8MBReadHoldingRegisters:
       case ku8MBReadWriteMultipleRegisters:
         // load bytes into word; response bytes are ordered H, L, H, L, ...
-        for (i = 0; i < (u8ModbusADU[2] >> 1); i++)
+        for (i = 0; i < (_adu[2] >> 1); i++)
         {
-          if (i < sizeof(context.readBuffer))
+          if (i < ku8MaxBufferSize)
           {
-            context.readBuffer[i] = bytesToWord(u8ModbusADU[2 * i + 3], u8ModbusADU[2 * i + 4]);
+            context.readBuffer[i] = bytesToWord(_adu[2 * i + 3], _adu[2 * i + 4]);
           }
         }
         break;
@@ -467,9 +631,20 @@ uint8_t ModbusClient::ModbusClientTransactionRtu(uint8_t id, uint8_t u8MBFunctio
   }
   if (_debugReceiveData)
   {
-    _debugReceiveData(u8ModbusADU, (size_t)u8ModbusADUSize);
+    _debugReceiveData(_adu, (size_t)_aduSize);
   }
 
   _lastModbusTransmission = millis();
-  return u8MBStatus;
+  _transactionTime = (uint32_t)micros() - _transmitTime;
+  _status = u8MBStatus;
+  _state = ModbusClientState::Idle;
+  _context = nullptr;
+
+  // the completion may start the next transaction
+  auto completion = std::move(_completion);
+  _completion = nullptr;
+  if (completion)
+  {
+    completion(u8MBStatus);
+  }
 }
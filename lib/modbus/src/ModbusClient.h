@@ -48,11 +48,14 @@ namespace particle {
 /* _____UTILITY MACROS_______________________________________________________ */
 using ModbusClientCallback = std::function<void(void)>;
 using ModbusClientDebug = std::function<void(uint8_t*, size_t)>;
+using ModbusClientCompletion = std::function<void(uint8_t)>;
 
 
 /* _____CONSTANTS and STRUCTS________________________________________________ */
 
 constexpr size_t ku8MaxBufferSize                 {250};  ///< size of response/transmit buffers
+constexpr size_t ku16MaxAduSize                   {256};  ///< size of a serial line application data unit
+constexpr uint32_t ku32FrameDelayFixed            {1750}; ///< t3.5, in microseconds, for baud rates above 19200
 
 enum class ModbusType
 {
@@ -79,6 +82,17 @@ enum class ModbusFloatEndianess
   DCBA,                                       ///< All bytes and words are in little endian order
 };
 
+/**
+ * @brief States of a transaction driven by ModbusClient::poll().
+ *
+ */
+enum class ModbusClientState
+{
+  Idle,                                       ///< No transaction in progress
+  Waiting,                                    ///< Request is waiting for the bus to be quiet
+  Receiving,                                  ///< Request was sent and the response is being collected
+};
+
 struct ModbusClientContext {
   uint16_t writeBuffer[ku8MaxBufferSize];     ///< buffer containing data to transmit to Modbus server; set via SetTransmitBuffer()
   uint16_t writeAddress;                      ///< server register to which to write
@@ -124,6 +138,30 @@ class ModbusClient
     void begin(Stream& serial, system_tick_t responseTimeout = 2000, system_tick_t interMessageDelay = 0);
 
 
+    /**
+     * @brief Get the response timeout
+     *
+     * @return system_tick_t Milliseconds to wait for a response.
+     */
+    system_tick_t getResponseTimeout()
+    {
+      std::lock_guard<RecursiveMutex> lock(_mutex);
+      return _responseTimeout;
+    }
+
+
+    /**
+     * @brief Set the response timeout for subsequent transactions
+     *
+     * @param responseTimeout Milliseconds to wait for a response.
+     */
+    void setResponseTimeout(system_tick_t responseTimeout)
+    {
+      std::lock_guard<RecursiveMutex> lock(_mutex);
+      _responseTimeout = responseTimeout;
+    }
+
+
     /**
      * @brief Get the inter message delay value
      *
@@ -148,6 +186,34 @@ class ModbusClient
     }
 
 
+    /**
+     * @brief Set the baud rate of the serial line to derive the inter-frame delay.
+     *
+     * Frames are separated by at least 3.5 character times (t3.5).  Above 19200 baud
+     * a fixed 1750 microseconds is used as recommended by the Modbus serial line specification.
+     *
+     * @param baud Serial line baud rate
+     */
+    void setBaudRate(uint32_t baud)
+    {
+      std::lock_guard<RecursiveMutex> lock(_mutex);
+      // 11 bits per character, 3.5 characters
+      _frameDelay = ((0 == baud) || (baud > 19200)) ? ku32FrameDelayFixed : (38500000UL / baud);
+    }
+
+
+    /**
+     * @brief Get the inter-frame delay (t3.5).
+     *
+     * @return uint32_t Microseconds of silence required between frames.
+     */
+    uint32_t getFrameDelay()
+    {
+      std::lock_guard<RecursiveMutex> lock(_mutex);
+      return _frameDelay;
+    }
+
+
     /**
     * @brief Set idle time callback function (cooperative multitasking).
     *
@@ -576,6 +642,85 @@ class ModbusClient
      */
     uint8_t  readWriteMultipleRegisters(uint8_t id, uint16_t u16ReadAddress, uint16_t u16ReadQty, uint16_t u16WriteAddress, uint16_t u16WriteQty, ModbusClientContext& context);
 
+
+    /**
+     * @brief Start a read without waiting for the response.
+     *
+     * The request is sent and the response collected by subsequent calls to poll().
+     * The context must remain valid until the completion callback is called or the
+     * transaction is cancelled.
+     *
+     * @param id Modbus server ID (1..255)
+     * @param type Type of register to read
+     * @param u16ReadAddress address of the first register (0x0000..0xFFFF)
+     * @param u16ReadQty quantity of registers to read (1..125 registers or 1..2000 coils/inputs, enforced by remote device)
+     * @param context Buffers for the transaction
+     * @param completion Called with the transaction status once the transaction finishes
+     * @return true Transaction was started
+     * @return false Another transaction is in progress or the type is unknown
+     * @ingroup register
+     */
+    bool beginRead(uint8_t id, ModbusType type, uint16_t u16ReadAddress, uint16_t u16ReadQty, ModbusClientContext& context, ModbusClientCompletion completion = nullptr);
+
+
+    /**
+     * @brief Advance the transaction in progress.
+     *
+     * Sends the request once the bus has been quiet for the inter-message delay and t3.5,
+     * collects any response bytes received, and completes the transaction on a full
+     * response, an error, or a timeout.  Never blocks waiting for the server.
+     *
+     * @return true A transaction is still in progress
+     * @return false No transaction is in progress
+     */
+    bool poll();
+
+
+    /**
+     * @brief Abandon the transaction in progress.  The completion callback is not called.
+     *
+     */
+    void cancel();
+
+
+    /**
+     * @brief Get the state of the transaction driven by poll().
+     *
+     * @return ModbusClientState Current state
+     */
+    ModbusClientState state()
+    {
+      std::lock_guard<RecursiveMutex> lock(_mutex);
+      return _state;
+    }
+
+
+    /**
+     * @brief Get the duration of the most recently completed transaction.
+     *
+     * Measured from the start of transmission to the end of the response, error, or timeout.
+     * Time spent waiting for the bus to become quiet is not included.
+     *
+     * @return uint32_t Duration [microseconds]
+     */
+    uint32_t getTransactionTime()
+    {
+      std::lock_guard<RecursiveMutex> lock(_mutex);
+      return _transactionTime;
+    }
+
+
+    /**
+     * @brief Get the status of the most recently completed transaction.
+     *
+     * @return 0 on success; exception number on failure
+     */
+    uint8_t status()
+    {
+      std::lock_guard<RecursiveMutex> lock(_mutex);
+      return _status;
+    }
+
     /**
      * @brief Swap two bytes in a 16-bit word.
      *
@@ -756,6 +901,24 @@ class ModbusClient
     Stream* _serial;                                             ///< reference to serial port object
     system_tick_t _lastModbusTransmission {};                    ///< Modbus Transmission rate limiter
     system_tick_t _lastModbusTransmissionDelay {};
+    uint32_t _lastModbusReceive {};                              ///< Time of the last bus activity [microseconds]
+    uint32_t _frameDelay {ku32FrameDelayFixed};                  ///< t3.5 [microseconds]
+
+    // Transaction in progress
+    ModbusClientState _state {ModbusClientState::Idle};
+    ModbusClientContext* _context {};
+    ModbusClientCompletion _completion {};
+    uint8_t _adu[ku16MaxAduSize] {};                             ///< Request, then response, application data unit
+    uint8_t _aduSize {};
+    uint8_t _id {};
+    uint8_t _function {};
+    uint8_t _bytesLeft {};
+    uint8_t _status {};
+    uint16_t _crc {};                                            ///< Running CRC of the response
+    system_tick_t _startTime {};
+    system_tick_t _timeout {};                                   ///< Response timeout of the transaction [milliseconds]
+    uint32_t _transmitTime {};                                   ///< Start of transmission [microseconds]
+    uint32_t _transactionTime {};                                ///< Duration of the last transaction [microseconds]
 
     // Modbus timeout [milliseconds]
     system_tick_t _responseTimeout                       {2000}; ///< Modbus timeout [milliseconds]
@@ -777,6 +940,12 @@ class ModbusClient
     // master function that conducts Modbus transactions
     uint8_t ModbusClientTransactionRtu(uint8_t id, uint8_t u8MBFunction, ModbusClientContext& context);
 
+    // steps of the transaction state machine
+    bool beginTransaction(uint8_t id, uint8_t u8MBFunction, ModbusClientContext& context, ModbusClientCompletion completion);
+    void transmit();
+    bool receive();
+    void complete(uint8_t u8MBStatus);
+
     // idle callback function; gets called during idle time between TX and RX
     ModbusClientCallback _idle {};
     // preTransmission callback function; gets called before writing a Modbus message
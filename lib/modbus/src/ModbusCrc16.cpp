@@ -20,7 +20,7 @@
 
 #include "ModbusCrc16.h"
 
-static const uint16_t CRCTable[] = {
+static constexpr uint16_t CRCTable[256] = {
   0X0000, 0XC0C1, 0XC181, 0X0140, 0XC301, 0X03C0, 0X0280, 0XC241,
   0XC601, 0X06C0, 0X0780, 0XC741, 0X0500, 0XC5C1, 0XC481, 0X0440,
   0XCC01, 0X0CC0, 0X0D80, 0XCD41, 0X0F00, 0XCFC1, 0XCE81, 0X0E40,
@@ -55,15 +55,63 @@ static const uint16_t CRCTable[] = {
   0X8201, 0X42C0, 0X4380, 0X8341, 0X4100, 0X81C1, 0X8081, 0X4040
 };
 
-uint16_t ModbusCrc16 (const uint8_t* data, size_t count)
+#if MODBUS_CRC16_SLICE_BY_4
+// Tables for the CRC of a byte followed by one, two, and three zero bytes
+struct CRCSliceTables {
+  uint16_t table[3][256];
+};
+
+static constexpr CRCSliceTables makeSliceTables()
+{
+  CRCSliceTables slices {};
+  for (unsigned int i = 0; i < 256; i++)
+  {
+    uint16_t crc = CRCTable[i];
+    for (unsigned int k = 0; k < 3; k++)
+    {
+      crc = (crc >> 8) ^ CRCTable[crc & 0xFF];
+      slices.table[k][i] = crc;
+    }
+  }
+  return slices;
+}
+
+static constexpr CRCSliceTables CRCSlices = makeSliceTables();
+#endif
+
+uint16_t ModbusCrc16Update (uint16_t crc, uint8_t data)
 {
-  uint16_t crcWord = 0xFFFF;
+  uint8_t temp = data ^ crc;
+  crc >>= 8;
+  crc ^= CRCTable[temp];
+  return crc;
+}
+
+uint16_t ModbusCrc16Update (uint16_t crc, const uint8_t* data, size_t count)
+{
+#if MODBUS_CRC16_SLICE_BY_4
+  while (count >= 4)
+  {
+    crc ^= (uint16_t)data[0] | ((uint16_t)data[1] << 8);
+    crc = CRCSlices.table[2][crc & 0xFF] ^
+          CRCSlices.table[1][crc >> 8] ^
+          CRCSlices.table[0][data[2]] ^
+          CRCTable[data[3]];
+    data += 4;
+    count -= 4;
+  }
+#endif
 
   while (count--)
   {
-    uint8_t temp = *data++ ^ crcWord;
-    crcWord >>= 8;
-    crcWord ^= CRCTable[temp];
+    uint8_t temp = *data++ ^ crc;
+    crc >>= 8;
+    crc ^= CRCTable[temp];
   }
-  return crcWord;
+  return crc;
+}
+
+uint16_t ModbusCrc16 (const uint8_t* data, size_t count)
+{
+  return ModbusCrc16Update(ModbusCrc16Init, data, count);
 }
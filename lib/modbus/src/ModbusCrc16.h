@@ -24,6 +24,35 @@
 #include <cstdint>
 #include <cstddef>
 
+// Set to 1 to update the CRC four bytes at a time.  Faster for long buffers at the cost of
+// 1.5 KB of extra lookup tables.
+#ifndef MODBUS_CRC16_SLICE_BY_4
+#define MODBUS_CRC16_SLICE_BY_4 0
+#endif
+
+constexpr uint16_t ModbusCrc16Init {0xFFFF};  ///< CRC state before any bytes are added
+
+/**
+ * @brief Add one byte to a running Modbus CRC16.
+ *
+ * A frame whose CRC was appended, low byte first, leaves a running CRC of zero.
+ *
+ * @param crc CRC state, starting at ModbusCrc16Init
+ * @param data Byte to add
+ * @return uint16_t Updated CRC state
+ */
+uint16_t ModbusCrc16Update (uint16_t crc, uint8_t data);
+
+/**
+ * @brief Add a buffer to a running Modbus CRC16.
+ *
+ * @param crc CRC state, starting at ModbusCrc16Init
+ * @param data Byte pointer to data
+ * @param count Number of bytes to include from given data
+ * @return uint16_t Updated CRC state
+ */
+uint16_t ModbusCrc16Update (uint16_t crc, const uint8_t* data, size_t count);
+
 /**
  * @brief Calculate the Modbus CRC16 with a given buffer.
  *
@@ -0,0 +1,240 @@
+/**
+@file
+Transaction counters and response time histogram for Modbus clients.
+*/
+/*
+
+  ModbusStats.h - Transaction counters and response time histogram for
+  Modbus clients.
+
+  Library:: ModbusClient
+
+  Copyright:: 2023 Particle
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+
+#pragma once
+
+/* _____PROJECT INCLUDES_____________________________________________________ */
+#include "ModbusClient.h"
+#include <algorithm>
+
+namespace particle {
+
+/* _____CLASS DEFINITIONS____________________________________________________ */
+/**
+ * @brief Response time histogram with logarithmic buckets.
+ *
+ * Times below 8 milliseconds have their own bucket and each doubling above that is split into
+ * four buckets, so percentiles are accurate to within 25%.  Counts are halved whenever a bucket
+ * fills so that recent responses carry more weight than old ones.
+ *
+ */
+class ModbusLatencyHistogram
+{
+  public:
+    static constexpr size_t BucketCount       {52};     ///< Covers 0 to 16383 milliseconds
+    static constexpr uint32_t BucketLimit     {16383};  ///< Largest time with its own bucket [milliseconds]
+
+    /**
+     * @brief Record a response time.
+     *
+     * @param time Response time [milliseconds]
+     */
+    void record(uint32_t time)
+    {
+      auto& bucket = _buckets[index(time)];
+      if (UINT16_MAX == bucket)
+      {
+        decay();
+      }
+      bucket++;
+      _count++;
+      if (time > _max)
+      {
+        _max = time;
+      }
+    }
+
+    /**
+     * @brief Find the time that the given percentage of responses fall within.
+     *
+     * @param percent Percentage of responses (0..100)
+     * @return uint32_t Upper bound of the bucket holding the percentile [milliseconds], zero if nothing was recorded
+     */
+    uint32_t percentile(unsigned int percent) const
+    {
+      if (!_count)
+      {
+        return 0;
+      }
+
+      // Round up so that the percentile always lands on a recorded response
+      uint32_t target = (uint32_t)(((uint64_t)_count * percent + 99) / 100);
+      target = (target) ? target : 1;
+      uint32_t seen = 0;
+      for (size_t i = 0; i < BucketCount; i++)
+      {
+        seen += _buckets[i];
+        if (seen >= target)
+        {
+          return std::min(upper(i), _max);
+        }
+      }
+      return _max;
+    }
+
+    /**
+     * @brief Get the longest response time recorded.
+     *
+     * @return uint32_t Response time [milliseconds]
+     */
+    uint32_t max() const
+    {
+      return _max;
+    }
+
+    /**
+     * @brief Get the weight of the responses held in the histogram.
+     *
+     * @return uint32_t Number of responses, after any decay
+     */
+    uint32_t count() const
+    {
+      return _count;
+    }
+
+    /**
+     * @brief Discard all recorded response times.
+     *
+     */
+    void reset()
+    {
+      *this = ModbusLatencyHistogram();
+    }
+
+  private:
+    static size_t index(uint32_t time)
+    {
+      if (time < 8)
+      {
+        return time;
+      }
+      if (time > BucketLimit)
+      {
+        return BucketCount - 1;
+      }
+      unsigned int msb = 31 - __builtin_clz(time);
+      return 8 + (msb - 3) * 4 + ((time >> (msb - 2)) & 3);
+    }
+
+    static uint32_t upper(size_t index)
+    {
+      if (index < 8)
+      {
+        return (uint32_t)index;
+      }
+      if (index >= (BucketCount - 1))
+      {
+        return UINT32_MAX;
+      }
+      // Next bucket's lower bound, less one
+      index++;
+      unsigned int msb = 3 + (index - 8) / 4;
+      unsigned int sub = (index - 8) % 4;
+      return ((4 + sub) << (msb - 2)) - 1;
+    }
+
+    void decay()
+    {
+      _count = 0;
+      for (auto& bucket: _buckets)
+      {
+        bucket /= 2;
+        _count += bucket;
+      }
+    }
+
+    uint16_t _buckets[BucketCount] {};
+    uint32_t _count {};
+    uint32_t _max {};
+};
+
+/**
+ * @brief Outcome counters and response times for Modbus transactions.
+ *
+ */
+struct ModbusStats
+{
+  static constexpr size_t ExceptionCodeCount {12};  ///< Exception codes 0x01 through 0x0B are counted separately
+
+  uint32_t requests {};                         ///< Transactions attempted
+  uint32_t timeouts {};                         ///< Transactions without a response
+  uint32_t crcErrors {};                        ///< Responses with a bad CRC
+  uint32_t exceptions {};                       ///< Exception responses
+  uint32_t invalid {};                          ///< Responses from the wrong server or for the wrong function
+  uint16_t exceptionCodes[ExceptionCodeCount] {}; ///< Exception responses by exception code
+  ModbusLatencyHistogram latency;               ///< Time to a valid or exception response
+
+  /**
+   * @brief Record the outcome of a transaction.
+   *
+   * @param status Transaction status returned by ModbusClient
+   * @param time Time from the start of transmission to the end of the transaction [microseconds]
+   */
+  void record(uint8_t status, uint32_t time)
+  {
+    requests++;
+    switch (status)
+    {
+      case ModbusClient::ku8MBSuccess:
+        break;
+
+      case ModbusClient::ku8MBResponseTimedOut:
+        timeouts++;
+        return;
+
+      case ModbusClient::ku8MBInvalidCRC:
+        crcErrors++;
+        return;
+
+      case ModbusClient::ku8MBInvalidSlaveID:
+      case ModbusClient::ku8MBInvalidFunction:
+        invalid++;
+        return;
+
+      default:
+        exceptions++;
+        if (status < ExceptionCodeCount)
+        {
+          exceptionCodes[status]++;
+        }
+        break;
+    }
+    latency.record((time + 500) / 1000);
+  }
+
+  /**
+   * @brief Discard all counters and response times.
+   *
+   */
+  void reset()
+  {
+    *this = ModbusStats();
+  }
+};
+
+}
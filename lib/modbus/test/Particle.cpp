@@ -0,0 +1,13 @@
+#include "Particle.h"
+
+CloudClass Particle;
+
+static uint64_t mockTime = 1000000;
+
+void mockAdvanceMicros(uint64_t delta) {
+    mockTime += delta;
+}
+
+uint64_t mockMicros() {
+    return mockTime;
+}
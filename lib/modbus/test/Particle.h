@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <mutex>
+
+typedef uint32_t system_tick_t;
+
+// Simulated clock, advanced explicitly by tests
+void mockAdvanceMicros(uint64_t delta);
+uint64_t mockMicros();
+
+inline system_tick_t millis() {
+    return (system_tick_t)(mockMicros() / 1000);
+}
+
+inline unsigned long micros() {
+    return (unsigned long)mockMicros();
+}
+
+#define SINGLE_THREADED_BLOCK()
+
+class RecursiveMutex : public std::recursive_mutex {
+};
+
+class Stream {
+public:
+    virtual ~Stream() = default;
+
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() = 0;
+    virtual size_t write(uint8_t byte) = 0;
+
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+        size_t count = 0;
+        while (size--) {
+            count += write(*buffer++);
+        }
+        return count;
+    }
+};
+
+class CloudClass {
+public:
+    void process() {
+        // Let a blocked caller make progress on the simulated clock
+        mockAdvanceMicros(100);
+    }
+};
+
+extern CloudClass Particle;
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <vector>
+
+#include "Particle.h"
+#include "ModbusCrc16.h"
+
+/**
+ * @brief Modbus RTU server that answers requests written to it as if it were on the other end of a serial line.
+ *
+ * Requests are complete once the client flushes them.  The response becomes readable after the
+ * configured response delay has passed on the simulated clock.
+ */
+class SimulatedServer : public Stream {
+public:
+    static constexpr size_t RegisterCount = 64;
+
+    explicit SimulatedServer(uint8_t id) : _id(id) {}
+
+    uint16_t registers[RegisterCount] {};   ///< Holding and input registers
+    bool coils[RegisterCount] {};           ///< Coils and discrete inputs
+    uint64_t responseDelay {0};             ///< Microseconds between the request and the response
+    bool corrupt {false};                   ///< Damage the CRC of responses
+    int byteCount {-1};                     ///< Byte count claimed and sent by register reads, -1 for the actual count
+    int requests {0};                       ///< Number of requests received
+
+    int available() override {
+        return ready() ? (int)(_rx.size() - _rxPos) : 0;
+    }
+
+    int read() override {
+        if (!available()) {
+            return -1;
+        }
+        return _rx[_rxPos++];
+    }
+
+    int peek() override {
+        if (!available()) {
+            return -1;
+        }
+        return _rx[_rxPos];
+    }
+
+    void flush() override {
+        if (!_tx.empty()) {
+            respond();
+            _tx.clear();
+        }
+    }
+
+    size_t write(uint8_t byte) override {
+        _tx.push_back(byte);
+        return 1;
+    }
+
+private:
+    bool ready() const {
+        return mockMicros() >= _readyAt;
+    }
+
+    void append(uint8_t byte) {
+        _rx.push_back(byte);
+    }
+
+    void finish() {
+        auto crc = ModbusCrc16(_rx.data(), _rx.size());
+        append(crc & 0xff);
+        append(crc >> 8);
+        if (corrupt) {
+            _rx.back() ^= 0xff;
+        }
+        _readyAt = mockMicros() + responseDelay;
+    }
+
+    void respond() {
+        requests++;
+        _rx.clear();
+        _rxPos = 0;
+
+        if ((_tx.size() < 8) || (_tx[0] != _id)) {
+            return;
+        }
+        auto crc = ModbusCrc16(_tx.data(), _tx.size() - 2);
+        if ((_tx[_tx.size() - 2] != (crc & 0xff)) || (_tx[_tx.size() - 1] != (crc >> 8))) {
+            return;
+        }
+
+        auto function = _tx[1];
+        unsigned int address = (_tx[2] << 8) | _tx[3];
+        unsigned int quantity = (_tx[4] << 8) | _tx[5];
+
+        append(_id);
+        if ((address + quantity) > RegisterCount) {
+            append(function | 0x80);
+            append(0x02); // Illegal data address
+            finish();
+            return;
+        }
+
+        append(function);
+        switch (function) {
+            case 0x01:
+            case 0x02: {
+                uint8_t bytes = (quantity + 7) / 8;
+                append(bytes);
+                for (uint8_t byte = 0; byte < bytes; byte++) {
+                    uint8_t packed = 0;
+                    for (unsigned int bit = 0; bit < 8; bit++) {
+                        auto index = byte * 8 + bit;
+                        if ((index < quantity) && coils[address + index]) {
+                            packed |= (1 << bit);
+                        }
+                    }
+                    append(packed);
+                }
+                break;
+            }
+
+            case 0x03:
+            case 0x04:
+                if (byteCount >= 0) {
+                    append(byteCount);
+                    for (int i = 0; i < byteCount; i++) {
+                        append(0);
+                    }
+                    break;
+                }
+                append(quantity * 2);
+                for (unsigned int i = 0; i < quantity; i++) {
+                    append(registers[address + i] >> 8);
+                    append(registers[address + i] & 0xff);
+                }
+                break;
+
+            default:
+                _rx.back() |= 0x80;
+                append(0x01); // Illegal function
+                break;
+        }
+        finish();
+    }
+
+    uint8_t _id;
+    std::vector<uint8_t> _tx;
+    std::vector<uint8_t> _rx;
+    size_t _rxPos {0};
+    uint64_t _readyAt {0};
+};
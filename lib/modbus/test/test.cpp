@@ -0,0 +1,384 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "ModbusClient.h"
+#include "ModbusStats.h"
+#include "ModbusCrc16.h"
+#include "SimulatedServer.h"
+
+using namespace particle;
+
+// Copies of the client result codes so they can be compared by value
+static const uint8_t Success = ModbusClient::ku8MBSuccess;
+static const uint8_t IllegalDataAddress = ModbusClient::ku8MBIllegalDataAddress;
+static const uint8_t TimedOut = ModbusClient::ku8MBResponseTimedOut;
+static const uint8_t InvalidCRC = ModbusClient::ku8MBInvalidCRC;
+static const uint8_t InvalidFunction = ModbusClient::ku8MBInvalidFunction;
+
+static void setupClient(ModbusClient& client, SimulatedServer& server) {
+    client.begin(server, 100);
+    // Blocking calls move the simulated clock forward while they wait
+    client.idle([]() {mockAdvanceMicros(1000);});
+}
+
+TEST_CASE("Blocking reads") {
+    SimulatedServer server(1);
+    ModbusClient client;
+    ModbusClientContext context {};
+    setupClient(client, server);
+
+    for (unsigned int i = 0; i < SimulatedServer::RegisterCount; i++) {
+        server.registers[i] = 0x1000 + i;
+    }
+    server.coils[3] = true;
+    server.coils[9] = true;
+
+    SECTION("Holding registers") {
+        REQUIRE(client.readHoldingRegisters(1, 10, 4, context) == Success);
+        CHECK(context.readBuffer[0] == 0x100a);
+        CHECK(context.readBuffer[3] == 0x100d);
+    }
+
+    SECTION("Coils") {
+        REQUIRE(client.readCoils(1, 0, 12, context) == Success);
+        CHECK(context.readBuffer[0] == ((1 << 3) | (1 << 9)));
+    }
+
+    SECTION("Exception") {
+        CHECK(client.readInputRegisters(1, 60, 8, context) == IllegalDataAddress);
+    }
+
+    SECTION("Wrong server times out") {
+        CHECK(client.readHoldingRegisters(2, 0, 1, context) == TimedOut);
+    }
+
+    SECTION("Response timeout applies to later transactions") {
+        server.responseDelay = 50000;
+        client.setResponseTimeout(20);
+        CHECK(client.readHoldingRegisters(1, 0, 1, context) == TimedOut);
+        client.setResponseTimeout(100);
+        CHECK(client.readHoldingRegisters(1, 0, 1, context) == Success);
+    }
+
+    SECTION("Damaged response") {
+        server.corrupt = true;
+        CHECK(client.readHoldingRegisters(1, 0, 1, context) == InvalidCRC);
+    }
+
+    SECTION("Largest response") {
+        server.byteCount = 250;
+        CHECK(client.readHoldingRegisters(1, 0, 1, context) == Success);
+    }
+
+    SECTION("Byte count past the largest response") {
+        for (int count = 251; count <= 255; count++) {
+            server.byteCount = count;
+            CHECK(client.readHoldingRegisters(1, 0, 1, context) == InvalidFunction);
+        }
+        // the rejected responses must not have disturbed later transactions
+        server.byteCount = -1;
+        REQUIRE(client.readHoldingRegisters(1, 10, 4, context) == Success);
+        CHECK(context.readBuffer[0] == 0x100a);
+    }
+}
+
+TEST_CASE("Inter-frame delay") {
+    ModbusClient client;
+
+    client.setBaudRate(9600);
+    CHECK(client.getFrameDelay() == 4010);
+
+    client.setBaudRate(19200);
+    CHECK(client.getFrameDelay() == 2005);
+
+    client.setBaudRate(115200);
+    CHECK(client.getFrameDelay() == ku32FrameDelayFixed);
+
+    SECTION("Request waits for a quiet bus") {
+        SimulatedServer server(1);
+        ModbusClientContext context {};
+        client.begin(server, 100);
+        client.setBaudRate(9600);
+
+        REQUIRE(client.beginRead(1, ModbusType::HoldingRegister, 0, 1, context));
+        REQUIRE(client.poll());
+        REQUIRE(server.requests == 1);
+        while (client.poll()) {
+            mockAdvanceMicros(100);
+        }
+
+        // The response just finished arriving so the next request must hold off for t3.5
+        REQUIRE(client.beginRead(1, ModbusType::HoldingRegister, 0, 1, context));
+        CHECK(client.poll());
+        CHECK(server.requests == 1);
+        mockAdvanceMicros(client.getFrameDelay());
+        CHECK(client.poll());
+        CHECK(server.requests == 2);
+        client.cancel();
+    }
+}
+
+TEST_CASE("Asynchronous reads") {
+    SimulatedServer server1(1);
+    SimulatedServer server2(7);
+    ModbusClient client1;
+    ModbusClient client2;
+    ModbusClientContext context1 {};
+    ModbusClientContext context2 {};
+    client1.begin(server1, 200);
+    client2.begin(server2, 200);
+
+    server1.registers[0] = 111;
+    server2.registers[5] = 222;
+    server1.responseDelay = 50000;
+    server2.responseDelay = 50000;
+
+    SECTION("Slow servers on separate buses are read in parallel") {
+        int completed = 0;
+        uint8_t status1 = 0xff;
+        uint8_t status2 = 0xff;
+
+        REQUIRE(client1.beginRead(1, ModbusType::HoldingRegister, 0, 1, context1,
+            [&](uint8_t status) {status1 = status; completed++;}));
+        REQUIRE(client2.beginRead(7, ModbusType::InputRegister, 5, 1, context2,
+            [&](uint8_t status) {status2 = status; completed++;}));
+
+        // A second request can't be started while one is in progress
+        CHECK_FALSE(client1.beginRead(1, ModbusType::HoldingRegister, 0, 1, context1));
+
+        auto start = millis();
+        while (completed < 2) {
+            client1.poll();
+            client2.poll();
+            mockAdvanceMicros(1000);
+        }
+
+        CHECK((millis() - start) < 100);
+        CHECK(status1 == Success);
+        CHECK(status2 == Success);
+        CHECK(context1.readBuffer[0] == 111);
+        CHECK(context2.readBuffer[0] == 222);
+        CHECK(client1.state() == ModbusClientState::Idle);
+    }
+
+    SECTION("Cancel abandons the transaction") {
+        bool called = false;
+        REQUIRE(client1.beginRead(1, ModbusType::HoldingRegister, 0, 1, context1,
+            [&](uint8_t) {called = true;}));
+        client1.poll();
+        CHECK(client1.state() == ModbusClientState::Receiving);
+        client1.cancel();
+        CHECK_FALSE(client1.poll());
+        mockAdvanceMicros(100000);
+        CHECK_FALSE(client1.poll());
+        CHECK_FALSE(called);
+    }
+
+    SECTION("Timeout completes the transaction") {
+        uint8_t status = 0xff;
+        REQUIRE(client1.beginRead(3, ModbusType::HoldingRegister, 0, 1, context1,
+            [&](uint8_t result) {status = result;}));
+        while (client1.poll()) {
+            mockAdvanceMicros(1000);
+        }
+        CHECK(status == TimedOut);
+        CHECK(client1.status() == TimedOut);
+    }
+
+    SECTION("Exception completes the transaction") {
+        uint8_t status = 0xff;
+        REQUIRE(client1.beginRead(1, ModbusType::InputRegister, 60, 8, context1,
+            [&](uint8_t result) {status = result;}));
+        while (client1.poll()) {
+            mockAdvanceMicros(1000);
+        }
+        CHECK(status == IllegalDataAddress);
+        CHECK(client1.status() == IllegalDataAddress);
+    }
+
+    SECTION("Unknown type isn't started") {
+        CHECK_FALSE(client1.beginRead(1, ModbusType::Unknown, 0, 1, context1));
+        CHECK(client1.state() == ModbusClientState::Idle);
+        CHECK_FALSE(client1.poll());
+        CHECK(server1.requests == 0);
+    }
+
+    SECTION("Cancelled request holds off the next one") {
+        client1.begin(server1, 200, 10);
+        REQUIRE(client1.beginRead(1, ModbusType::HoldingRegister, 0, 1, context1));
+        client1.poll();
+        REQUIRE(server1.requests == 1);
+        client1.cancel();
+
+        // A late response to the abandoned request may still be on its way
+        REQUIRE(client1.beginRead(1, ModbusType::HoldingRegister, 0, 1, context1));
+        CHECK(client1.poll());
+        CHECK(server1.requests == 1);
+        mockAdvanceMicros(10000);
+        while (client1.poll()) {
+            mockAdvanceMicros(1000);
+        }
+        CHECK(server1.requests == 2);
+        CHECK(client1.status() == Success);
+        CHECK(context1.readBuffer[0] == 111);
+    }
+}
+
+TEST_CASE("Response time histogram") {
+    ModbusLatencyHistogram histogram;
+
+    CHECK(histogram.percentile(50) == 0);
+
+    SECTION("Small times are exact") {
+        for (uint32_t time = 1; time <= 5; time++) {
+            histogram.record(time);
+        }
+        CHECK(histogram.percentile(50) == 3);
+        CHECK(histogram.percentile(100) == 5);
+        CHECK(histogram.max() == 5);
+    }
+
+    SECTION("Large times are within a quarter octave") {
+        for (int i = 0; i < 95; i++) {
+            histogram.record(40);
+        }
+        for (int i = 0; i < 5; i++) {
+            histogram.record(1500);
+        }
+        auto p50 = histogram.percentile(50);
+        CHECK(p50 >= 40);
+        CHECK(p50 < 50);
+        CHECK(histogram.percentile(95) == p50);
+        auto p99 = histogram.percentile(99);
+        CHECK(p99 >= 1500);
+        CHECK(p99 <= 1500);
+        CHECK(histogram.max() == 1500);
+    }
+
+    SECTION("Beyond the last bucket") {
+        histogram.record(100000);
+        CHECK(histogram.percentile(50) == 100000);
+    }
+
+    SECTION("Full buckets decay") {
+        for (int i = 0; i < UINT16_MAX; i++) {
+            histogram.record(10);
+        }
+        histogram.record(10);
+        CHECK(histogram.count() == (UINT16_MAX / 2) + 1);
+    }
+}
+
+TEST_CASE("Transaction statistics") {
+    SimulatedServer server(1);
+    ModbusClient client;
+    ModbusClientContext context {};
+    ModbusStats stats;
+    setupClient(client, server);
+    server.responseDelay = 20000;
+
+    auto read = [&](uint8_t id, uint16_t address, uint16_t quantity) {
+        auto status = client.readHoldingRegisters(id, address, quantity, context);
+        stats.record(status, client.getTransactionTime());
+    };
+
+    read(1, 0, 1);
+    CHECK(client.getTransactionTime() >= 20000);
+    read(1, 63, 2);
+    read(2, 0, 1);
+
+    CHECK(stats.requests == 3);
+    CHECK(stats.exceptions == 1);
+    CHECK(stats.exceptionCodes[IllegalDataAddress] == 1);
+    CHECK(stats.timeouts == 1);
+    CHECK(stats.latency.count() == 2);
+    CHECK(stats.latency.percentile(50) >= 20);
+}
+
+// Bit at a time CRC straight from the Modbus serial line specification
+static uint16_t referenceCrc16(const uint8_t* data, size_t count) {
+    uint16_t crc = 0xFFFF;
+    while (count--) {
+        crc ^= *data++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+        }
+    }
+    return crc;
+}
+
+TEST_CASE("CRC16") {
+    SECTION("Known frame") {
+        const uint8_t request[] = {0x01, 0x03, 0x00, 0x00, 0x00, 0x0A};
+        CHECK(ModbusCrc16(request, sizeof(request)) == 0xCDC5);
+
+        const uint8_t check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+        CHECK(ModbusCrc16(check, sizeof(check)) == 0x4B37);
+    }
+
+    SECTION("Frame with its CRC leaves zero") {
+        const uint8_t frame[] = {0x01, 0x03, 0x00, 0x00, 0x00, 0x0A, 0xC5, 0xCD};
+        uint16_t crc = ModbusCrc16Init;
+        for (auto byte: frame) {
+            crc = ModbusCrc16Update(crc, byte);
+        }
+        CHECK(crc == 0);
+    }
+
+    SECTION("Every length and split matches the reference") {
+        std::mt19937 random(1234);
+        std::vector<uint8_t> data(300);
+        for (auto& byte: data) {
+            byte = (uint8_t)random();
+        }
+
+        for (size_t length = 0; length <= data.size(); length++) {
+            auto expected = referenceCrc16(data.data(), length);
+            REQUIRE(ModbusCrc16(data.data(), length) == expected);
+
+            uint16_t bytewise = ModbusCrc16Init;
+            for (size_t i = 0; i < length; i++) {
+                bytewise = ModbusCrc16Update(bytewise, data[i]);
+            }
+            REQUIRE(bytewise == expected);
+
+            auto split = length / 3;
+            auto streamed = ModbusCrc16Update(ModbusCrc16Init, data.data(), split);
+            streamed = ModbusCrc16Update(streamed, data.data() + split, length - split);
+            REQUIRE(streamed == expected);
+        }
+    }
+}
+
+// Run with: modbus-test "[benchmark]"
+TEST_CASE("CRC16 throughput", "[.][benchmark]") {
+    constexpr size_t size = 256;
+    constexpr int rounds = 20000;
+    std::vector<uint8_t> data(size, 0x5A);
+    volatile uint16_t sink = 0;
+
+    auto measure = [&](const char* name, std::function<uint16_t()> run) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) {
+            sink = run();
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::printf("%-12s %8.1f MB/s\n", name, (double)size * rounds / elapsed.count() / 1e6);
+    };
+
+    measure("bitwise", [&]() {return referenceCrc16(data.data(), size);});
+    measure("bytewise", [&]() {
+        uint16_t crc = ModbusCrc16Init;
+        for (auto byte: data) {
+            crc = ModbusCrc16Update(crc, byte);
+        }
+        return crc;
+    });
+    measure("buffer", [&]() {return ModbusCrc16(data.data(), size);});
+    (void)sink;
+}
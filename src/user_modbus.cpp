@@ -19,7 +19,16 @@
 #include "edge.h"
 #include "monitor_edge_ioexpansion.h"
 #include "ModbusClient.h"
+#include "ModbusStats.h"
+#include "ThresholdComparator.h"
+#include "edge_location_publish.h"
+#include "cloud_service.h"
+#include "edge_location.h"
 
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 //
 // Constants
@@ -44,18 +53,50 @@ enum class ModbusParity {
     Even,
 };
 
-static constexpr int MODBUS_CLIENT_COUNT                {3};
+static constexpr int32_t MODBUS_POINT_COUNT_MAX         {100};
+static constexpr size_t MODBUS_POINT_NAME_SIZE          {12};
+static constexpr double MODBUS_POLL_INTERVAL_MIN        {0.1};      // Shortest poll interval in seconds
+static constexpr double MODBUS_POLL_INTERVAL_MAX        {86400.0};  // Longest poll interval in seconds
+static constexpr uint64_t MODBUS_PUBLISH_INTERVAL       {1000};     // Shortest time between result publishes in milliseconds
+static constexpr unsigned int MODBUS_PHASE_SLOTS        {16};       // Automatic phase positions across a poll interval
+static constexpr size_t MODBUS_PUBLISH_ITEM_SIZE        {96};       // Largest encoded result within an event
+static constexpr size_t MODBUS_PUBLISH_CLOSE_SIZE       {2};        // Characters needed to close an event, "]}"
+static constexpr std::size_t MODBUS_PUBLISH_PRIORITY    {1};        // Low priority queue in the background publisher
+static constexpr const char* MODBUS_EVENT_NAME          {"modbus"};
 static constexpr ModbusBaudRates MODBUS_BAUD_DEFAULT    {ModbusBaudRates::Baud38400};
 static constexpr ModbusParity MODBUS_PARITY_DEFAULT     {ModbusParity::None};
 static constexpr int32_t MODBUS_IMD_DEFAULT             {0};
-
-enum class ModbusServerPublish
+static constexpr uint8_t MODBUS_BUS_RS485               {0};    // RS-485 transceiver on Serial1
+static constexpr uint8_t MODBUS_BUS_TCP                 {1};    // RTU framing tunnelled through a TCP gateway
+static constexpr size_t MODBUS_BUS_COUNT                {2};
+static constexpr size_t MODBUS_TCP_HOST_SIZE            {64};
+static constexpr int32_t MODBUS_TCP_PORT_DEFAULT        {502};
+static constexpr size_t MODBUS_SERVER_STATS_MAX         {32};   // Servers tracked per bus
+static constexpr size_t MODBUS_STATS_SERVER_SIZE        {192};  // Largest encoded server entry in the statistics event
+static constexpr const char* MODBUS_STATS_COMMAND       {"modbus_stats"};
+static constexpr uint32_t MODBUS_TIMEOUT_MIN            {50};       // Shortest learned response timeout in milliseconds
+static constexpr uint32_t MODBUS_TIMEOUT_MARGIN         {20};       // Added to the learned response timeout in milliseconds
+static constexpr unsigned int MODBUS_TIMEOUT_FACTOR     {2};        // Learned response timeout as a multiple of p99
+static constexpr uint32_t MODBUS_TIMEOUT_SAMPLES        {16};       // Responses needed before the timeout is learned
+static constexpr unsigned int MODBUS_BREAKER_FAILURES   {3};        // Consecutive failures that stop requests to a server
+static constexpr uint64_t MODBUS_BACKOFF_BASE           {1000};     // First wait before probing a failed server in milliseconds
+static constexpr uint64_t MODBUS_BACKOFF_MAX            {300000};   // Longest wait before probing a failed server in milliseconds
+static constexpr system_tick_t MODBUS_RX_POLL_INTERVAL  {1};        // Wait between checks for response bytes in milliseconds
+static constexpr size_t MODBUS_THREAD_STACK_SIZE        {4*1024};   // Bus workers pack, send, and spill results to the filesystem
+
+// Limits for merging several configured points into a single read request
+static constexpr unsigned int MODBUS_REGISTER_READ_MAX  {125};  // Maximum registers in one read (PDU limit)
+static constexpr unsigned int MODBUS_BIT_READ_MAX       {2000}; // Maximum coils or discrete inputs in one read (PDU limit)
+static constexpr unsigned int MODBUS_REGISTER_GAP_MAX   {8};    // Unused registers allowed between merged points
+static constexpr unsigned int MODBUS_BIT_GAP_MAX        {64};   // Unused coils or discrete inputs allowed between merged points
+
+enum class ModbusServerPublish : uint8_t
 {
   Always,
   OnThreshold,
 };
 
-enum class ModbusServerFunction
+enum class ModbusServerFunction : uint8_t
 {
   Coil,                                       ///< Coil register
   DiscreteInput,                              ///< Discrete input register
@@ -63,7 +104,7 @@ enum class ModbusServerFunction
   HoldingRegister,                            ///< Holding register
 };
 
-enum class ModbusServerType
+enum class ModbusServerType : uint8_t
 {
     Int16,
     Uint16,
@@ -81,7 +122,6 @@ enum class ModbusServerType
 // Global variables
 //
 static Logger monitorOneLog("IoModbus");
-static Thread* modbusThread;
 
 struct ModbusSettings
 {
@@ -92,53 +132,145 @@ struct ModbusSettings
 static ModbusSettings modbusRtuSettings { MODBUS_BAUD_DEFAULT, MODBUS_PARITY_DEFAULT};
 static ModbusSettings modbusRtuSettingsShadow { MODBUS_BAUD_DEFAULT, MODBUS_PARITY_DEFAULT};
 static int32_t modbusInterMessageDelay {MODBUS_IMD_DEFAULT};
-static ModbusClient modbusRtu;
 
-struct ModbusServerConfig {
-    bool enabled                        {false};
-    int32_t id                          {1};
-    int32_t timeout                     {2000};
-    int32_t pollInterval                {1};
-    ModbusServerPublish publish         {ModbusServerPublish::Always};
+struct ModbusTcpSettings
+{
+    char host[MODBUS_TCP_HOST_SIZE];    ///< Gateway host name or address, empty to disable the bus
+    int32_t port;
+};
+
+static ModbusTcpSettings modbusTcpSettings {"", MODBUS_TCP_PORT_DEFAULT};
+static ModbusTcpSettings modbusTcpSettingsShadow {"", MODBUS_TCP_PORT_DEFAULT};
+static TCPClient modbusTcpClient;
+
+struct ModbusPoint {
+    char name[MODBUS_POINT_NAME_SIZE]   {};
+    float offset                        {0.0f};
+    float scale                         {1.0f};
+    uint32_t pollInterval               {1000}; ///< Milliseconds between polls
+    uint32_t phase                      {0};    ///< Milliseconds into the poll interval, zero for automatic
+    uint32_t publishMin                 {0};    ///< Minimum milliseconds between reports on threshold
+    uint32_t publishMax                 {0};    ///< Maximum milliseconds between reports on threshold, zero for none
+    float deadband                      {0.0f}; ///< Absolute change from the last report to report again
+    float deadbandPercent               {0.0f}; ///< Change from the last report, in percent, to report again
+    float threshold                     {0.0f};
+    float hysteresis                    {0.0f};
+    uint16_t address                    {0};
+    uint16_t mask                       {UINT16_MAX};
+    uint16_t timeout                    {2000};
+    uint8_t id                          {1};
+    uint8_t shift                       {0};
+    uint8_t bus                         {MODBUS_BUS_RS485};
     ModbusServerFunction function       {ModbusServerFunction::Coil};
-    uint32_t address                    {0};
     ModbusServerType type               {ModbusServerType::Uint16};
-    uint32_t mask                       {UINT16_MAX};
-    uint32_t shift                      {0};
-    double offset                       {0.0};
-    double scale                        {1.0};
+    ModbusServerPublish publish         {ModbusServerPublish::Always};
+    bool enabled                        {false};
+    bool thresholdEnable                {false};
 
     // Other fields that descibe the data
-    unsigned int readLength             {1};
+    uint8_t readLength                  {1};
     bool signedInt                      {false};
-    uint32_t negativeTest               {0x8000};
-    uint32_t signExtend                 {0};
     bool isFloat                        {false};
     ModbusFloatEndianess endian         {ModbusFloatEndianess::CDAB};
+    uint16_t negativeTest               {0x8000};
+
+    // Polling state
+    bool isolate                        {false}; ///< Read this point on its own rather than merged with neighbours
+};
+
+// Point table in use by the poller and the table being edited by the config service
+static Vector<ModbusPoint> modbusPoints;
+static Vector<ModbusPoint> modbusPointsShadow;
+static RecursiveMutex modbusPointsMutex;
+// Incremented each time a new point table is committed
+static volatile uint32_t modbusPointsGeneration {0};
+// Point selected by the config service for the array element being accessed
+static ModbusPoint* modbusPointCursor {nullptr};
+
+struct ModbusDuePoint {
+    int index;                          ///< Index of the point in the point table
+    ModbusPoint config;
+};
+
+struct ModbusReadBlock {
+    uint8_t id;
+    ModbusServerFunction function;
+    uint16_t address;                   ///< First register, coil, or input to read
+    uint16_t quantity;                  ///< Number of registers, coils, or inputs to read
+    uint16_t timeout;                   ///< Longest response timeout configured for the points in milliseconds
+    int first;                          ///< Index of the first point served by this block
+    int count;                          ///< Number of consecutive points served by this block
+};
+
+struct ModbusScheduleEntry {
+    uint64_t due;                       ///< Deadline for the next poll in milliseconds
+    int index;                          ///< Index of the point in the point table
+};
+
+struct ModbusReportState {
+    double value;                       ///< Last reported value
+    uint64_t reportTick;                ///< Time of the last report in milliseconds
+    uint8_t result;                     ///< Last reported result
+    bool reported;                      ///< A report has been made since the point was scheduled
+    bool pending;                       ///< A change is waiting for the minimum report interval
+    ThresholdState thresholdState;
+    ThresholdComparator<float>* comparator;
+};
+
+static uint64_t modbusScheduleEpoch {0};
+
+struct ModbusServerStats {
+    uint8_t id;
+    ModbusStats stats;
 };
 
-struct ModbusServerObject {
-    char name[16];
-    ModbusServerConfig primary;
-    ModbusServerConfig shadow;
-    ConfigObject* configObject;
-    RecursiveMutex mutex;
-    unsigned int loopTick;
-    ModbusClientContext context;
+struct ModbusServerHealth {
+    uint8_t id;
+    bool open;                          ///< Requests are held back until the retry time
+    unsigned int failures;              ///< Consecutive transactions without a valid response
+    bool widen;                         ///< Use the configured timeout after a learned timeout expired
+    uint64_t retryTick;                 ///< Time to probe the server again in milliseconds
+    ModbusLatencyHistogram latency;     ///< Response times used to learn the timeout
 };
 
-static Vector<ModbusServerObject*> modbusServers {};
+struct ModbusBus {
+    ModbusClient client;
+    ModbusClientContext context;            ///< Shared transaction buffers for all block reads on the bus
+    Vector<ModbusScheduleEntry> schedule;   ///< Min-heap of poll deadlines, owned by the bus worker
+    Vector<ModbusReportState> reports;      ///< Report by exception state for each point in the table, owned by the bus worker
+    Vector<ModbusServerHealth> health;      ///< Responsiveness of each server, owned by the bus worker
+    os_queue_t wakeQueue {nullptr};         ///< Wakes the worker early when the point table or bus settings change
+    Thread* thread {nullptr};
+    volatile bool reconnect {false};        ///< Transport settings changed and the port or connection must be reopened
+    uint8_t index {0};
+
+    // Health of the bus, guarded by the statistics mutex
+    ModbusStats stats;
+    Vector<ModbusServerStats> servers;
+    uint64_t busyTime {0};                  ///< Time spent in transactions since the statistics started in microseconds
+    uint64_t statsStart {0};                ///< Start of the statistics in milliseconds
+};
+
+// Each bus is polled by its own worker so that a slow bus doesn't hold up the others
+static ModbusBus modbusBuses[MODBUS_BUS_COUNT];
+static RecursiveMutex modbusStatsMutex;
 
 struct ModbusPublish {
-    char* name {nullptr};
+    char name[MODBUS_POINT_NAME_SIZE] {};
     //bool isFloat {false};
     //bool signedInt {false};
     double value {0.0};
+    uint64_t tick {0};                  ///< Time of the poll in milliseconds
     uint8_t result {0};
 };
 
+// Results from every bus, published by whichever worker finds them due
 static Vector<ModbusPublish> resultsToPublish;
-static unsigned int publishTick;
+static uint64_t publishTick;
+static bool modbusPublishing;           ///< A worker is sending results outside of the lock
+static RecursiveMutex modbusResultsMutex;
+
+static char modbusEventBuffer[particle::protocol::MAX_EVENT_DATA_LENGTH + 1];
 
 
 //
@@ -236,6 +368,8 @@ uint32_t modbusEnumToParity(ModbusParity parity)
 /**
  * @brief Change the serial port baud and parity settings
  *
+ * @details Only called by the RS-485 bus worker, between transactions, once the worker is running.
+ *
  * @param settings Structure to contain desired baud and parity
  * @retval SYSTEM_ERROR_NONE Success
  * @retval SYSTEM_ERROR_INVALID_ARGUMENT Something wasn't good
@@ -251,6 +385,7 @@ int modbusChangeInterfaceSettings(ModbusSettings& settings)
     }
 
     Serial1.begin(baud, SERIAL_DATA_BITS_8 | SERIAL_STOP_BITS_1 | parity);
+    modbusBuses[MODBUS_BUS_RS485].client.setBaudRate(baud);
 
     return SYSTEM_ERROR_NONE;
 }
@@ -283,8 +418,20 @@ int config_modbus_exit(bool write, int status, const void *context)
 {
     if (write && (0 == status))
     {
-        memcpy(&modbusRtuSettings, &modbusRtuSettingsShadow, sizeof(modbusRtuSettings));
-        modbusChangeInterfaceSettings(modbusRtuSettings);
+        // The port is reopened by the bus worker between transactions rather than here, where it
+        // could be in the middle of one
+        auto& bus = modbusBuses[MODBUS_BUS_RS485];
+        const std::lock_guard<RecursiveMutex> lock(modbusPointsMutex);
+        if (memcmp(&modbusRtuSettings, &modbusRtuSettingsShadow, sizeof(modbusRtuSettings)))
+        {
+            memcpy(&modbusRtuSettings, &modbusRtuSettingsShadow, sizeof(modbusRtuSettings));
+            bus.reconnect = true;
+            if (bus.wakeQueue)
+            {
+                uint8_t wake {};
+                os_queue_put(bus.wakeQueue, &wake, 0, nullptr);
+            }
+        }
     }
     return status;
 }
@@ -326,357 +473,1793 @@ int buildModbusRtuSettings() {
     ConfigService::instance().registerModule(modbusRtuConfiguration);
 
     // Modbus RTU settings
+    auto& client = modbusBuses[MODBUS_BUS_RS485].client;
     modbusChangeInterfaceSettings(modbusRtuSettings);
-    modbusRtu.begin(Serial1);
+    client.begin(Serial1);
     // Callbacks allow us to configure the RS485 transceiver correctly
-    modbusRtu.preTransmission([]() {digitalWrite(MONITOREDGE_IOEX_RS485_DE_PIN, 1);});
-    modbusRtu.postTransmission([]() {digitalWrite(MONITOREDGE_IOEX_RS485_DE_PIN, 0);});
-    modbusRtu.idle([]() {os_thread_yield();});
+    client.preTransmission([]() {digitalWrite(MONITOREDGE_IOEX_RS485_DE_PIN, 1);});
+    client.postTransmission([]() {digitalWrite(MONITOREDGE_IOEX_RS485_DE_PIN, 0);});
+    client.idle([]() {os_thread_yield();});
 
     return 0;
 }
 
 /**
- * @brief Config service object setting upon new JSON configuration for polling
+ * @brief Config service object setting upon new JSON configuration for the TCP gateway
  *
  * @param write Indicates whether the current operation is to write
  * @param context Unused
  * @return int Zero (success) always
  */
-int modbusConfigEnter(bool write, const void *context)
+int config_modbus_tcp_enter(bool write, const void *context)
 {
-    auto modbusContext = (ModbusServerObject*)context;
-    assert(nullptr != modbusContext);
-
     if (write)
     {
-        const std::lock_guard<RecursiveMutex> lock(modbusContext->mutex);
-        memcpy(&modbusContext->shadow, &modbusContext->primary, sizeof(modbusContext->shadow));
+        memcpy(&modbusTcpSettingsShadow, &modbusTcpSettings, sizeof(modbusTcpSettingsShadow));
     }
     return 0;
 }
 
 /**
- * @brief Config service object settings to commit new JSON configuration for polling
+ * @brief Config service object settings to commit new JSON configuration for the TCP gateway
  *
  * @param write Indicates whether the current operation is to write
  * @param status Status of the command return value
  * @param context Unused
  * @return int The command return value
  */
-int modbusConfigExit(bool write, int status, const void *context)
+int config_modbus_tcp_exit(bool write, int status, const void *context)
 {
-    auto modbusContext = (ModbusServerObject*)context;
-    assert(nullptr != modbusContext);
-
     if (write && (0 == status))
     {
-        const std::lock_guard<RecursiveMutex> lock(modbusContext->mutex);
-        memcpy(&modbusContext->primary, &modbusContext->shadow, sizeof(modbusContext->primary));
+        auto& bus = modbusBuses[MODBUS_BUS_TCP];
+        const std::lock_guard<RecursiveMutex> lock(modbusPointsMutex);
+        if (memcmp(&modbusTcpSettings, &modbusTcpSettingsShadow, sizeof(modbusTcpSettings)))
+        {
+            memcpy(&modbusTcpSettings, &modbusTcpSettingsShadow, sizeof(modbusTcpSettings));
+            bus.reconnect = true;
+            if (bus.wakeQueue)
+            {
+                uint8_t wake {};
+                os_queue_put(bus.wakeQueue, &wake, 0, nullptr);
+            }
+        }
+    }
+    return status;
+}
 
-        // Collect properties of the data type
-        modbusContext->primary.signedInt = false;
-        modbusContext->primary.isFloat = false;
-        switch (modbusContext->primary.type)
+/**
+ * @brief Create the Modbus TCP gateway configuration settings
+ *
+ * @details The gateway carries RTU frames, including the CRC, over a TCP connection.  This
+ * is the mode offered by most serial to Ethernet converters and lets a second field bus be
+ * polled alongside the RS-485 port.
+ *
+ * @return int Zero (success) always
+ */
+int buildModbusTcpSettings() {
+    static ConfigObject modbusTcpConfiguration("modbus_tcp",
         {
-            case ModbusServerType::Int16:
-                modbusContext->primary.signedInt = true;
-                // Fall through
-            case ModbusServerType::Uint16:
+            ConfigString("host",
+                config_get_string_cb, config_set_string_cb,
+                modbusTcpSettings.host, modbusTcpSettingsShadow.host,
+                sizeof(modbusTcpSettings.host)),
+            ConfigInt("port",
+                config_get_int32_cb, config_set_int32_cb,
+                &modbusTcpSettings.port, &modbusTcpSettingsShadow.port,
+                1, UINT16_MAX),
+        },
+        config_modbus_tcp_enter,
+        config_modbus_tcp_exit
+    );
+    ConfigService::instance().registerModule(modbusTcpConfiguration);
+
+    auto& client = modbusBuses[MODBUS_BUS_TCP].client;
+    client.begin(modbusTcpClient);
+    client.idle([]() {os_thread_yield();});
+
+    return 0;
+}
+
+/**
+ * @brief Derive the decode properties of a point from its configuration
+ *
+ * @param point Point to update
+ */
+void modbusPointDerive(ModbusPoint& point)
+{
+    // Collect properties of the data type
+    point.signedInt = false;
+    point.isFloat = false;
+    switch (point.type)
+    {
+        case ModbusServerType::Int16:
+            point.signedInt = true;
+            // Fall through
+        case ModbusServerType::Uint16:
+        // Fall through
+        case ModbusServerType::Bits:
+            point.readLength = 1;
+            break;
+
+        case ModbusServerType::Int32:
+            point.signedInt = true;
             // Fall through
-            case ModbusServerType::Bits:
-                modbusContext->primary.readLength = 1;
-                break;
+        case ModbusServerType::Uint32:
+            point.readLength = 2;
+            break;
 
-            case ModbusServerType::Int32:
-                modbusContext->primary.signedInt = true;
-                // Fall through
-            case ModbusServerType::Uint32:
-                modbusContext->primary.readLength = 2;
-                break;
+        case ModbusServerType::Float32abcd:
+            // Fall through
+        case ModbusServerType::Float32badc:
+            // Fall through
+        case ModbusServerType::Float32cdab:
+            // Fall through
+        case ModbusServerType::Float32dcba:
+            point.isFloat = true;
+            point.readLength = 2;
+            break;
+    }
 
-            case ModbusServerType::Float32abcd:
-                // Fall through
-            case ModbusServerType::Float32badc:
-                // Fall through
-            case ModbusServerType::Float32cdab:
-                // Fall through
-            case ModbusServerType::Float32dcba:
-                modbusContext->primary.isFloat = true;
-                modbusContext->primary.readLength = 2;
-                break;
-        }
+    switch (point.type)
+    {
+        case ModbusServerType::Float32abcd:
+            point.endian = ModbusFloatEndianess::ABCD;
+            break;
 
-        switch (modbusContext->primary.type)
-        {
-            case ModbusServerType::Float32abcd:
-                modbusContext->primary.endian = ModbusFloatEndianess::ABCD;
-                break;
+        case ModbusServerType::Float32badc:
+            point.endian = ModbusFloatEndianess::BADC;
+            break;
+
+        case ModbusServerType::Float32cdab:
+            point.endian = ModbusFloatEndianess::CDAB;
+            break;
 
-            case ModbusServerType::Float32badc:
-                modbusContext->primary.endian = ModbusFloatEndianess::BADC;
-                break;
+        case ModbusServerType::Float32dcba:
+            point.endian = ModbusFloatEndianess::DCBA;
+            break;
+    }
+
+    // Fixed for paranoia
+    point.shift = std::min<uint8_t>(point.shift, 15);
 
-            case ModbusServerType::Float32cdab:
-                modbusContext->primary.endian = ModbusFloatEndianess::CDAB;
-                break;
+    point.negativeTest = 0;
+    if (point.signedInt)
+    {
+        // Figure out sign extension for signed types
+        auto leadingZeros = __builtin_clz((unsigned int)(point.mask >> point.shift));
+        leadingZeros -= 16; // We only care about the least significant 16 bits
 
-            case ModbusServerType::Float32dcba:
-                modbusContext->primary.endian = ModbusFloatEndianess::DCBA;
-                break;
+        if (15 > leadingZeros)
+        {
+            point.negativeTest = 1U << (15 - leadingZeros);  // This is a mask to test the sign bit
         }
+        // Otherwise the number doesn't have enough bits to represent a negative number
+    }
+}
 
-        // Fixed for paranoia
-        modbusContext->primary.shift = min(modbusContext->primary.shift, 15UL);
-        modbusContext->primary.mask &= 0xffff;
-        modbusContext->primary.address &= 0xffff;
+/**
+ * @brief Config service array setting upon new JSON configuration for polling
+ *
+ * @param write Indicates whether the current operation is to write
+ * @param context Unused
+ * @return int Zero (success) always
+ */
+int modbusPointsEnter(bool write, const void *context)
+{
+    if (write)
+    {
+        // The shadow table only exists while a configuration is being applied
+        const std::lock_guard<RecursiveMutex> lock(modbusPointsMutex);
+        modbusPointsShadow = modbusPoints;
+    }
+    return 0;
+}
 
-        if (modbusContext->primary.signedInt)
+/**
+ * @brief Config service array settings to commit new JSON configuration for polling
+ *
+ * @param write Indicates whether the current operation is to write
+ * @param status Status of the command return value
+ * @param context Unused
+ * @return int The command return value
+ */
+int modbusPointsExit(bool write, int status, const void *context)
+{
+    if (write)
+    {
+        const std::lock_guard<RecursiveMutex> lock(modbusPointsMutex);
+        if (0 == status)
         {
-            // Figure out sign extension for signed types
-            auto leadingZeros = __builtin_clz((unsigned int)(modbusContext->primary.mask >> modbusContext->primary.shift));
-            leadingZeros -= 16; // We only care about the least significant 16 bits
-
-            if (15 > leadingZeros)
+            for (auto& point: modbusPointsShadow)
             {
-                modbusContext->primary.negativeTest = 1UL << (15 - leadingZeros);  // This is a mask to test the sign bit
-                modbusContext->primary.signExtend = UINT32_MAX << (15 - leadingZeros); // This is the pattern to OR the result to extend the sign bit
+                modbusPointDerive(point);
+                // Give the new configuration a chance to be merged with its neighbours again
+                point.isolate = false;
             }
-            else
+            modbusPoints = modbusPointsShadow;
+            modbusPointsGeneration++;
+            for (auto& bus: modbusBuses)
             {
-                // The number doesn't have enough bits to represent a negative number
-                modbusContext->primary.negativeTest = 0;
-                modbusContext->primary.signExtend = 0;
+                if (bus.wakeQueue)
+                {
+                    uint8_t wake {};
+                    os_queue_put(bus.wakeQueue, &wake, 0, nullptr);
+                }
             }
         }
-
-        // Serial.printlnf(
-        //     "ID=%ld, TO=%ld, PI=%ld, FN=%d, ADD=0x%04lx, MASK=0x%04lx, SHIFT=%ld, NT=0x%04lx, SE=0x%04lx, LOW=%0.3lf, HIGH=%0.3lf",
-        //     modbusContext->primary.id,
-        //     modbusContext->primary.timeout,
-        //     modbusContext->primary.pollInterval,
-        //     (int)modbusContext->primary.function,
-        //     modbusContext->primary.address,
-        //     modbusContext->primary.mask, modbusContext->primary.shift,
-        //     modbusContext->primary.negativeTest, modbusContext->primary.signExtend,
-        //     modbusContext->primary.offset, modbusContext->primary.scale);
+        modbusPointsShadow.clear();
+        modbusPointsShadow.trimToSize();
     }
     return status;
 }
 
 /**
- * @brief Create the Modbus polling configuration settings
+ * @brief Get the number of points in a point table
  *
+ * @param count Number of points
+ * @param context Point table
  * @return int Zero (success) always
  */
-int buildModbusSettings(int n) {
-    auto serverConfig = new ModbusServerObject();
+int modbusPointsGetCount(int32_t &count, const void *context)
+{
+    count = ((const Vector<ModbusPoint>*)context)->size();
+    return 0;
+}
+
+/**
+ * @brief Change the number of points in a point table
+ *
+ * @param count Number of points
+ * @param context Point table
+ * @retval 0 Success
+ * @retval -ENOMEM Not enough memory for the table
+ */
+int modbusPointsSetCount(int32_t count, const void *context)
+{
+    auto points = (Vector<ModbusPoint>*)context;
+
+    while (points->size() > count)
+    {
+        points->takeLast();
+    }
+    if (!points->reserve(count))
+    {
+        return -ENOMEM;
+    }
+    while (points->size() < count)
+    {
+        points->append(ModbusPoint());
+    }
+    return 0;
+}
+
+/**
+ * @brief Point the element accessors at the given point
+ *
+ * @param index Index of the point
+ * @param context Point table
+ * @retval 0 Success
+ * @retval -EINVAL Index is out of range
+ */
+int modbusPointsSelect(int32_t index, const void *context)
+{
+    auto points = (Vector<ModbusPoint>*)context;
+
+    if ((index < 0) || (index >= points->size()))
+    {
+        return -EINVAL;
+    }
+    modbusPointCursor = &(*points)[index];
+    return 0;
+}
+
+template <typename T, T ModbusPoint::*Field>
+int modbusPointGetInt(int32_t &value, const void *context)
+{
+    value = (int32_t)(modbusPointCursor->*Field);
+    return 0;
+}
 
-    snprintf(serverConfig->name, sizeof(serverConfig->name), "modbus%d", n);
+template <typename T, T ModbusPoint::*Field>
+int modbusPointSetInt(int32_t value, const void *context)
+{
+    modbusPointCursor->*Field = (T)value;
+    return 0;
+}
+
+template <uint32_t ModbusPoint::*Field>
+int modbusPointGetSeconds(double &value, const void *context)
+{
+    value = (double)(modbusPointCursor->*Field) / 1000.0;
+    return 0;
+}
+
+template <uint32_t ModbusPoint::*Field>
+int modbusPointSetSeconds(double value, const void *context)
+{
+    modbusPointCursor->*Field = (uint32_t)round(value * 1000.0);
+    return 0;
+}
+
+template <float ModbusPoint::*Field>
+int modbusPointGetFloat(double &value, const void *context)
+{
+    value = (double)(modbusPointCursor->*Field);
+    return 0;
+}
+
+template <float ModbusPoint::*Field>
+int modbusPointSetFloat(double value, const void *context)
+{
+    modbusPointCursor->*Field = (float)value;
+    return 0;
+}
 
-    serverConfig->configObject = new ConfigObject(serverConfig->name,
+/**
+ * @brief Create the Modbus polling configuration settings
+ *
+ * @return int Zero (success) always
+ */
+int buildModbusSettings() {
+    static ConfigObject modbusConfiguration("modbus",
         {
-            ConfigBool("enable",
-                config_get_bool_cb, config_set_bool_cb,
-                &serverConfig->primary.enabled, &serverConfig->shadow.enabled),
-            ConfigInt("id",
-                config_get_int32_cb, config_set_int32_cb,
-                &serverConfig->primary.id, &serverConfig->shadow.id),
-            ConfigInt("timeout",
-                config_get_int32_cb, config_set_int32_cb,
-                &serverConfig->primary.timeout, &serverConfig->shadow.timeout),
-            ConfigInt("poll",
-                config_get_int32_cb, config_set_int32_cb,
-                &serverConfig->primary.pollInterval, &serverConfig->shadow.pollInterval),
-            ConfigStringEnum("publish", {
-                    {"always", (int32_t) ModbusServerPublish::Always},
-                },
-                config_get_int32_cb, config_set_int32_cb,
-                &serverConfig->primary.publish, &serverConfig->shadow.publish),
-            ConfigStringEnum("function", {
-                    {"coil", (int32_t) ModbusServerFunction::Coil},
-                    {"discrete_input", (int32_t) ModbusServerFunction::DiscreteInput},
-                    {"input_register", (int32_t) ModbusServerFunction::InputRegister},
-                    {"holding_register", (int32_t) ModbusServerFunction::HoldingRegister},
-                },
-                config_get_int32_cb, config_set_int32_cb,
-                &serverConfig->primary.function, &serverConfig->shadow.function),
-            ConfigInt("address",
-                config_get_int32_cb, config_set_int32_cb,
-                &serverConfig->primary.address, &serverConfig->shadow.address),
-            ConfigStringEnum("type", {
-                    {"int16", (int32_t) ModbusServerType::Int16},
-                    {"uint16", (int32_t) ModbusServerType::Uint16},
-                    {"int32", (int32_t) ModbusServerType::Int32},
-                    {"uint32", (int32_t) ModbusServerType::Uint32},
-                    {"float32_abcd", (int32_t) ModbusServerType::Float32abcd},
-                    {"float32_badc", (int32_t) ModbusServerType::Float32badc},
-                    {"float32_cdab", (int32_t) ModbusServerType::Float32cdab},
-                    {"float32_dcba", (int32_t) ModbusServerType::Float32dcba},
-                    {"bits", (int32_t) ModbusServerType::Bits},
-                },
-                config_get_int32_cb, config_set_int32_cb,
-                &serverConfig->primary.type, &serverConfig->shadow.type),
-            ConfigInt("mask",
-                config_get_int32_cb, config_set_int32_cb,
-                &serverConfig->primary.mask, &serverConfig->shadow.mask),
-            ConfigInt("shift",
-                config_get_int32_cb, config_set_int32_cb,
-                &serverConfig->primary.shift, &serverConfig->shadow.shift),
-            ConfigFloat("offset",
-                config_get_float_cb, config_set_float_cb,
-                &serverConfig->primary.offset, &serverConfig->shadow.offset),
-            ConfigFloat("scale",
-                config_get_float_cb, config_set_float_cb,
-                &serverConfig->primary.scale, &serverConfig->shadow.scale),
-        },
-        modbusConfigEnter,
-        modbusConfigExit,
-        serverConfig, serverConfig
+            ConfigArray("points",
+                ConfigObject(nullptr,
+                {
+                    ConfigString("name",
+                        [](const char * &value, const void *context) {
+                            value = modbusPointCursor->name;
+                            return 0;
+                        },
+                        [](const char *value, const void *context) {
+                            strlcpy(modbusPointCursor->name, value, sizeof(modbusPointCursor->name));
+                            return 0;
+                        },
+                        nullptr, nullptr, MODBUS_POINT_NAME_SIZE),
+                    ConfigBool("enable",
+                        [](bool &value, const void *context) {
+                            value = modbusPointCursor->enabled;
+                            return 0;
+                        },
+                        [](bool value, const void *context) {
+                            modbusPointCursor->enabled = value;
+                            return 0;
+                        }),
+                    ConfigInt("id",
+                        modbusPointGetInt<uint8_t, &ModbusPoint::id>,
+                        modbusPointSetInt<uint8_t, &ModbusPoint::id>,
+                        nullptr, nullptr, 1, UINT8_MAX),
+                    ConfigInt("bus",
+                        modbusPointGetInt<uint8_t, &ModbusPoint::bus>,
+                        modbusPointSetInt<uint8_t, &ModbusPoint::bus>,
+                        nullptr, nullptr, 0, MODBUS_BUS_COUNT - 1),
+                    ConfigInt("timeout",
+                        modbusPointGetInt<uint16_t, &ModbusPoint::timeout>,
+                        modbusPointSetInt<uint16_t, &ModbusPoint::timeout>,
+                        nullptr, nullptr, 0, UINT16_MAX),
+                    ConfigFloat("poll",
+                        modbusPointGetSeconds<&ModbusPoint::pollInterval>,
+                        modbusPointSetSeconds<&ModbusPoint::pollInterval>,
+                        nullptr, nullptr, MODBUS_POLL_INTERVAL_MIN, MODBUS_POLL_INTERVAL_MAX),
+                    ConfigFloat("phase",
+                        modbusPointGetSeconds<&ModbusPoint::phase>,
+                        modbusPointSetSeconds<&ModbusPoint::phase>,
+                        nullptr, nullptr, 0.0, MODBUS_POLL_INTERVAL_MAX),
+                    ConfigStringEnum("publish", {
+                            {"always", (int32_t) ModbusServerPublish::Always},
+                            {"on_threshold", (int32_t) ModbusServerPublish::OnThreshold},
+                        },
+                        modbusPointGetInt<ModbusServerPublish, &ModbusPoint::publish>,
+                        modbusPointSetInt<ModbusServerPublish, &ModbusPoint::publish>),
+                    ConfigFloat("deadband",
+                        modbusPointGetFloat<&ModbusPoint::deadband>,
+                        modbusPointSetFloat<&ModbusPoint::deadband>,
+                        nullptr, nullptr, 0.0),
+                    ConfigFloat("deadband_pct",
+                        modbusPointGetFloat<&ModbusPoint::deadbandPercent>,
+                        modbusPointSetFloat<&ModbusPoint::deadbandPercent>,
+                        nullptr, nullptr, 0.0),
+                    ConfigFloat("thresh",
+                        modbusPointGetFloat<&ModbusPoint::threshold>,
+                        modbusPointSetFloat<&ModbusPoint::threshold>),
+                    ConfigFloat("hyst",
+                        modbusPointGetFloat<&ModbusPoint::hysteresis>,
+                        modbusPointSetFloat<&ModbusPoint::hysteresis>,
+                        nullptr, nullptr, 0.0),
+                    ConfigBool("th_en",
+                        [](bool &value, const void *context) {
+                            value = modbusPointCursor->thresholdEnable;
+                            return 0;
+                        },
+                        [](bool value, const void *context) {
+                            modbusPointCursor->thresholdEnable = value;
+                            return 0;
+                        }),
+                    ConfigFloat("min_pub",
+                        modbusPointGetSeconds<&ModbusPoint::publishMin>,
+                        modbusPointSetSeconds<&ModbusPoint::publishMin>,
+                        nullptr, nullptr, 0.0, MODBUS_POLL_INTERVAL_MAX),
+                    ConfigFloat("max_pub",
+                        modbusPointGetSeconds<&ModbusPoint::publishMax>,
+                        modbusPointSetSeconds<&ModbusPoint::publishMax>,
+                        nullptr, nullptr, 0.0, MODBUS_POLL_INTERVAL_MAX),
+                    ConfigStringEnum("function", {
+                            {"coil", (int32_t) ModbusServerFunction::Coil},
+                            {"discrete_input", (int32_t) ModbusServerFunction::DiscreteInput},
+                            {"input_register", (int32_t) ModbusServerFunction::InputRegister},
+                            {"holding_register", (int32_t) ModbusServerFunction::HoldingRegister},
+                        },
+                        modbusPointGetInt<ModbusServerFunction, &ModbusPoint::function>,
+                        modbusPointSetInt<ModbusServerFunction, &ModbusPoint::function>),
+                    ConfigInt("address",
+                        modbusPointGetInt<uint16_t, &ModbusPoint::address>,
+                        modbusPointSetInt<uint16_t, &ModbusPoint::address>,
+                        nullptr, nullptr, 0, UINT16_MAX),
+                    ConfigStringEnum("type", {
+                            {"int16", (int32_t) ModbusServerType::Int16},
+                            {"uint16", (int32_t) ModbusServerType::Uint16},
+                            {"int32", (int32_t) ModbusServerType::Int32},
+                            {"uint32", (int32_t) ModbusServerType::Uint32},
+                            {"float32_abcd", (int32_t) ModbusServerType::Float32abcd},
+                            {"float32_badc", (int32_t) ModbusServerType::Float32badc},
+                            {"float32_cdab", (int32_t) ModbusServerType::Float32cdab},
+                            {"float32_dcba", (int32_t) ModbusServerType::Float32dcba},
+                            {"bits", (int32_t) ModbusServerType::Bits},
+                        },
+                        modbusPointGetInt<ModbusServerType, &ModbusPoint::type>,
+                        modbusPointSetInt<ModbusServerType, &ModbusPoint::type>),
+                    ConfigInt("mask",
+                        modbusPointGetInt<uint16_t, &ModbusPoint::mask>,
+                        modbusPointSetInt<uint16_t, &ModbusPoint::mask>,
+                        nullptr, nullptr, 0, UINT16_MAX),
+                    ConfigInt("shift",
+                        modbusPointGetInt<uint8_t, &ModbusPoint::shift>,
+                        modbusPointSetInt<uint8_t, &ModbusPoint::shift>,
+                        nullptr, nullptr, 0, 15),
+                    ConfigFloat("offset",
+                        modbusPointGetFloat<&ModbusPoint::offset>,
+                        modbusPointSetFloat<&ModbusPoint::offset>),
+                    ConfigFloat("scale",
+                        modbusPointGetFloat<&ModbusPoint::scale>,
+                        modbusPointSetFloat<&ModbusPoint::scale>),
+                }),
+                modbusPointsGetCount,
+                modbusPointsSetCount,
+                modbusPointsSelect,
+                modbusPointsEnter,
+                modbusPointsExit,
+                &modbusPoints, &modbusPointsShadow,
+                MODBUS_POINT_COUNT_MAX),
+        }
     );
-    ConfigService::instance().registerModule(*serverConfig->configObject);
-    modbusServers.append(serverConfig);
+    ConfigService::instance().registerModule(modbusConfiguration);
 
     return 0;
 }
 
+/**
+ * @brief Find the value of a string enumeration in a legacy configuration
+ *
+ * @param names Names of the enumeration in order of value
+ * @param count Number of names
+ * @param value Name to look up
+ * @return int Value of the name, or -1 if it isn't known
+ */
+static int modbusLegacyEnum(const char* const names[], size_t count, const JSONString& value)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (value == names[i])
+        {
+            return (int)i;
+        }
+    }
+    return -1;
+}
 
 /**
- * @brief The thread that service all poll requests
+ * @brief Convert the settings of a legacy modbus1 through modbus3 module to a point
  *
- * @param param Unused
+ * @param object Module object read from the legacy configuration file
+ * @param point Point to update
  */
-void modbusThreadLoop(void* param)
+static void modbusLegacyPoint(const JSONValue& object, ModbusPoint& point)
 {
-    while (true)
+    static const char* const functions[] = {"coil", "discrete_input", "input_register", "holding_register"};
+    static const char* const types[] = {"int16", "uint16", "int32", "uint32",
+        "float32_abcd", "float32_badc", "float32_cdab", "float32_dcba", "bits"};
+
+    JSONObjectIterator it(object);
+    while (it.next())
     {
-        for (auto server: modbusServers) {
-            ModbusServerConfig safeConfig {};
+        auto value = it.value();
+        if (it.name() == "enable")
+        {
+            point.enabled = value.toBool();
+        }
+        else if (it.name() == "id")
+        {
+            point.id = (uint8_t)std::max(1, std::min(value.toInt(), (int)UINT8_MAX));
+        }
+        else if (it.name() == "timeout")
+        {
+            point.timeout = (uint16_t)std::max(0, std::min(value.toInt(), (int)UINT16_MAX));
+        }
+        else if (it.name() == "poll")
+        {
+            // Polled in whole seconds before points were introduced
+            auto poll = std::max(MODBUS_POLL_INTERVAL_MIN, std::min((double)value.toInt(), MODBUS_POLL_INTERVAL_MAX));
+            point.pollInterval = (uint32_t)(poll * 1000.0);
+        }
+        else if (it.name() == "function")
+        {
+            auto function = modbusLegacyEnum(functions, sizeof(functions) / sizeof(functions[0]), value.toString());
+            if (function >= 0)
+            {
+                point.function = (ModbusServerFunction)function;
+            }
+        }
+        else if (it.name() == "address")
+        {
+            point.address = (uint16_t)std::max(0, std::min(value.toInt(), (int)UINT16_MAX));
+        }
+        else if (it.name() == "type")
+        {
+            auto type = modbusLegacyEnum(types, sizeof(types) / sizeof(types[0]), value.toString());
+            if (type >= 0)
             {
-                const std::lock_guard<RecursiveMutex> lock(server->mutex);
-                memcpy(&safeConfig, &server->primary, sizeof(safeConfig));
+                point.type = (ModbusServerType)type;
             }
-            if (safeConfig.enabled && ((System.uptime() - server->loopTick) >= (unsigned int)safeConfig.pollInterval)) {
-                server->loopTick = System.uptime();
+        }
+        else if (it.name() == "mask")
+        {
+            point.mask = (uint16_t)std::max(0, std::min(value.toInt(), (int)UINT16_MAX));
+        }
+        else if (it.name() == "shift")
+        {
+            point.shift = (uint8_t)std::max(0, std::min(value.toInt(), 15));
+        }
+        else if (it.name() == "offset")
+        {
+            point.offset = (float)value.toDouble();
+        }
+        else if (it.name() == "scale")
+        {
+            point.scale = (float)value.toDouble();
+        }
+        // The legacy modules only ever published every poll, which is the point default
+    }
+}
 
-                uint8_t result {};
-                switch (safeConfig.function)
-                {
-                    case ModbusServerFunction::Coil:
-                        result = modbusRtu.readCoils(safeConfig.id, safeConfig.address, safeConfig.readLength, server->context);
-                        break;
-                    case ModbusServerFunction::DiscreteInput:
-                        result = modbusRtu.readDiscreteInputs(safeConfig.id, safeConfig.address, safeConfig.readLength, server->context);
-                        break;
-                    case ModbusServerFunction::InputRegister:
-                        result = modbusRtu.readInputRegisters(safeConfig.id, safeConfig.address, safeConfig.readLength, server->context);
-                        break;
-                    case ModbusServerFunction::HoldingRegister:
-                        result = modbusRtu.readHoldingRegisters(safeConfig.id, safeConfig.address, safeConfig.readLength, server->context);
-                        break;
-                }
+/**
+ * @brief Move the settings of the legacy modbus1 through modbus3 modules into the point table
+ *
+ * @details Before the point table each Modbus server was configured through its own module.  Their
+ * files are converted into the first points of the table, named after the module, unless the table
+ * has already been configured.  The files are removed once the converted table has been saved so
+ * this only happens once, and are kept whenever they couldn't be converted or saved.
+ *
+ * @return int Number of points converted
+ */
+int modbusMigrateLegacySettings()
+{
+    static constexpr int MODBUS_LEGACY_MODULES {3};
+    static constexpr size_t MODBUS_LEGACY_FILE_MAX {1024};
+
+    int converted {0};
+    bool configured {false};
+    bool removable[MODBUS_LEGACY_MODULES] {};
+    {
+        const std::lock_guard<RecursiveMutex> lock(modbusPointsMutex);
+        configured = !modbusPoints.isEmpty();
+    }
+
+    for (int n = 1; n <= MODBUS_LEGACY_MODULES; n++)
+    {
+        char name[MODBUS_POINT_NAME_SIZE] {};
+        snprintf(name, sizeof(name), "modbus%d", n);
+        auto filename = String(CONFIG_SERVICE_FS_PATH) + '/' + name + ".cfg";
 
-                uint32_t uint32_Value {};
+        struct stat st;
+        if (stat(filename, &st) || !S_ISREG(st.st_mode))
+        {
+            continue;
+        }
 
-                if (ModbusClient::ku8MBSuccess == result)
+        bool moved {configured};
+        if (!configured && (st.st_size > 0) && (st.st_size <= (off_t)MODBUS_LEGACY_FILE_MAX))
+        {
+            auto buffer = new (std::nothrow) char[st.st_size];
+            auto fd = open(filename, O_RDONLY);
+            if (buffer && (fd >= 0) && (read(fd, buffer, st.st_size) == st.st_size))
+            {
+                auto root = JSONValue::parseCopy(buffer, st.st_size);
+                JSONObjectIterator it(root);
+                while (it.next())
                 {
-                    switch (safeConfig.type)
+                    if ((it.name() == name) && it.value().isObject())
                     {
-                        case ModbusServerType::Int16:
-                            // Fall through
-                        case ModbusServerType::Bits:
-                            // Fall through
-                        case ModbusServerType::Uint16:
-                            uint32_Value = (uint32_t)server->context.readBuffer[0];
-                            uint32_Value &= safeConfig.mask;
-                            uint32_Value >>= safeConfig.shift;
-                            if (safeConfig.signedInt && (uint32_Value & safeConfig.negativeTest))
-                            {
-                                uint32_Value |= safeConfig.signExtend;
-                            }
-                            break;
-
-                        case ModbusServerType::Int32:
-                            // Fall through
-                        case ModbusServerType::Uint32:
-                            uint32_Value = ModbusClient::wordsToDword(server->context.readBuffer[0], server->context.readBuffer[1]);
-                            break;
+                        ModbusPoint point {};
+                        strlcpy(point.name, name, sizeof(point.name));
+                        modbusLegacyPoint(it.value(), point);
+                        modbusPointDerive(point);
+
+                        const std::lock_guard<RecursiveMutex> lock(modbusPointsMutex);
+                        modbusPoints.append(point);
+                        converted++;
+                        moved = true;
                     }
                 }
-
-                double sensorValue {};
-                if (safeConfig.isFloat)
-                {
-                    sensorValue = (double)ModbusClient::wordsToFloat(server->context.readBuffer[0], server->context.readBuffer[1], safeConfig.endian);
-                }
-                else if (safeConfig.signedInt)
-                {
-                    sensorValue = (double)((int32_t)uint32_Value);
-                }
-                else
-                {
-                    sensorValue = (double)uint32_Value;
-                }
-
-                sensorValue = sensorValue * safeConfig.scale + safeConfig.offset;
-
-                ModbusPublish publishMe {};
-                publishMe.name = server->name;
-                publishMe.value = sensorValue;
-                publishMe.result = result;
-                resultsToPublish.append(publishMe);
             }
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            delete[] buffer;
         }
 
-        if (!resultsToPublish.isEmpty() && ((System.uptime() != publishTick)))
+        if (!moved)
         {
-            publishTick = System.uptime();
-            static char publish1[1024] = {};
-            memset(publish1, 0, sizeof(publish1));
-            JSONBufferWriter toPublish(publish1, sizeof(publish1));
-            toPublish.beginObject();
-            toPublish.name("modbus").beginArray();
+            monitorOneLog.warn("Unable to convert legacy %s settings", name);
+        }
+        removable[n - 1] = moved;
+    }
 
-            for (auto client: resultsToPublish)
-            {
-                toPublish.beginObject().name("name").value(client.name);
-                toPublish.name("result").value((unsigned long)client.result);
-                if (modbusRtu.ku8MBSuccess == client.result)
-                {
-                    toPublish.name("value").value(client.value);
-                }
-                toPublish.endObject();
-            }
-            toPublish.endArray().endObject();
-            resultsToPublish.clear();
-            if (Particle.connected())
-                Particle.publish("modbus", publish1);
+    if (converted)
+    {
+        monitorOneLog.info("Converted %d legacy Modbus servers to points", converted);
+        {
+            const std::lock_guard<RecursiveMutex> lock(modbusPointsMutex);
+            modbusPointsGeneration++;
+        }
+        // Values were written directly so the module must be rehashed, saved, and synchronized
+        ConfigService::instance().markChanged("modbus");
+        // The legacy files are the only copy until the converted table is on file
+        auto error = ConfigService::instance().save("modbus", true);
+        if (error)
+        {
+            monitorOneLog.error("Unable to save converted Modbus points: %d", error);
+            return converted;
         }
-        // Play fair and let other threads execute
-        os_thread_yield();
     }
 
-    // It is safe to exit here with Thread::run properly handling OS thread exit
+    for (int n = 1; n <= MODBUS_LEGACY_MODULES; n++)
+    {
+        if (removable[n - 1])
+        {
+            monitorOneLog.info("Removing legacy modbus%d settings", n);
+            unlink(String(CONFIG_SERVICE_FS_PATH) + "/modbus" + n + ".cfg");
+        }
+    }
+
+    return converted;
 }
 
+
 /**
- * @brief Initializes the Modbus settings and polling thread
+ * @brief Offset of a point's deadlines within its poll interval
  *
- * @return int Zero (success) always
+ * @details Without an explicit phase, server IDs are spread across the interval so that servers
+ * polled at the same rate don't all fire together, while points on the same server stay aligned
+ * and can still be merged into block reads.
+ *
+ * @param point Point to schedule
+ * @return uint32_t Offset in milliseconds
  */
-int modbusInit()
+static uint32_t modbusPointPhase(const ModbusPoint& point)
 {
-    buildModbusRtuSettings();
-
-    //for loop for instances
-    for (int i = 1; i <= MODBUS_CLIENT_COUNT;i++)
+    if (point.phase)
     {
-        buildModbusSettings(i);
+        return point.phase % point.pollInterval;
     }
 
-    if (nullptr == modbusThread)
-    {
-        modbusThread = new Thread("modbus", modbusThreadLoop, nullptr, OS_THREAD_PRIORITY_DEFAULT, 2*1024);
+    auto slot = (point.id * 7U) % MODBUS_PHASE_SLOTS;
+    return (uint32_t)(((uint64_t)point.pollInterval * slot) / MODBUS_PHASE_SLOTS);
+}
+
+/**
+ * @brief Find the first deadline for a point that falls after the given time
+ *
+ * @details Deadlines are aligned to the start of the schedule so missed polls are skipped
+ * rather than bunched up.
+ *
+ * @param point Point to schedule
+ * @param now Current time in milliseconds
+ * @return uint64_t Deadline in milliseconds
+ */
+static uint64_t modbusNextDeadline(const ModbusPoint& point, uint64_t now)
+{
+    auto start = modbusScheduleEpoch + modbusPointPhase(point);
+    if (now < start)
+    {
+        return start;
+    }
+    return start + ((now - start) / point.pollInterval + 1) * point.pollInterval;
+}
+
+static bool modbusScheduleCompare(const ModbusScheduleEntry& a, const ModbusScheduleEntry& b)
+{
+    // Order the heap with the earliest deadline at the front
+    return a.due > b.due;
+}
+
+/**
+ * @brief Build the deadline heap for a bus from the current point table
+ *
+ * @param bus Bus to schedule
+ * @param now Current time in milliseconds
+ * @return uint32_t Generation of the point table that was scheduled
+ */
+static uint32_t modbusScheduleRebuild(ModbusBus& bus, uint64_t now)
+{
+    const std::lock_guard<RecursiveMutex> lock(modbusPointsMutex);
+
+    bus.schedule.clear();
+    for (auto& report: bus.reports)
+    {
+        delete report.comparator;
+    }
+    bus.reports.clear();
+
+    for (int i = 0; i < modbusPoints.size(); i++)
+    {
+        auto& point = modbusPoints[i];
+        auto owned = (bus.index == point.bus);
+        if (owned && point.enabled && point.pollInterval)
+        {
+            bus.schedule.append({modbusNextDeadline(point, now), i});
+        }
+
+        // Keep one entry per point so the table index can be used directly
+        ModbusReportState report {};
+        report.thresholdState = ThresholdState::Initial;
+        if (owned && (ModbusServerPublish::OnThreshold == point.publish) && point.thresholdEnable)
+        {
+            report.comparator = new ThresholdComparator<float>(point.threshold, point.hysteresis);
+        }
+        bus.reports.append(report);
+    }
+    std::make_heap(bus.schedule.begin(), bus.schedule.end(), modbusScheduleCompare);
+
+    return modbusPointsGeneration;
+}
+
+/**
+ * @brief Determine whether the given function reads single bits rather than registers
+ *
+ * @param function Modbus read function
+ * @return true Function reads coils or discrete inputs
+ * @return false Function reads input or holding registers
+ */
+static bool modbusIsBitFunction(ModbusServerFunction function)
+{
+    return (ModbusServerFunction::Coil == function) || (ModbusServerFunction::DiscreteInput == function);
+}
+
+/**
+ * @brief Group due points into as few read requests as possible
+ *
+ * @details Points are sorted by server ID, function, and address.  Neighbouring points on the same
+ * server and function are merged into one request when the gap between them is small and the
+ * merged request stays within the Modbus PDU limits.
+ *
+ * @param due Points that are due to be polled, sorted in place
+ * @param blocks Resulting read requests
+ */
+static void modbusPlanReads(Vector<ModbusDuePoint>& due, Vector<ModbusReadBlock>& blocks)
+{
+    std::sort(due.begin(), due.end(), [](const ModbusDuePoint& a, const ModbusDuePoint& b) {
+        if (a.config.id != b.config.id) {
+            return a.config.id < b.config.id;
+        }
+        if (a.config.function != b.config.function) {
+            return a.config.function < b.config.function;
+        }
+        return a.config.address < b.config.address;
+    });
+
+    blocks.clear();
+    for (int i = 0; i < due.size(); i++)
+    {
+        auto& point = due[i];
+        auto pointEnd = point.config.address + point.config.readLength;
+
+        if (!blocks.isEmpty() && !point.config.isolate)
+        {
+            auto& block = blocks.last();
+            auto& blockFirst = due[block.first];
+            auto isBits = modbusIsBitFunction(block.function);
+            auto gapMax = isBits ? MODBUS_BIT_GAP_MAX : MODBUS_REGISTER_GAP_MAX;
+            auto readMax = isBits ? MODBUS_BIT_READ_MAX : MODBUS_REGISTER_READ_MAX;
+            auto blockEnd = block.address + block.quantity;
+            auto mergedEnd = std::max<unsigned int>(blockEnd, pointEnd);
+
+            if (!blockFirst.config.isolate &&
+                (block.id == point.config.id) &&
+                (block.function == point.config.function) &&
+                (point.config.address <= blockEnd + gapMax) &&
+                ((mergedEnd - block.address) <= readMax))
+            {
+                block.quantity = (uint16_t)(mergedEnd - block.address);
+                block.timeout = std::max(block.timeout, point.config.timeout);
+                block.count++;
+                continue;
+            }
+        }
+
+        ModbusReadBlock block {};
+        block.id = point.config.id;
+        block.function = point.config.function;
+        block.address = point.config.address;
+        block.quantity = point.config.readLength;
+        block.timeout = point.config.timeout;
+        block.first = i;
+        block.count = 1;
+        blocks.append(block);
+    }
+}
+
+/**
+ * @brief Find the statistics for a server, adding them if the server is new
+ *
+ * @param bus Bus that the server is on
+ * @param id Modbus server ID
+ * @return ModbusServerStats* Statistics for the server, null if too many servers are tracked
+ */
+static ModbusServerStats* modbusServerStats(ModbusBus& bus, uint8_t id)
+{
+    for (auto& server: bus.servers)
+    {
+        if (id == server.id)
+        {
+            return &server;
+        }
+    }
+    if ((bus.servers.size() >= (int)MODBUS_SERVER_STATS_MAX) || !bus.servers.append({id, ModbusStats()}))
+    {
+        return nullptr;
+    }
+    return &bus.servers.last();
+}
+
+/**
+ * @brief Count the outcome and response time of a transaction
+ *
+ * @param bus Bus that carried the transaction
+ * @param id Modbus server ID
+ * @param result ModbusClient result code
+ * @param time Duration of the transaction in microseconds
+ */
+static void modbusRecordTransaction(ModbusBus& bus, uint8_t id, uint8_t result, uint32_t time)
+{
+    const std::lock_guard<RecursiveMutex> lock(modbusStatsMutex);
+
+    bus.stats.record(result, time);
+    bus.busyTime += time;
+    auto server = modbusServerStats(bus, id);
+    if (server)
+    {
+        server->stats.record(result, time);
+    }
+}
+
+/**
+ * @brief Write transaction counters and response times
+ *
+ * @param writer Destination for the statistics
+ * @param stats Statistics to write
+ */
+static void modbusWriteStats(JSONWriter& writer, const ModbusStats& stats)
+{
+    writer.name("req").value((unsigned int)stats.requests);
+    writer.name("to").value((unsigned int)stats.timeouts);
+    writer.name("crc").value((unsigned int)stats.crcErrors);
+    writer.name("inv").value((unsigned int)stats.invalid);
+    writer.name("exc").value((unsigned int)stats.exceptions);
+    writer.name("p50").value((unsigned int)stats.latency.percentile(50));
+    writer.name("p95").value((unsigned int)stats.latency.percentile(95));
+    writer.name("max").value((unsigned int)stats.latency.max());
+}
+
+/**
+ * @brief Write the health of a bus
+ *
+ * @param writer Destination for the statistics
+ * @param bus Bus to write
+ * @param now Current time in milliseconds
+ */
+static void modbusWriteBusStats(JSONWriter& writer, const ModbusBus& bus, uint64_t now)
+{
+    double utilization {0.0};
+    if (now > bus.statsStart)
+    {
+        utilization = (double)bus.busyTime / 10.0 / (double)(now - bus.statsStart);
+    }
+    writer.name("bus").value((unsigned int)bus.index);
+    modbusWriteStats(writer, bus.stats);
+    writer.name("util").value(std::min(utilization, 100.0), 1);
+}
+
+/**
+ * @brief Discard the statistics of every bus and server
+ */
+static void modbusResetStats()
+{
+    const std::lock_guard<RecursiveMutex> lock(modbusStatsMutex);
+
+    auto now = System.millis();
+    for (auto& bus: modbusBuses)
+    {
+        bus.stats.reset();
+        bus.servers.clear();
+        bus.busyTime = 0;
+        bus.statsStart = now;
+    }
+}
+
+/**
+ * @brief Cloud command to publish the health of each bus and server
+ *
+ * @details Send {"cmd":"modbus_stats"} to receive the statistics.  Add "reset":true to clear them
+ * once they are published.
+ *
+ * @param root Command object
+ * @return int Zero on success, or a negative error code if the statistics couldn't be sent
+ */
+static int modbusStatsCommand(JSONValue* root)
+{
+    bool reset {false};
+    JSONObjectIterator it(*root);
+    while (it.next())
+    {
+        if (it.name() == "reset")
+        {
+            reset = it.value().toBool();
+        }
+    }
+
+    auto& cloud = CloudService::instance();
+    int ret {0};
+    {
+        const std::lock_guard<RecursiveMutex> lock(modbusStatsMutex);
+        auto now = System.millis();
+
+        cloud.beginCommand(MODBUS_STATS_COMMAND);
+        auto& writer = cloud.writer();
+        writer.name(MODBUS_STATS_COMMAND).beginArray();
+        for (auto& bus: modbusBuses)
+        {
+            writer.beginObject();
+            modbusWriteBusStats(writer, bus, now);
+            writer.name("servers").beginArray();
+            for (auto& server: bus.servers)
+            {
+                // Leave the remaining servers out rather than overflow the event
+                if ((writer.dataSize() + MODBUS_STATS_SERVER_SIZE) >= writer.bufferSize())
+                {
+                    break;
+                }
+                writer.beginObject().name("id").value((unsigned int)server.id);
+                modbusWriteStats(writer, server.stats);
+                writer.name("codes").beginObject();
+                for (size_t code = 1; code < ModbusStats::ExceptionCodeCount; code++)
+                {
+                    if (server.stats.exceptionCodes[code])
+                    {
+                        char name[4];
+                        snprintf(name, sizeof(name), "%u", (unsigned int)code);
+                        writer.name(name).value((unsigned int)server.stats.exceptionCodes[code]);
+                    }
+                }
+                writer.endObject().endObject();
+            }
+            writer.endArray().endObject();
+        }
+        writer.endArray();
+        ret = cloud.send();
+    }
+
+    if (reset && (0 == ret))
+    {
+        modbusResetStats();
+    }
+    return ret;
+}
+
+/**
+ * @brief Find the responsiveness of a server, adding it if the server is new
+ *
+ * @param bus Bus that the server is on
+ * @param id Modbus server ID
+ * @return ModbusServerHealth* Responsiveness of the server, null if too many servers are tracked
+ */
+static ModbusServerHealth* modbusServerHealth(ModbusBus& bus, uint8_t id)
+{
+    for (auto& server: bus.health)
+    {
+        if (id == server.id)
+        {
+            return &server;
+        }
+    }
+
+    ModbusServerHealth server {};
+    server.id = id;
+    if ((bus.health.size() >= (int)MODBUS_SERVER_STATS_MAX) || !bus.health.append(server))
+    {
+        return nullptr;
+    }
+    return &bus.health.last();
+}
+
+/**
+ * @brief Choose the response timeout for a request to a server
+ *
+ * @details Once enough responses have been seen, the timeout is a multiple of the server's 99th
+ * percentile response time, never longer than the configured timeout.  A request that follows a
+ * learned timeout expiring waits for the configured timeout in case the server has slowed down.
+ *
+ * @param health Responsiveness of the server, if known
+ * @param configured Timeout configured for the points being read in milliseconds
+ * @return system_tick_t Timeout in milliseconds
+ */
+static system_tick_t modbusResponseTimeout(const ModbusServerHealth* health, uint16_t configured)
+{
+    if (!health || health->widen || (health->latency.count() < MODBUS_TIMEOUT_SAMPLES))
+    {
+        return configured;
+    }
+
+    auto learned = health->latency.percentile(99) * MODBUS_TIMEOUT_FACTOR + MODBUS_TIMEOUT_MARGIN;
+    learned = std::max(learned, MODBUS_TIMEOUT_MIN);
+    return std::min<uint32_t>(learned, configured);
+}
+
+/**
+ * @brief Update the responsiveness of a server after a transaction
+ *
+ * @details Servers that fail several times in a row are held back with an exponentially
+ * growing wait.  Once the wait passes, a single request probes the server and a response
+ * resumes normal polling.
+ *
+ * @param bus Bus that the server is on
+ * @param health Responsiveness of the server
+ * @param result ModbusClient result code
+ * @param time Duration of the transaction in microseconds
+ */
+static void modbusUpdateHealth(ModbusBus& bus, ModbusServerHealth& health, uint8_t result, uint32_t time)
+{
+    auto responded = (ModbusClient::ku8MBResponseTimedOut != result) &&
+        (ModbusClient::ku8MBInvalidCRC != result) &&
+        (ModbusClient::ku8MBInvalidSlaveID != result) &&
+        (ModbusClient::ku8MBInvalidFunction != result);
+
+    if (responded)
+    {
+        if (health.open)
+        {
+            monitorOneLog.info("Modbus server %u on bus %u is responding again", health.id, bus.index);
+        }
+        health.latency.record((time + 500) / 1000);
+        health.failures = 0;
+        health.open = false;
+        health.widen = false;
+        return;
+    }
+
+    health.widen = (ModbusClient::ku8MBResponseTimedOut == result);
+    health.failures++;
+    if (health.failures >= MODBUS_BREAKER_FAILURES)
+    {
+        auto doublings = std::min<unsigned int>(health.failures - MODBUS_BREAKER_FAILURES, 16);
+        auto backoff = std::min<uint64_t>(MODBUS_BACKOFF_BASE << doublings, MODBUS_BACKOFF_MAX);
+        if (!health.open)
+        {
+            monitorOneLog.warn("Modbus server %u on bus %u isn't responding, backing off", health.id, bus.index);
+        }
+        health.open = true;
+        health.retryTick = System.millis() + backoff;
+    }
+}
+
+/**
+ * @brief Make sure the transport for a bus is able to carry requests
+ *
+ * @param bus Bus about to be polled
+ * @return true Requests can be sent
+ * @return false The bus isn't configured or its connection couldn't be opened
+ */
+static bool modbusBusReady(ModbusBus& bus)
+{
+    if (MODBUS_BUS_TCP != bus.index)
+    {
+        if (bus.reconnect)
+        {
+            bus.reconnect = false;
+            ModbusSettings settings {};
+            {
+                const std::lock_guard<RecursiveMutex> lock(modbusPointsMutex);
+                memcpy(&settings, &modbusRtuSettings, sizeof(settings));
+            }
+            modbusChangeInterfaceSettings(settings);
+        }
+        return true;
+    }
+
+    if (bus.reconnect)
+    {
+        bus.reconnect = false;
+        modbusTcpClient.stop();
+    }
+    if (modbusTcpClient.connected())
+    {
+        return true;
+    }
+
+    ModbusTcpSettings settings {};
+    {
+        const std::lock_guard<RecursiveMutex> lock(modbusPointsMutex);
+        memcpy(&settings, &modbusTcpSettings, sizeof(settings));
+    }
+    if (!settings.host[0] || !Network.ready())
+    {
+        return false;
+    }
+
+    // Only this worker is held up while the connection is opened
+    if (!modbusTcpClient.connect(settings.host, (uint16_t)settings.port))
+    {
+        monitorOneLog.warn("Unable to connect to Modbus gateway %s:%d", settings.host, (int)settings.port);
+        return false;
+    }
+    return true;
+}
+
+static uint64_t modbusServicePublish(uint64_t now);
+
+/**
+ * @brief Issue the read request for a block of points
+ *
+ * @details The request is driven through the client's transaction state machine so that the
+ * worker can publish results while it waits and give up on the request when the bus settings
+ * change.
+ *
+ * @param bus Bus that the points are on
+ * @param block Read request to issue
+ * @return uint8_t ModbusClient result code
+ */
+static uint8_t modbusReadBlock(ModbusBus& bus, const ModbusReadBlock& block)
+{
+    uint8_t result {ModbusClient::ku8MBIllegalFunction};
+
+    auto health = modbusServerHealth(bus, block.id);
+    if (health && health->open && (System.millis() < health->retryTick))
+    {
+        // Don't spend bus time on a server that isn't answering
+        return ModbusClient::ku8MBResponseTimedOut;
+    }
+
+    if (!modbusBusReady(bus))
+    {
+        return ModbusClient::ku8MBResponseTimedOut;
+    }
+
+    bus.client.setResponseTimeout(modbusResponseTimeout(health, block.timeout));
+
+    auto type {ModbusType::Unknown};
+    switch (block.function)
+    {
+        case ModbusServerFunction::Coil:
+            type = ModbusType::Coil;
+            break;
+        case ModbusServerFunction::DiscreteInput:
+            type = ModbusType::DiscreteInput;
+            break;
+        case ModbusServerFunction::InputRegister:
+            type = ModbusType::InputRegister;
+            break;
+        case ModbusServerFunction::HoldingRegister:
+            type = ModbusType::HoldingRegister;
+            break;
+    }
+
+    if (!bus.client.beginRead(block.id, type, block.address, block.quantity, bus.context))
+    {
+        return result;
+    }
+
+    // Stay with the transaction until it completes so that the measured response time is the
+    // server's alone and the receive buffer is drained in time.  Results are published between
+    // transactions by the worker loop.
+    while (bus.client.poll())
+    {
+        if (bus.reconnect)
+        {
+            // The response can't arrive on a port or connection that is about to be reopened, and
+            // the server isn't to blame for it
+            bus.client.cancel();
+            return ModbusClient::ku8MBResponseTimedOut;
+        }
+        // The port has no receive notification so check again shortly, or as soon as the bus
+        // settings change.  A point table change taken here is picked up by the worker loop.
+        uint8_t wakeEvent {};
+        os_queue_take(bus.wakeQueue, &wakeEvent, MODBUS_RX_POLL_INTERVAL, nullptr);
+    }
+    result = bus.client.status();
+
+    auto time = bus.client.getTransactionTime();
+    modbusRecordTransaction(bus, block.id, result, time);
+    if (health)
+    {
+        modbusUpdateHealth(bus, *health, result, time);
+    }
+
+    return result;
+}
+
+/**
+ * @brief Collect a run of bits from a coil or discrete input response
+ *
+ * @param context Transaction buffers holding the response
+ * @param offset Bit offset from the start of the response
+ * @param length Number of bits to collect, up to 16
+ * @return uint16_t Bits packed least significant first, as if they were read on their own
+ */
+static uint16_t modbusExtractBits(const ModbusClientContext& context, unsigned int offset, unsigned int length)
+{
+    uint16_t word {};
+    for (unsigned int bit = 0; bit < length; bit++)
+    {
+        auto position = offset + bit;
+        if (context.readBuffer[position / 16] & (1U << (position % 16)))
+        {
+            word |= (1U << bit);
+        }
+    }
+    return word;
+}
+
+/**
+ * @brief Convert raw words read for a point to a scaled value
+ *
+ * @param config Point configuration
+ * @param word0 First word read for the point
+ * @param word1 Second word read for the point, if any
+ * @return double Scaled value
+ */
+static double modbusDecodeValue(const ModbusPoint& config, uint16_t word0, uint16_t word1)
+{
+    uint32_t uint32_Value {};
+
+    switch (config.type)
+    {
+        case ModbusServerType::Int16:
+            // Fall through
+        case ModbusServerType::Bits:
+            // Fall through
+        case ModbusServerType::Uint16:
+            uint32_Value = (uint32_t)word0;
+            uint32_Value &= config.mask;
+            uint32_Value >>= config.shift;
+            if (config.signedInt && (uint32_Value & config.negativeTest))
+            {
+                // Extend the sign bit through the upper bits
+                uint32_Value |= UINT32_MAX << __builtin_ctz(config.negativeTest);
+            }
+            break;
+
+        case ModbusServerType::Int32:
+            // Fall through
+        case ModbusServerType::Uint32:
+            uint32_Value = ModbusClient::wordsToDword(word0, word1);
+            break;
+    }
+
+    double sensorValue {};
+    if (config.isFloat)
+    {
+        sensorValue = (double)ModbusClient::wordsToFloat(word0, word1, config.endian);
+    }
+    else if (config.signedInt)
+    {
+        sensorValue = (double)((int32_t)uint32_Value);
+    }
+    else
+    {
+        sensorValue = (double)uint32_Value;
+    }
+
+    return sensorValue * config.scale + config.offset;
+}
+
+/**
+ * @brief Decide whether a polled value should be reported
+ *
+ * @details Points that publish on threshold are reported when the read result changes, the value
+ * moves past the deadband from the last report, or the value crosses the threshold.  Reports are
+ * held back until the minimum interval has passed and are forced once the maximum interval passes.
+ * Without a deadband or threshold, any change in value is reported.
+ *
+ * @param bus Bus that the point is on
+ * @param due Point that was polled
+ * @param value Scaled value
+ * @param result ModbusClient result code
+ * @param now Current time in milliseconds
+ * @return true Report the value
+ * @return false Suppress the value
+ */
+static bool modbusShouldReport(ModbusBus& bus, const ModbusDuePoint& due, double value, uint8_t result, uint64_t now)
+{
+    if ((ModbusServerPublish::OnThreshold != due.config.publish) || (due.index >= bus.reports.size()))
+    {
+        return true;
+    }
+
+    auto& point = due.config;
+    auto& report = bus.reports[due.index];
+    auto success = (ModbusClient::ku8MBSuccess == result);
+
+    if (!report.reported || (result != report.result))
+    {
+        report.pending = true;
+    }
+    else if (success)
+    {
+        auto delta = fabs(value - report.value);
+        if ((point.deadband > 0.0f) && (delta >= point.deadband))
+        {
+            report.pending = true;
+        }
+        if ((point.deadbandPercent > 0.0f) && (delta > 0.0) &&
+            (delta >= (fabs(report.value) * point.deadbandPercent / 100.0)))
+        {
+            report.pending = true;
+        }
+        if ((point.deadband <= 0.0f) && (point.deadbandPercent <= 0.0f) && !report.comparator && (delta > 0.0))
+        {
+            report.pending = true;
+        }
+    }
+
+    if (success && report.comparator)
+    {
+        auto state = report.comparator->evaluate((float)value);
+        if (state != report.thresholdState)
+        {
+            report.thresholdState = state;
+            report.pending = true;
+        }
+    }
+
+    auto elapsed = now - report.reportTick;
+    auto heartbeat = report.reported && point.publishMax && (elapsed >= point.publishMax);
+    auto ready = report.pending && (!report.reported || (elapsed >= point.publishMin));
+
+    if (!heartbeat && !ready)
+    {
+        return false;
+    }
+
+    report.value = value;
+    report.result = result;
+    report.reportTick = now;
+    report.reported = true;
+    report.pending = false;
+
+    return true;
+}
+
+/**
+ * @brief Read a block and fan the response out to each point it serves
+ *
+ * @details If a merged block is rejected because it spans an address the server does not
+ * implement, each point in the block is read on its own and excluded from future merges.
+ *
+ * @param bus Bus that the points are on
+ * @param block Read request to issue
+ * @param due Points that are due to be polled
+ */
+static void modbusPollBlock(ModbusBus& bus, const ModbusReadBlock& block, Vector<ModbusDuePoint>& due)
+{
+    auto result = modbusReadBlock(bus, block);
+
+    if ((ModbusClient::ku8MBIllegalDataAddress == result) && (block.count > 1))
+    {
+        for (int i = block.first; i < (block.first + block.count); i++)
+        {
+            auto& point = due[i];
+            point.config.isolate = true;
+            {
+                const std::lock_guard<RecursiveMutex> lock(modbusPointsMutex);
+                if (point.index < modbusPoints.size())
+                {
+                    modbusPoints[point.index].isolate = true;
+                }
+            }
+
+            ModbusReadBlock single {};
+            single.id = block.id;
+            single.function = block.function;
+            single.address = point.config.address;
+            single.quantity = point.config.readLength;
+            single.timeout = point.config.timeout;
+            single.first = i;
+            single.count = 1;
+            modbusPollBlock(bus, single, due);
+        }
+        return;
+    }
+
+    for (int i = block.first; i < (block.first + block.count); i++)
+    {
+        auto& point = due[i];
+        unsigned int offset = point.config.address - block.address;
+
+        uint16_t word0 {};
+        uint16_t word1 {};
+        if (modbusIsBitFunction(block.function))
+        {
+            word0 = modbusExtractBits(bus.context, offset, point.config.readLength);
+        }
+        else
+        {
+            word0 = bus.context.readBuffer[offset];
+            word1 = (point.config.readLength > 1) ? bus.context.readBuffer[offset + 1] : 0;
+        }
+
+        auto value = modbusDecodeValue(point.config, word0, word1);
+        auto now = System.millis();
+        if (!modbusShouldReport(bus, point, value, result, now))
+        {
+            continue;
+        }
+
+        ModbusPublish publishMe {};
+        if (point.config.name[0])
+        {
+            strlcpy(publishMe.name, point.config.name, sizeof(publishMe.name));
+        }
+        else
+        {
+            snprintf(publishMe.name, sizeof(publishMe.name), "modbus%d", point.index + 1);
+        }
+        publishMe.value = value;
+        publishMe.tick = now;
+        publishMe.result = result;
+        const std::lock_guard<RecursiveMutex> lock(modbusResultsMutex);
+        resultsToPublish.append(publishMe);
+    }
+}
+
+/**
+ * @brief Store an event on disk to be sent later, alongside stored location publishes
+ *
+ * @param data Event data
+ */
+static void modbusSpill(const char* data)
+{
+    if (!EdgeLocationPublish::instance().store(StoreLane::MODBUS, data))
+    {
+        monitorOneLog.warn("Unable to store Modbus results, discarding");
+    }
+}
+
+/**
+ * @brief Cloud service callback to store events that failed to send
+ *
+ * @param status Status of the publish
+ * @param data Event data
+ * @return int Zero (success) always
+ */
+static int modbusSendCallback(CloudServiceStatus status, String&& data)
+{
+    if (CloudServiceStatus::SUCCESS != status)
+    {
+        modbusSpill(data.c_str());
+    }
+    return 0;
+}
+
+/**
+ * @brief Send an event in the background, or store it on disk if it can't be sent now
+ *
+ * @param data Event data
+ */
+static void modbusSend(const char* data)
+{
+    if (!Particle.connected() ||
+        CloudService::instance().send(data,
+            WITH_ACK,
+            CloudServicePublishFlags::NONE,
+            modbusSendCallback,
+            CLOUD_DEFAULT_TIMEOUT_MS,
+            MODBUS_EVENT_NAME,
+            0,
+            MODBUS_PUBLISH_PRIORITY))
+    {
+        modbusSpill(data);
+    }
+}
+
+/**
+ * @brief Write a single result in compact form
+ *
+ * @param writer Destination for the result
+ * @param result Result to write
+ * @param base Poll time that the result's time is relative to, in milliseconds
+ */
+static void modbusWriteResult(JSONWriter& writer, const ModbusPublish& result, uint64_t base)
+{
+    writer.beginObject().name("n").value(result.name);
+    if (ModbusClient::ku8MBSuccess == result.result)
+    {
+        writer.name("v").value(result.value);
+    }
+    else
+    {
+        writer.name("r").value((unsigned int)result.result);
+    }
+    writer.name("d").value((unsigned int)(result.tick - base));
+    writer.endObject();
+}
+
+/**
+ * @brief Start a new event with the time of its first result
+ *
+ * @param writer Destination for the event
+ * @param base Poll time of the first result in the event, in milliseconds
+ */
+static void modbusBeginEvent(JSONBufferWriter& writer, uint64_t base)
+{
+    // Results carry their offset from the first result in milliseconds
+    unsigned int time {0};
+    if (Time.isValid())
+    {
+        time = (unsigned int)(Time.now() - (time_t)((System.millis() - base) / 1000));
+    }
+    writer.beginObject().name("t").value(time);
+    writer.name("modbus").beginArray();
+}
+
+/**
+ * @brief Pack as many pending results as fit into one event and send it
+ *
+ * @param results Results taken for publishing
+ * @param first Index of the first result to pack
+ * @param limit Largest event size allowed
+ * @return int Index of the first result that didn't fit
+ */
+static int modbusPackEvent(const Vector<ModbusPublish>& results, int first, size_t limit)
+{
+    JSONBufferWriter event(modbusEventBuffer, sizeof(modbusEventBuffer) - 1);
+    auto base = results[first].tick;
+    modbusBeginEvent(event, base);
+
+    int next = first;
+    for (; next < results.size(); next++)
+    {
+        // Measure the result before committing it to the event
+        char item[MODBUS_PUBLISH_ITEM_SIZE];
+        JSONBufferWriter itemWriter(item, sizeof(item));
+        modbusWriteResult(itemWriter, results[next], base);
+        auto needed = event.dataSize() + ((next > first) ? 1 : 0) + itemWriter.dataSize() + MODBUS_PUBLISH_CLOSE_SIZE;
+        if ((needed > limit) && (next > first))
+        {
+            break;
+        }
+        modbusWriteResult(event, results[next], base);
+    }
+    event.endArray().endObject();
+
+    if (event.dataSize() < event.bufferSize())
+    {
+        modbusEventBuffer[event.dataSize()] = '\0';
+        modbusSend(modbusEventBuffer);
+    }
+    return next;
+}
+
+/**
+ * @brief Pack pending results into as few events as possible and send them
+ *
+ * @details Events are filled up to the largest size the cloud connection allows.  A result that
+ * would overflow the current event starts a new one.
+ *
+ * @param results Results taken for publishing
+ */
+static void modbusPublishResults(const Vector<ModbusPublish>& results)
+{
+    size_t limit = sizeof(modbusEventBuffer) - 1;
+    auto maxEventDataSize = Particle.maxEventDataSize();
+    if (maxEventDataSize > 0)
+    {
+        limit = std::min(limit, (size_t)maxEventDataSize);
+    }
+
+    for (int next = 0; next < results.size();)
+    {
+        next = modbusPackEvent(results, next, limit);
+    }
+}
+
+/**
+ * @brief Publish pending results once the publish interval passes
+ *
+ * @details Called by every bus worker.  The first worker to find the interval expired takes the
+ * results collected from all buses and publishes them after releasing the lock, so that sending or
+ * storing them never holds up other workers adding results.  Only one worker publishes at a time.
+ *
+ * @param now Current time in milliseconds
+ * @return uint64_t Time the waiting results are next due to be published in milliseconds, or
+ * UINT64_MAX if nothing is waiting
+ */
+static uint64_t modbusServicePublish(uint64_t now)
+{
+    Vector<ModbusPublish> results;
+    {
+        const std::lock_guard<RecursiveMutex> lock(modbusResultsMutex);
+        if (!modbusPublishing && !resultsToPublish.isEmpty() && ((now - publishTick) >= MODBUS_PUBLISH_INTERVAL))
+        {
+            publishTick = now;
+            modbusPublishing = true;
+            std::swap(results, resultsToPublish);
+        }
+    }
+
+    if (!results.isEmpty())
+    {
+        modbusPublishResults(results);
+
+        const std::lock_guard<RecursiveMutex> lock(modbusResultsMutex);
+        modbusPublishing = false;
+    }
+
+    // The publish time is shared by every worker so it is only read under the lock
+    const std::lock_guard<RecursiveMutex> lock(modbusResultsMutex);
+    if (resultsToPublish.isEmpty())
+    {
+        return UINT64_MAX;
+    }
+    if (modbusPublishing)
+    {
+        // The worker that is publishing picks the new results up on its next pass
+        return std::max(publishTick, now) + MODBUS_PUBLISH_INTERVAL;
+    }
+    return publishTick + MODBUS_PUBLISH_INTERVAL;
+}
+
+/**
+ * @brief The worker that services all poll requests for one bus
+ *
+ * @param param Bus to service
+ */
+void modbusThreadLoop(void* param)
+{
+    auto& bus = *(ModbusBus*)param;
+    Vector<ModbusDuePoint> due;
+    Vector<ModbusReadBlock> blocks;
+
+    auto generation = modbusScheduleRebuild(bus, System.millis());
+
+    while (true)
+    {
+        auto now = System.millis();
+
+        // Collect every point that is due so that neighbouring points can share a request
+        due.clear();
+        {
+            const std::lock_guard<RecursiveMutex> lock(modbusPointsMutex);
+            if (generation != modbusPointsGeneration)
+            {
+                generation = modbusScheduleRebuild(bus, now);
+            }
+
+            while (!bus.schedule.isEmpty() && (bus.schedule.first().due <= now))
+            {
+                std::pop_heap(bus.schedule.begin(), bus.schedule.end(), modbusScheduleCompare);
+                auto& entry = bus.schedule.last();
+                auto& point = modbusPoints[entry.index];
+                due.append({entry.index, point});
+                entry.due = modbusNextDeadline(point, now);
+                std::push_heap(bus.schedule.begin(), bus.schedule.end(), modbusScheduleCompare);
+            }
+        }
+
+        if (!due.isEmpty())
+        {
+            modbusPlanReads(due, blocks);
+            for (auto& block: blocks)
+            {
+                modbusPollBlock(bus, block, due);
+            }
+        }
+
+        now = System.millis();
+        auto publishDue = modbusServicePublish(now);
+
+        // Sleep until the next deadline, a pending publish, or a configuration change
+        now = System.millis();
+        uint64_t wake = publishDue;
+        if (!bus.schedule.isEmpty())
+        {
+            wake = std::min(wake, bus.schedule.first().due);
+        }
+        if (wake > now)
+        {
+            system_tick_t timeout = (UINT64_MAX == wake) ? CONCURRENT_WAIT_FOREVER : (system_tick_t)std::min<uint64_t>(wake - now, INT32_MAX);
+            uint8_t wakeEvent {};
+            os_queue_take(bus.wakeQueue, &wakeEvent, timeout, nullptr);
+        }
+    }
+
+    // It is safe to exit here with Thread::run properly handling OS thread exit
+}
+
+/**
+ * @brief Initializes the Modbus settings and polling threads
+ *
+ * @return int Zero (success) always
+ */
+int modbusInit()
+{
+    for (size_t i = 0; i < MODBUS_BUS_COUNT; i++)
+    {
+        auto& bus = modbusBuses[i];
+        bus.index = (uint8_t)i;
+        if (!bus.wakeQueue)
+        {
+            os_queue_create(&bus.wakeQueue, sizeof(uint8_t), 1, nullptr);
+        }
+    }
+
+    buildModbusRtuSettings();
+
+    buildModbusTcpSettings();
+
+    buildModbusSettings();
+
+    modbusMigrateLegacySettings();
+
+    // All buses share one schedule origin so points keep their phase across buses
+    if (0 == modbusScheduleEpoch)
+    {
+        modbusScheduleEpoch = System.millis();
+        modbusResetStats();
+
+        CloudService::instance().registerCommand(MODBUS_STATS_COMMAND, modbusStatsCommand);
+        EdgeLocation::instance().regLocGenCallback(
+            [](JSONWriter& writer, LocationPoint& location, const void* nothing) {
+                const std::lock_guard<RecursiveMutex> lock(modbusStatsMutex);
+                auto now = System.millis();
+                auto active = std::any_of(std::begin(modbusBuses), std::end(modbusBuses),
+                    [](const ModbusBus& bus) {return bus.stats.requests > 0;});
+                if (!active)
+                {
+                    return;
+                }
+                writer.name("modbus_bus").beginArray();
+                for (auto& bus: modbusBuses)
+                {
+                    if (bus.stats.requests)
+                    {
+                        writer.beginObject();
+                        modbusWriteBusStats(writer, bus, now);
+                        writer.endObject();
+                    }
+                }
+                writer.endArray();
+            }
+        );
+    }
+
+    for (auto& bus: modbusBuses)
+    {
+        if (nullptr == bus.thread)
+        {
+            bus.thread = new Thread((MODBUS_BUS_TCP == bus.index) ? "modbus_tcp" : "modbus",
+                modbusThreadLoop, &bus, OS_THREAD_PRIORITY_DEFAULT, MODBUS_THREAD_STACK_SIZE);
+        }
     }
     return 0;
 }